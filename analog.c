@@ -0,0 +1,241 @@
+/**
+ * Analog (Hall-effect) key support. The ADC free-runs in round-robin mode over
+ * all four inputs and a pair of DMA channels copies the samples into a small
+ * buffer forever, so the scan loop only has to average what's already there.
+ *
+ * Each analog key has its own actuation and release points, plus optional
+ * 'rapid trigger': once pressed, lifting the key by rapid_trigger releases it
+ * (and pushing back down by the same amount presses it again) regardless of
+ * where in the travel that happens.
+ */
+#include "analog.h"
+
+#include <stdlib.h> // abs
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hotpath.h" // for HOT_PATH
+
+#define ANALOG_BUFFER_SIZE (ANALOG_CHANNELS * ANALOG_SAMPLES)
+#define ANALOG_NO_SAMPLE 0xffff // the ADC is 12 bit, so this can't be a reading
+
+typedef struct {
+  AnalogKey key;
+  bool enabled;
+  bool calibrated;
+} AnalogChannel;
+
+AnalogChannel channels[ANALOG_CHANNELS];
+
+// Sample i belongs to channel i % ANALOG_CHANNELS
+uint16_t samples[ANALOG_BUFFER_SIZE];
+uint16_t * samples_start = samples;
+
+int sample_dma = -1;
+int restart_dma = -1;
+
+void analog_key_config(AnalogKey *key, uint8_t actuation, uint8_t release, uint8_t rapid_trigger) {
+  // Release has to sit above rest and below actuation or the key can get stuck
+  if (actuation == 0)
+    actuation = 1;
+  if (release >= actuation)
+    release = actuation - 1;
+
+  key->actuation = actuation;
+  key->release = release;
+  key->rapid_trigger = rapid_trigger;
+}
+
+void analog_key_calibrate(AnalogKey *key, uint16_t rest) {
+  key->rest = rest;
+  key->bottom = rest;
+  key->extreme = 0;
+  key->pressed = false;
+}
+
+uint8_t HOT_PATH(analog_key_travel)(AnalogKey *key, uint16_t raw) {
+  // Sensors can read up or down as the magnet approaches, so work in distance
+  // from rest, and let the range grow to the furthest reading we've seen
+  int distance = abs((int) raw - key->rest);
+  int range = abs((int) key->bottom - key->rest);
+
+  if (distance > range) {
+    key->bottom = raw;
+    range = distance;
+  }
+
+  if (range < ANALOG_MIN_RANGE)
+    range = ANALOG_MIN_RANGE;
+
+  int travel = distance * ANALOG_TRAVEL_MAX / range;
+  return travel > ANALOG_TRAVEL_MAX ? ANALOG_TRAVEL_MAX : travel;
+}
+
+bool HOT_PATH(analog_key_update)(AnalogKey *key, uint8_t travel) {
+  if (key->pressed) {
+    if (travel > key->extreme)
+      key->extreme = travel;
+
+    if (travel <= key->release ||
+        (key->rapid_trigger && travel + key->rapid_trigger <= key->extreme)) {
+      key->pressed = false;
+      key->extreme = travel;
+    }
+  } else {
+    if (travel < key->extreme)
+      key->extreme = travel;
+
+    // After a rapid trigger release the key is still part way down, and
+    // pushing back down re-presses it anywhere above the release point rather
+    // than at actuation (which it may well still be past); once it's come back
+    // up through the release point it needs actuation again
+    bool rapid = key->rapid_trigger && key->extreme > key->release;
+    if (rapid ? travel >= key->extreme + key->rapid_trigger : travel >= key->actuation) {
+      key->pressed = true;
+      key->extreme = travel;
+    }
+  }
+
+  return key->pressed;
+}
+
+bool HOT_PATH(analog_pin)(int pin) {
+  return pin >= ANALOG_PIN_BASE && pin < ANALOG_PIN_BASE + ANALOG_CHANNELS;
+}
+
+void analog_start() {
+  for (int i = 0; i < ANALOG_BUFFER_SIZE; i++)
+    samples[i] = ANALOG_NO_SAMPLE;
+
+  adc_init();
+  adc_select_input(0);
+  adc_set_round_robin((1 << ANALOG_CHANNELS) - 1);
+  adc_fifo_setup(true, true, 1, false, false); // FIFO on, DREQ on, 16 bit samples
+  adc_set_clkdiv(0); // as fast as it goes, 500ksps across all channels
+
+  sample_dma = dma_claim_unused_channel(true);
+  restart_dma = dma_claim_unused_channel(true);
+
+  // Copies one round of samples from the ADC FIFO then hands over to restart_dma
+  dma_channel_config sample_config = dma_channel_get_default_config(sample_dma);
+  channel_config_set_transfer_data_size(&sample_config, DMA_SIZE_16);
+  channel_config_set_read_increment(&sample_config, false);
+  channel_config_set_write_increment(&sample_config, true);
+  channel_config_set_dreq(&sample_config, DREQ_ADC);
+  channel_config_set_chain_to(&sample_config, restart_dma);
+  dma_channel_configure(sample_dma, &sample_config, samples, &adc_hw->fifo, ANALOG_BUFFER_SIZE, false);
+
+  // Points sample_dma back at the start of the buffer and retriggers it; the
+  // transfer count reloads itself on trigger
+  dma_channel_config restart_config = dma_channel_get_default_config(restart_dma);
+  channel_config_set_transfer_data_size(&restart_config, DMA_SIZE_32);
+  channel_config_set_read_increment(&restart_config, false);
+  channel_config_set_write_increment(&restart_config, false);
+  dma_channel_configure(restart_dma, &restart_config, &dma_hw->ch[sample_dma].al2_write_addr_trig,
+                        &samples_start, 1, false);
+
+  dma_channel_start(sample_dma);
+  adc_run(true);
+}
+
+void analog_enable(int pin) {
+  if (!analog_pin(pin))
+    return;
+
+  AnalogChannel *channel = &channels[pin - ANALOG_PIN_BASE];
+  if (channel->enabled)
+    return;
+
+  // Don't spend DMA channels or ADC power on boards without analog keys
+  if (sample_dma == -1)
+    analog_start();
+
+  // Thresholds come from the config, which is applied before any pin is
+  // set up and stays with the channel if the key moves off and back
+  adc_gpio_init(pin);
+  channel->enabled = true;
+  channel->calibrated = false;
+}
+
+void analog_configure(int pin, uint8_t actuation, uint8_t release, uint8_t rapid_trigger) {
+  if (!analog_pin(pin))
+    return;
+
+  analog_key_config(&channels[pin - ANALOG_PIN_BASE].key, actuation, release, rapid_trigger);
+}
+
+void HOT_PATH(analog_update)() {
+  for (int c = 0; c < ANALOG_CHANNELS; c++) {
+    AnalogChannel *channel = &channels[c];
+    if (!channel->enabled)
+      continue;
+
+    uint32_t sum = 0;
+    bool ready = true;
+    for (int i = c; i < ANALOG_BUFFER_SIZE; i += ANALOG_CHANNELS) {
+      if (samples[i] == ANALOG_NO_SAMPLE)
+        ready = false;
+      sum += samples[i];
+    }
+
+    if (!ready)
+      continue; // DMA hasn't filled the buffer yet
+
+    uint16_t raw = sum / ANALOG_SAMPLES;
+
+    // Assume the key is up when we first see it
+    if (!channel->calibrated) {
+      analog_key_calibrate(&channel->key, raw);
+      channel->calibrated = true;
+    }
+
+    analog_key_update(&channel->key, analog_key_travel(&channel->key, raw));
+  }
+}
+
+bool HOT_PATH(analog_pressed)(int pin) {
+  if (!analog_pin(pin))
+    return false;
+
+  return channels[pin - ANALOG_PIN_BASE].key.pressed;
+}
+
+// Every channel, whether or not a key is on it yet, so what's read back is
+// what a key will get when it's assigned there
+int analog_config_read(uint8_t config[], int len) {
+  if (len < ANALOG_CONFIG_SIZE)
+    return 0;
+
+  config[0] = ANALOG_CHANNELS;
+  for (int c = 0; c < ANALOG_CHANNELS; c++) {
+    uint8_t *entry = config + 1 + c * ANALOG_ENTRY_SIZE;
+    entry[0] = ANALOG_PIN_BASE + c;
+    entry[1] = channels[c].key.actuation;
+    entry[2] = channels[c].key.release;
+    entry[3] = channels[c].key.rapid_trigger;
+  }
+
+  return ANALOG_CONFIG_SIZE;
+}
+
+void analog_config_set(uint8_t config[], int len) {
+  analog_config_reset();
+  if (len < 1)
+    return;
+
+  // Erased flash reads as 0xff, which also lands here
+  int count = config[0];
+  if (count > ANALOG_CHANNELS || 1 + count * ANALOG_ENTRY_SIZE > len)
+    return;
+
+  for (int i = 0; i < count; i++) {
+    uint8_t *entry = config + 1 + i * ANALOG_ENTRY_SIZE;
+    analog_configure(entry[0], entry[1], entry[2], entry[3]);
+  }
+}
+
+void analog_config_reset() {
+  for (int c = 0; c < ANALOG_CHANNELS; c++) {
+    analog_key_config(&channels[c].key, ANALOG_DEFAULT_ACTUATION, ANALOG_DEFAULT_RELEASE,
+                      ANALOG_DEFAULT_RAPID_TRIGGER);
+  }
+}
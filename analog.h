@@ -0,0 +1,56 @@
+#ifndef ANALOG_H_
+#define ANALOG_H_
+
+#include "pico/stdlib.h"
+
+// The RP2040 ADC inputs 0-3 live on GPIO 26-29; a key assigned to one of these
+// pins is read as an analog (Hall-effect) switch instead of a digital one
+#define ANALOG_PIN_BASE 26
+#define ANALOG_CHANNELS 4
+
+// Samples per channel kept in the DMA ring; these are averaged every scan
+#define ANALOG_SAMPLES 8
+
+// Travel is normalised to 0 (rest) - 255 (bottomed out)
+#define ANALOG_TRAVEL_MAX 255
+#define ANALOG_DEFAULT_ACTUATION 128
+#define ANALOG_DEFAULT_RELEASE 96
+#define ANALOG_DEFAULT_RAPID_TRIGGER 16
+
+// Config is the entry count, then per entry an analog pin and its actuation,
+// release and rapid trigger; pins without an entry get the defaults
+#define ANALOG_ENTRY_SIZE 4
+#define ANALOG_CONFIG_SIZE (1 + ANALOG_CHANNELS * ANALOG_ENTRY_SIZE)
+
+// Raw ADC counts we expect a full keystroke to cover before we've seen one;
+// stops a barely-touched key reading as fully pressed before calibration
+#define ANALOG_MIN_RANGE 800
+
+typedef struct {
+  uint16_t rest;        // raw reading with the key up
+  uint16_t bottom;      // furthest raw reading seen from rest
+  uint8_t actuation;    // travel at which a released key presses
+  uint8_t release;      // travel at or below which a key always releases
+  uint8_t rapid_trigger; // direction change (in travel) that flips the key, 0: off
+  uint8_t extreme;      // deepest travel while pressed, shallowest while released
+  bool pressed;
+} AnalogKey;
+
+// Pure threshold logic - no hardware access, so it can be driven with
+// synthetic travel curves
+void analog_key_config(AnalogKey *key, uint8_t actuation, uint8_t release, uint8_t rapid_trigger);
+void analog_key_calibrate(AnalogKey *key, uint16_t rest);
+uint8_t analog_key_travel(AnalogKey *key, uint16_t raw);
+bool analog_key_update(AnalogKey *key, uint8_t travel);
+
+bool analog_pin(int pin);
+void analog_enable(int pin);
+void analog_configure(int pin, uint8_t actuation, uint8_t release, uint8_t rapid_trigger);
+void analog_update();
+bool analog_pressed(int pin);
+
+int analog_config_read(uint8_t config[], int len);
+void analog_config_set(uint8_t config[], int len);
+void analog_config_reset();
+
+#endif /* ANALOG_H_ */
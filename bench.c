@@ -0,0 +1,258 @@
+/**
+ * Debounce benchmark. Generates synthetic bounce traces for a run of
+ * keystrokes (where we know when each one really started and ended), then
+ * steps them through debounce_update at KEYBOARD_SCAN_RATE_US and scores the
+ * edges that come out.
+ *
+ * Each step replays one trace / algorithm / window combination and takes a few
+ * tens of milliseconds, during which the keyboard isn't scanned - it's meant
+ * to be run from the config page, not mid-game, and webusb.c won't start or
+ * carry on a run while keys are in use.
+ */
+#include "bench.h"
+#include "keyboard.h" // for KEYBOARD_SCAN_RATE_US
+
+#include <string.h> // for memset
+
+#define BENCH_MAX_EDGES 4096
+#define BENCH_START_US 20000 // clear of the debouncer's initial state
+
+typedef struct {
+  uint32_t time_us;
+  bool state;
+} TraceEdge;
+
+const uint16_t bench_windows_us[BENCH_WINDOWS] = { 500, 1000, 2000, 5000, 10000 };
+
+TraceEdge trace[BENCH_MAX_EDGES];
+int trace_edges = 0;
+int trace_type = -1;
+uint32_t trace_end_us = 0;
+
+// When each keystroke really went down and up
+uint32_t press_us[BENCH_KEYSTROKES];
+uint32_t release_us[BENCH_KEYSTROKES];
+
+// Past the last result is the end marker, and past that we're idle
+#define BENCH_IDLE (BENCH_RESULTS + 1)
+int bench_index = BENCH_IDLE;
+BenchResult bench_result;
+
+// Fixed seed per trace type so results are comparable between runs
+uint32_t bench_seed = 0;
+static uint32_t bench_random(uint32_t min, uint32_t max) {
+  bench_seed = bench_seed * 1664525 + 1013904223;
+  return min + (bench_seed >> 8) % (max - min + 1);
+}
+
+static void trace_add(uint32_t time_us, bool state) {
+  if (trace_edges >= BENCH_MAX_EDGES)
+    return;
+  if (trace_edges > 0 && trace[trace_edges - 1].state == state)
+    return;
+
+  trace[trace_edges].time_us = time_us;
+  trace[trace_edges].state = state;
+  trace_edges++;
+}
+
+// Lands on state at time_us, then chatters back and forth before settling there
+static uint32_t trace_bounce(uint32_t time_us, bool state, int bounces, uint32_t min_gap, uint32_t max_gap) {
+  trace_add(time_us, state);
+  for (int i = 0; i < bounces; i++) {
+    time_us += bench_random(min_gap, max_gap);
+    trace_add(time_us, !state);
+    time_us += bench_random(min_gap, max_gap);
+    trace_add(time_us, state);
+  }
+  return time_us;
+}
+
+static void trace_spikes(uint32_t start_us, uint32_t end_us, bool state, int spikes) {
+  for (int i = 0; i < spikes; i++) {
+    uint32_t at = bench_random(start_us, end_us - 200);
+    if (trace_edges > 0 && at <= trace[trace_edges - 1].time_us)
+      continue; // keep the trace in order
+    trace_add(at, !state);
+    trace_add(at + bench_random(10, 150), state);
+  }
+}
+
+static void trace_generate(int type) {
+  uint32_t t = BENCH_START_US;
+
+  trace_edges = 0;
+  trace_type = type;
+  bench_seed = 0x5eed0000 + type;
+
+  for (int k = 0; k < BENCH_KEYSTROKES; k++) {
+    uint32_t settled;
+    press_us[k] = t;
+
+    switch (type) {
+      case TRACE_WORN:
+        settled = trace_bounce(t, true, bench_random(2, 8), 200, 1200);
+        t += bench_random(60000, 150000);
+        if (t < settled + 5000)
+          t = settled + 5000;
+        release_us[k] = t;
+        settled = trace_bounce(t, false, bench_random(2, 8), 200, 1200);
+        t = settled + bench_random(60000, 150000);
+        break;
+
+      case TRACE_FAST_TAP:
+        settled = trace_bounce(t, true, bench_random(0, 2), 50, 400);
+        t += bench_random(8000, 25000);
+        if (t < settled + 2000)
+          t = settled + 2000;
+        release_us[k] = t;
+        settled = trace_bounce(t, false, bench_random(0, 2), 50, 400);
+        t = settled + bench_random(15000, 40000);
+        break;
+
+      case TRACE_EMI:
+        trace_add(t, true);
+        t += bench_random(40000, 120000);
+        trace_spikes(press_us[k] + 1000, t, true, bench_random(0, 2));
+        release_us[k] = t;
+        trace_add(t, false);
+        settled = t;
+        t += bench_random(80000, 200000);
+        trace_spikes(settled + 1000, t, false, bench_random(2, 4));
+        break;
+
+      default: // TRACE_CLEAN
+        trace_add(t, true);
+        t += bench_random(30000, 80000);
+        release_us[k] = t;
+        trace_add(t, false);
+        t += bench_random(30000, 80000);
+        break;
+    }
+  }
+
+  trace_end_us = t;
+}
+
+static void sort(uint32_t values[], int count) {
+  for (int i = 1; i < count; i++) {
+    uint32_t value = values[i];
+    int j = i - 1;
+    for (; j >= 0 && values[j] > value; j--)
+      values[j + 1] = values[j];
+    values[j + 1] = value;
+  }
+}
+
+static uint16_t clamp_us(uint32_t us) {
+  return us > 0xffff ? 0xffff : us;
+}
+
+static void bench_distribution(uint32_t values[], int count, uint16_t *min, uint16_t *median, uint16_t *p95, uint16_t *max) {
+  if (count == 0) {
+    *min = *median = *p95 = *max = 0xffff;
+    return;
+  }
+
+  sort(values, count);
+  *min = clamp_us(values[0]);
+  *median = clamp_us(values[count / 2]);
+  *p95 = clamp_us(values[(count * 95) / 100]);
+  *max = clamp_us(values[count - 1]);
+}
+
+static void bench_replay(int algorithm, int window) {
+  Debounce d;
+  debounce_reset(&d);
+
+  bool pressed_seen[BENCH_KEYSTROKES];
+  bool released_seen[BENCH_KEYSTROKES];
+  uint32_t press_latency[BENCH_KEYSTROKES];
+  uint32_t release_latency[BENCH_KEYSTROKES];
+  int presses = 0;
+  int releases = 0;
+  int false_triggers = 0;
+
+  memset(pressed_seen, 0, sizeof(pressed_seen));
+  memset(released_seen, 0, sizeof(released_seen));
+
+  int edge = 0; // next trace edge
+  int k = -1;   // keystroke we're in
+  bool state = false;
+
+  for (uint32_t t = 0; t < trace_end_us; t += KEYBOARD_SCAN_RATE_US) {
+    while (edge < trace_edges && trace[edge].time_us <= t)
+      state = trace[edge++].state;
+    while (k + 1 < BENCH_KEYSTROKES && press_us[k + 1] <= t)
+      k++;
+
+    int reported = debounce_update(&d, state, t, window, algorithm);
+    if (reported == 0)
+      continue;
+
+    if (k < 0) {
+      false_triggers++;
+    } else if (reported == -1) {
+      if (pressed_seen[k]) {
+        false_triggers++;
+      } else {
+        pressed_seen[k] = true;
+        press_latency[presses++] = t - press_us[k];
+      }
+    } else {
+      // Letting go before the key really did is chatter
+      if (released_seen[k] || t < release_us[k]) {
+        false_triggers++;
+      } else {
+        released_seen[k] = true;
+        release_latency[releases++] = t - release_us[k];
+      }
+    }
+  }
+
+  bench_distribution(press_latency, presses, &bench_result.press_min, &bench_result.press_median,
+                     &bench_result.press_p95, &bench_result.press_max);
+  bench_distribution(release_latency, releases, &bench_result.release_min, &bench_result.release_median,
+                     &bench_result.release_p95, &bench_result.release_max);
+  bench_result.false_triggers = false_triggers;
+  bench_result.missed = BENCH_KEYSTROKES - presses;
+}
+
+void bench_debounce_start() {
+  bench_index = 0;
+  trace_type = -1;
+}
+
+void bench_debounce_stop() {
+  bench_index = BENCH_RESULTS;
+}
+
+bool bench_debounce_running() {
+  return bench_index < BENCH_IDLE;
+}
+
+BenchResult * bench_debounce_step() {
+  if (!bench_debounce_running())
+    return NULL;
+
+  if (bench_index == BENCH_RESULTS) {
+    bench_index = BENCH_IDLE;
+    return NULL;
+  }
+
+  int window = bench_index % BENCH_WINDOWS;
+  int algorithm = (bench_index / BENCH_WINDOWS) % DEBOUNCE_ALGORITHMS;
+  int type = bench_index / (BENCH_WINDOWS * DEBOUNCE_ALGORITHMS);
+  bench_index++;
+
+  if (type != trace_type)
+    trace_generate(type);
+
+  bench_result.trace = type;
+  bench_result.algorithm = algorithm;
+  bench_result.window_us = bench_windows_us[window];
+  bench_result.keystrokes = BENCH_KEYSTROKES;
+  bench_replay(algorithm, bench_windows_us[window]);
+
+  return &bench_result;
+}
@@ -0,0 +1,41 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include "pico/stdlib.h"
+#include "debounce.h"
+
+// Debounce benchmark - replays switch bounce traces through each debounce
+// algorithm and window at the real scan rate, and measures what comes out
+enum {
+  TRACE_CLEAN = 0, // no bounce at all, the latency floor
+  TRACE_WORN,      // long bursts of bounce on both press and release
+  TRACE_FAST_TAP,  // short taps with light bounce, easy to swallow
+  TRACE_EMI,       // short spikes on an otherwise idle line
+  TRACE_TYPES
+};
+
+#define BENCH_KEYSTROKES 64
+#define BENCH_WINDOWS 5
+#define BENCH_RESULTS (TRACE_TYPES * DEBOUNCE_ALGORITHMS * BENCH_WINDOWS)
+
+// Sent as-is over WebUSB; every field is naturally aligned so there's no padding
+typedef struct {
+  uint8_t trace;
+  uint8_t algorithm;
+  uint16_t window_us;
+  uint16_t keystrokes;
+  // Latencies in us from the intended edge to the reported edge. With
+  // BENCH_KEYSTROKES samples p99 would just be the max again
+  uint16_t press_min, press_median, press_p95, press_max;
+  uint16_t release_min, release_median, release_p95, release_max;
+  uint16_t false_triggers; // reported edges that weren't a real keystroke
+  uint16_t missed;         // keystrokes that never got reported
+} BenchResult;
+
+// A step returns the next result, or NULL once after the last to mark the end
+void bench_debounce_start();
+void bench_debounce_stop();
+bool bench_debounce_running();
+BenchResult * bench_debounce_step();
+
+#endif /* BENCH_H_ */
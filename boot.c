@@ -0,0 +1,12 @@
+/**
+ * Boot trace. Each stage is stamped the first time it's reached, so the
+ * trace shows where the time between reset and the first usable report goes.
+ * time_us_32() starts counting at reset, so these are time since power on.
+ */
+#include "boot.h"
+
+uint32_t boot_times[BOOT_STAGES];
+
+uint32_t * boot_trace() {
+  return boot_times;
+}
@@ -0,0 +1,33 @@
+#ifndef BOOT_H_
+#define BOOT_H_
+
+#include "pico/stdlib.h"
+
+// Boot trace - when each init stage finished, in us since reset
+enum {
+  BOOT_MAIN = 0,       // entered main()
+  BOOT_BOARD_INIT,     // board_init() done
+  BOOT_FLASH_READ,     // config read from flash
+  BOOT_KEYMAP_READY,   // GPIO set up, keys can be scanned
+  BOOT_USB_INIT,       // tusb_init() done
+  BOOT_FIRST_SCAN,     // first keyboard_update()
+  BOOT_MOUNTED,        // host configured us
+  BOOT_FIRST_REPORT,   // first keyboard report handed to the USB stack
+  BOOT_CONFIG_SAVED,   // first-boot config written to flash (deferred)
+  BOOT_STAGES
+};
+
+extern uint32_t boot_times[BOOT_STAGES];
+
+// The scan and report path stamp their stage every time round, so it's
+// inline: once a stage is set that's a load and a compare, with no call out
+// to flash
+static inline void boot_mark(int stage) {
+  if (stage < 0 || stage >= BOOT_STAGES || boot_times[stage] != 0)
+    return;
+
+  boot_times[stage] = time_us_32();
+}
+uint32_t * boot_trace();
+
+#endif /* BOOT_H_ */
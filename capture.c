@@ -0,0 +1,177 @@
+/**
+ * Raw pin capture. A PIO state machine runs a single 'in pins, 32', so it
+ * samples the whole bank once per divided clock and autopushes each word. A
+ * DMA channel copies them into a ring, using the DMA's own write address
+ * wrapping (which is why the buffer is aligned to its size). The channel's
+ * transfer count runs down by one per sample, so it's also our count of how
+ * many samples have been written - and so where the newest one is.
+ *
+ * The dump is run-length encoded: switch lines sit still for almost all of
+ * a capture, so a few hundred runs usually cover thousands of samples.
+ */
+#include "capture.h"
+
+#include "hardware/pio.h"
+#include "hardware/pio_instructions.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
+#include "hotpath.h" // for HOT_PATH
+#include "log.h"
+
+#define CAPTURE_BYTES (CAPTURE_SAMPLES * sizeof(uint32_t))
+#define CAPTURE_COUNT 0xffffffff // ~12 hours at 100kHz, after which we re-arm
+
+uint32_t capture_buffer[CAPTURE_SAMPLES] __attribute__((aligned(CAPTURE_BYTES)));
+
+PIO capture_pio = pio1; // pio0 has the pixels
+int capture_sm = -1;
+int capture_dma = -1;
+uint capture_offset = 0;
+
+uint16_t capture_instruction;
+struct pio_program capture_program = {
+  .instructions = &capture_instruction,
+  .length = 1,
+  .origin = -1,
+};
+
+uint8_t capture_state = CAPTURE_IDLE;
+uint8_t capture_key = 0;
+uint8_t capture_edge_type = CAPTURE_EDGE_ANY;
+uint32_t capture_rate_hz = CAPTURE_DEFAULT_KHZ * 1000;
+uint32_t capture_trigger = 0; // samples written when the edge was seen
+uint32_t capture_end = 0;     // samples written when we stopped
+
+uint32_t capture_dump_next = 0;
+bool capture_dumping = false;
+
+static uint32_t capture_written() {
+  return CAPTURE_COUNT - dma_channel_hw_addr(capture_dma)->transfer_count;
+}
+
+static void capture_stop() {
+  if (capture_sm == -1)
+    return;
+
+  // Let the DMA empty the FIFO before we take the count
+  pio_sm_set_enabled(capture_pio, capture_sm, false);
+  while (!pio_sm_is_rx_fifo_empty(capture_pio, capture_sm))
+    tight_loop_contents();
+
+  capture_end = capture_written();
+  dma_channel_abort(capture_dma);
+}
+
+void capture_arm(uint8_t key, uint8_t edge, uint32_t rate_khz) {
+  if (rate_khz < CAPTURE_MIN_KHZ)
+    rate_khz = CAPTURE_MIN_KHZ;
+  if (rate_khz > CAPTURE_MAX_KHZ)
+    rate_khz = CAPTURE_MAX_KHZ;
+
+  if (capture_sm == -1) {
+    capture_instruction = pio_encode_in(pio_pins, 32);
+    capture_offset = pio_add_program(capture_pio, &capture_program);
+    capture_sm = pio_claim_unused_sm(capture_pio, true);
+    capture_dma = dma_claim_unused_channel(true);
+  } else if (capture_state == CAPTURE_ARMED || capture_state == CAPTURE_TRIGGERED) {
+    capture_stop();
+  }
+
+  capture_key = key;
+  capture_edge_type = edge;
+  capture_rate_hz = rate_khz * 1000;
+  capture_dumping = false;
+
+  pio_sm_config config = pio_get_default_sm_config();
+  sm_config_set_wrap(&config, capture_offset, capture_offset);
+  sm_config_set_in_pins(&config, 0);
+  sm_config_set_in_shift(&config, false, true, 32); // autopush every sample
+  sm_config_set_fifo_join(&config, PIO_FIFO_JOIN_RX);
+  sm_config_set_clkdiv(&config, (float) clock_get_hz(clk_sys) / capture_rate_hz);
+  pio_sm_init(capture_pio, capture_sm, capture_offset, &config);
+
+  dma_channel_config dma_config = dma_channel_get_default_config(capture_dma);
+  channel_config_set_transfer_data_size(&dma_config, DMA_SIZE_32);
+  channel_config_set_read_increment(&dma_config, false);
+  channel_config_set_write_increment(&dma_config, true);
+  channel_config_set_ring(&dma_config, true, __builtin_ctz(CAPTURE_BYTES));
+  channel_config_set_dreq(&dma_config, pio_get_dreq(capture_pio, capture_sm, false));
+  dma_channel_configure(capture_dma, &dma_config, capture_buffer, &capture_pio->rxf[capture_sm],
+                        CAPTURE_COUNT, true);
+
+  pio_sm_set_enabled(capture_pio, capture_sm, true);
+  capture_state = CAPTURE_ARMED;
+  LOG(LOG_CAPTURE_ARMED, key, edge, capture_rate_hz);
+}
+
+void HOT_PATH(capture_edge)(uint8_t key, bool down) {
+  if (capture_state != CAPTURE_ARMED || key != capture_key)
+    return;
+
+  if ((capture_edge_type == CAPTURE_EDGE_PRESS && !down) ||
+      (capture_edge_type == CAPTURE_EDGE_RELEASE && down))
+    return;
+
+  capture_trigger = capture_written();
+  capture_state = CAPTURE_TRIGGERED;
+}
+
+// Until the ring has filled once there's less history than it can hold
+static uint32_t capture_samples() {
+  return capture_end < CAPTURE_SAMPLES ? capture_end : CAPTURE_SAMPLES;
+}
+
+void HOT_PATH(capture_update)() {
+  if (capture_state == CAPTURE_TRIGGERED && capture_written() - capture_trigger >= CAPTURE_POST_SAMPLES) {
+    capture_stop();
+    capture_state = CAPTURE_DONE;
+    LOG(LOG_CAPTURE_DONE, capture_samples());
+  } else if (capture_state == CAPTURE_ARMED && !dma_channel_is_busy(capture_dma)) {
+    capture_arm(capture_key, capture_edge_type, capture_rate_hz / 1000);
+  }
+}
+
+// The state machine's divider is from clk_sys, so the governor has us work
+// it out again when that changes; a capture that spans a switch keeps its rate
+void capture_clock_changed() {
+  if (capture_sm != -1)
+    pio_sm_set_clkdiv(capture_pio, capture_sm, (float) clock_get_hz(clk_sys) / capture_rate_hz);
+}
+
+void capture_status(CaptureStatus *status) {
+  status->state = capture_state;
+  status->key = capture_key;
+  status->edge = capture_edge_type;
+  status->reserved = 0;
+  status->rate_hz = capture_rate_hz;
+  status->samples = capture_state == CAPTURE_DONE ? capture_samples() : 0;
+  status->trigger = capture_state == CAPTURE_DONE ? capture_trigger - (capture_end - capture_samples()) : 0;
+}
+
+void capture_dump_start() {
+  capture_dump_next = capture_end - capture_samples();
+  capture_dumping = true;
+}
+
+bool capture_dump_running() {
+  return capture_dumping;
+}
+
+// Returns 0 once, when the dump has finished; nothing to dump is an empty one
+int capture_dump_read(CaptureRun out[], int max) {
+  int count = 0;
+
+  while (capture_state == CAPTURE_DONE && count < max && capture_dump_next != capture_end) {
+    uint32_t pins = capture_buffer[capture_dump_next & (CAPTURE_SAMPLES - 1)];
+    uint32_t run = 0;
+    while (capture_dump_next != capture_end && capture_buffer[capture_dump_next & (CAPTURE_SAMPLES - 1)] == pins) {
+      capture_dump_next++;
+      run++;
+    }
+    out[count++] = (CaptureRun) { pins, run };
+  }
+
+  if (count == 0)
+    capture_dumping = false;
+  return count;
+}
@@ -0,0 +1,58 @@
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include "pico/stdlib.h"
+
+// Raw pin capture - a logic analyser for switch diagnostics. Once armed, the
+// whole GPIO bank is sampled into a ring at a fixed rate; an edge on the
+// chosen key stops it half a ring later, so the capture holds the history
+// before the edge as well as the bounce after it
+#define CAPTURE_SAMPLES 4096 // 32 bit words, must be a power of 2
+#define CAPTURE_POST_SAMPLES (CAPTURE_SAMPLES / 2)
+#define CAPTURE_DEFAULT_KHZ 100
+#define CAPTURE_MIN_KHZ 2
+#define CAPTURE_MAX_KHZ 1000
+
+enum {
+  CAPTURE_IDLE = 0,
+  CAPTURE_ARMED,     // sampling, waiting for the edge
+  CAPTURE_TRIGGERED, // sampling what comes after the edge
+  CAPTURE_DONE,
+};
+
+enum {
+  CAPTURE_EDGE_ANY = 0,
+  CAPTURE_EDGE_PRESS,
+  CAPTURE_EDGE_RELEASE,
+};
+
+// Sent as-is over WebUSB
+typedef struct {
+  uint8_t state;
+  uint8_t key;
+  uint8_t edge;
+  uint8_t reserved;
+  uint32_t rate_hz;
+  uint32_t samples; // in the capture, once it's done
+  uint32_t trigger; // index of the first sample after the edge was seen
+} CaptureStatus;
+
+// One run of identical samples; the dump is these, oldest first
+typedef struct {
+  uint32_t pins;
+  uint32_t count;
+} CaptureRun;
+
+void capture_arm(uint8_t key, uint8_t edge, uint32_t rate_khz);
+void capture_status(CaptureStatus *status);
+void capture_clock_changed();
+
+// Called by the scan with every raw edge, and once per scan
+void capture_edge(uint8_t key, bool down);
+void capture_update();
+
+void capture_dump_start();
+bool capture_dump_running();
+int capture_dump_read(CaptureRun out[], int max);
+
+#endif /* CAPTURE_H_ */
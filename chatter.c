@@ -0,0 +1,201 @@
+/**
+ * Adaptive debounce. Each reported edge opens a span in which any further
+ * change of the pin is a bounce; the last one tells us how long that edge
+ * took to settle. The key's settle time is the largest seen, losing a
+ * little with every edge, and its window is twice that - so a switch that
+ * settles in half a millisecond gets the minimum window and a worn one gets
+ * as long as it needs. A bounce that comes after the window has closed goes
+ * out as an edge; we can't take that back, but it counts as an escape and
+ * the window has grown by the next press.
+ *
+ * Settle times are kept in a flash sector of their own, so a restart doesn't
+ * go back to the slow default. It's rewritten rarely, and only once things
+ * have moved by more than a little.
+ */
+#include "chatter.h"
+
+#include <string.h>
+
+#include "keyboard.h" // for KEYS and the debounce bounds
+#include "save.h"
+#include "log.h"
+#include "hotpath.h" // for HOT_PATH
+
+#define CHATTER_MAGIC 0x43484154 // "CHAT"
+#define CHATTER_SAVE_STEP_US 500 // smaller window changes aren't worth a save
+
+typedef struct {
+  uint32_t magic;
+  uint16_t keys;
+  uint16_t reserved;
+  uint16_t settle_us[KEYS];
+} ChatterSave;
+
+static ChatterStats stats[KEYS];
+static uint32_t settle_peak[KEYS]; // settle_us at full resolution as it decays
+static uint32_t last_edge[KEYS];   // when the debouncer last reported an edge
+static uint32_t burst_settle[KEYS]; // since then, when the last bounce was
+static bool seen_edge[KEYS];
+static bool announced[KEYS];
+
+static uint16_t saved_settle[KEYS];
+static uint64_t saved_us = 0;
+static uint32_t last_activity = 0;
+static int failing_pending = 0;
+
+static int dump_next = 0;
+static bool dumping = false;
+
+static uint32_t chatter_window_for(uint32_t settle) {
+  uint32_t window = settle * 2;
+  if (window < DEBOUNCE_MIN_US)
+    window = DEBOUNCE_MIN_US;
+  if (window > DEBOUNCE_MAX_US)
+    window = DEBOUNCE_MAX_US;
+  return window;
+}
+
+static uint8_t chatter_flags(int key) {
+  uint8_t flags = 0;
+  if (stats[key].settle_us > CHATTER_FAILING_US)
+    flags |= CHATTER_SLOW;
+  if (stats[key].escapes >= CHATTER_FAILING_ESCAPES)
+    flags |= CHATTER_ESCAPING;
+  return flags;
+}
+
+static void chatter_set_settle(int key, uint32_t settle) {
+  settle_peak[key] = settle;
+  stats[key].settle_us = settle;
+  stats[key].window_us = chatter_window_for(settle);
+}
+
+void chatter_init() {
+  ChatterSave save;
+  flash_debounce_read((uint8_t *) &save, sizeof(save));
+  bool valid = save.magic == CHATTER_MAGIC && save.keys == KEYS;
+
+  // Until we know better, every key starts out on the one global window
+  memset(stats, 0, sizeof(stats));
+  for (int i = 0; i < KEYS; i++) {
+    stats[i].key = i;
+    chatter_set_settle(i, valid ? save.settle_us[i] : DEBOUNCE_US / 2);
+    saved_settle[i] = stats[i].settle_us;
+    seen_edge[i] = false;
+    announced[i] = false;
+  }
+
+  saved_us = time_us_64();
+  failing_pending = 0;
+}
+
+void HOT_PATH(chatter_raw_edge)(int key, uint32_t time) {
+  if (!seen_edge[key] || time - last_edge[key] >= CHATTER_SPAN_US)
+    return;
+
+  stats[key].bounces++;
+  burst_settle[key] = time - last_edge[key];
+}
+
+// The span after the previous edge is over, so fold what it saw into the
+// settle time
+static void chatter_learn(int key, uint32_t time) {
+  ChatterStats *s = &stats[key];
+  uint32_t settle = burst_settle[key];
+
+  if (time - last_edge[key] < CHATTER_SPAN_US && s->escapes < 0xffff)
+    s->escapes++;
+  if (settle > s->settle_max_us)
+    s->settle_max_us = settle;
+
+  uint32_t peak = settle_peak[key] - settle_peak[key] / CHATTER_DECAY;
+  chatter_set_settle(key, settle > peak ? settle : peak);
+
+  uint8_t flags = chatter_flags(key);
+  if (flags && !s->flags && !announced[key]) {
+    failing_pending++;
+    LOG(LOG_SWITCH_FAILING, key, s->settle_us, s->escapes);
+  }
+  s->flags = flags;
+}
+
+void HOT_PATH(chatter_reported_edge)(int key, uint32_t time, bool down) {
+  if (seen_edge[key])
+    chatter_learn(key, time);
+
+  seen_edge[key] = true;
+  last_edge[key] = time;
+  burst_settle[key] = 0;
+  last_activity = time;
+  if (down)
+    stats[key].presses++;
+}
+
+uint32_t HOT_PATH(chatter_window)(int key) {
+  return stats[key].window_us;
+}
+
+void chatter_stats(int key, ChatterStats *out) {
+  *out = stats[key];
+}
+
+int chatter_failing_key() {
+  if (failing_pending == 0)
+    return -1;
+
+  for (int i = 0; i < KEYS; i++) {
+    if (stats[i].flags && !announced[i]) {
+      announced[i] = true;
+      failing_pending--;
+      return i;
+    }
+  }
+  failing_pending = 0;
+  return -1;
+}
+
+bool chatter_save_pending() {
+  if (time_us_64() - saved_us < (uint64_t) CHATTER_SAVE_INTERVAL_MS * 1000 ||
+      time_us_32() - last_activity < CHATTER_SAVE_IDLE_MS * 1000)
+    return false;
+
+  for (int i = 0; i < KEYS; i++) {
+    int moved = (int) stats[i].window_us - (int) chatter_window_for(saved_settle[i]);
+    if (moved >= CHATTER_SAVE_STEP_US || moved <= -CHATTER_SAVE_STEP_US)
+      return true;
+  }
+  return false;
+}
+
+void chatter_flash_save() {
+  ChatterSave save;
+  memset(&save, 0, sizeof(save));
+  save.magic = CHATTER_MAGIC;
+  save.keys = KEYS;
+  for (int i = 0; i < KEYS; i++)
+    save.settle_us[i] = saved_settle[i] = stats[i].settle_us;
+
+  flash_debounce_write((uint8_t *) &save, sizeof(save));
+  saved_us = time_us_64();
+  LOG(LOG_DEBOUNCE_SAVED);
+}
+
+void chatter_dump_start() {
+  dump_next = 0;
+  dumping = true;
+}
+
+bool chatter_dump_running() {
+  return dumping;
+}
+
+// Returns 0 once, when the dump has finished
+int chatter_dump_read(ChatterStats out[], int max) {
+  int count = 0;
+  while (count < max && dump_next < KEYS)
+    out[count++] = stats[dump_next++];
+
+  if (count == 0)
+    dumping = false;
+  return count;
+}
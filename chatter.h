@@ -0,0 +1,60 @@
+#ifndef CHATTER_H_
+#define CHATTER_H_
+
+#include "pico/stdlib.h"
+
+// Per-key debounce windows learned from how long each switch actually
+// bounces, between DEBOUNCE_MIN_US and DEBOUNCE_MAX_US (see keyboard.h). A
+// key's window is twice the settle time it's been seen to need, which decays
+// a little with every edge so a healthy switch works its way to the minimum
+#define CHATTER_SPAN_US (DEBOUNCE_MAX_US / 2) // raw edges this soon after a report are bounces
+#define CHATTER_DECAY 16                      // settle time loses 1/16 per clean edge
+#define CHATTER_FAILING_US 5000               // settling slower than this is a worn switch
+#define CHATTER_FAILING_ESCAPES 8             // or this many bounces got through as edges
+
+// Learned settle times are saved at most this often, and only once the keys
+// have been still for a while, since the sector erase stops the scan
+#define CHATTER_SAVE_INTERVAL_MS (60 * 60 * 1000)
+#define CHATTER_SAVE_IDLE_MS 10000
+
+enum {
+  CHATTER_SLOW = 1,    // takes longer than CHATTER_FAILING_US to settle
+  CHATTER_ESCAPING = 2, // CHATTER_FAILING_ESCAPES or more bounces reported as edges
+};
+
+// Reply to 'a', one per key; also sent unprompted as 'e' the first time a
+// key is flagged
+typedef struct {
+  uint32_t presses;
+  uint32_t bounces;       // raw edges inside the span after a reported edge
+  uint16_t escapes;       // reported edges inside the span - bounces we let through
+  uint16_t settle_us;     // learned settle time
+  uint16_t settle_max_us; // longest settle seen since boot
+  uint16_t window_us;     // debounce window in use
+  uint8_t key;
+  uint8_t flags;          // CHATTER_
+  uint16_t reserved;
+} ChatterStats;
+
+// Loads the learned settle times from flash
+void chatter_init();
+
+// From the scan: every change of a pin's physical state, then every edge
+// the debouncer reported
+void chatter_raw_edge(int key, uint32_t time);
+void chatter_reported_edge(int key, uint32_t time, bool down);
+uint32_t chatter_window(int key);
+
+void chatter_stats(int key, ChatterStats *stats);
+
+// A key that's started failing since we last looked, or -1
+int chatter_failing_key();
+
+bool chatter_save_pending();
+void chatter_flash_save();
+
+void chatter_dump_start();
+bool chatter_dump_running();
+int chatter_dump_read(ChatterStats out[], int max);
+
+#endif /* CHATTER_H_ */
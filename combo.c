@@ -0,0 +1,260 @@
+/**
+ * Combo engine. Sits between the debounced edges and the press/release path.
+ *
+ * Only keys that are part of some combo are ever held back - a bitmask of
+ * every combo member means any other key costs one AND and goes straight
+ * through. A held-back press waits only while a combo is still possible:
+ * the pending keys are let go (in the order they were pressed) as soon as
+ * the term runs out, one of them is released, or a key that can't complete
+ * any candidate combo goes down.
+ *
+ * A combo fires the moment its keys are all down, unless a bigger combo that
+ * includes them is still possible; then it fires when the term runs out or
+ * a key that can't complete the bigger one goes down. Its keycode is
+ * released when the first of its keys comes back up; the rest of its
+ * releases are swallowed.
+ */
+#include "combo.h"
+#include "keyboard.h" // for KEYS, NO_KEY, key_press, keyboard_key_event
+#include "hotpath.h" // for HOT_PATH
+
+#include <string.h> // for memset, memcpy
+
+#define KEY_WORDS ((KEYS + 31) / 32)
+
+typedef struct {
+  uint8_t keys[COMBO_MAX_KEYS];
+  uint8_t count;
+  uint8_t keycode;
+} Combo;
+
+Combo combos[COMBO_MAX];
+int combo_count = 0;
+uint32_t combo_term_us = COMBO_DEFAULT_TERM_MS * 1000;
+
+// Precomputed at config time: every key in any combo, and for each key the
+// combos it's part of
+uint32_t combo_members[KEY_WORDS];
+uint8_t key_combos[KEYS];
+
+// Presses we're holding back, in order
+uint8_t pending[COMBO_MAX_KEYS];
+int pending_count = 0;
+uint8_t candidates = 0; // combos still possible with the pending keys
+uint32_t pending_time = 0;
+
+// Keys currently down as part of a fired combo, and which combo
+uint8_t consumed[KEYS];
+uint8_t active_combos = 0;
+
+static bool HOT_PATH(combo_member)(uint8_t key) {
+  return combo_members[key >> 5] & (1u << (key & 31));
+}
+
+static void HOT_PATH(combo_flush)() {
+  for (int i = 0; i < pending_count; i++)
+    keyboard_key_event(pending[i], true);
+
+  pending_count = 0;
+  candidates = 0;
+}
+
+static void HOT_PATH(combo_fire)(int c) {
+  key_press(combos[c].keycode);
+  active_combos |= 1 << c;
+
+  for (int i = 0; i < combos[c].count; i++)
+    consumed[combos[c].keys[i]] = c;
+
+  pending_count = 0;
+  candidates = 0;
+}
+
+// Finds a candidate whose keys are exactly the pending ones; sets bigger if
+// some other candidate still needs more keys
+static int HOT_PATH(combo_match)(bool *bigger) {
+  int match = -1;
+  *bigger = false;
+
+  for (int c = 0; c < combo_count; c++) {
+    if (!(candidates & (1 << c)))
+      continue;
+
+    if (combos[c].count == pending_count)
+      match = c;
+    else
+      *bigger = true;
+  }
+  return match;
+}
+
+// Nothing more can join the pending keys: they're the combo they exactly
+// match, if there is one, or plain presses
+static void HOT_PATH(combo_resolve)() {
+  bool bigger;
+  int match = combo_match(&bigger);
+  if (match != -1)
+    combo_fire(match);
+  else
+    combo_flush();
+}
+
+bool HOT_PATH(combo_edge)(uint8_t key, bool down, uint32_t time) {
+  if (!KEY_IN_RANGE(key) || !combo_member(key)) {
+    // Anything else going down means the pending keys can't grow any more
+    if (down && pending_count > 0)
+      combo_resolve();
+    return true;
+  }
+
+  if (!down) {
+    if (consumed[key] != NO_KEY) {
+      int c = consumed[key];
+      consumed[key] = NO_KEY;
+      if (active_combos & (1 << c)) {
+        key_release(combos[c].keycode);
+        active_combos &= ~(1 << c);
+      }
+      return false;
+    }
+
+    for (int i = 0; i < pending_count; i++) {
+      if (pending[i] != key)
+        continue;
+
+      // Tapped and released before the combo completed - the press goes out
+      // now and the release has to wait for the next report or it'd be lost.
+      // The release skips this engine on its way back in, so a combo that
+      // fired here couldn't be let go: the pending keys go out as themselves
+      combo_flush();
+      keyboard_defer_event(key, false);
+      return false;
+    }
+    return true;
+  }
+
+  uint8_t possible = (pending_count > 0 ? candidates : 0xff) & key_combos[key];
+  if (pending_count > 0 && possible == 0) {
+    combo_resolve();
+    possible = key_combos[key];
+  }
+
+  if (pending_count == 0)
+    pending_time = time;
+  pending[pending_count++] = key;
+  candidates = possible;
+
+  bool bigger;
+  int match = combo_match(&bigger);
+  if (match != -1 && !bigger)
+    combo_fire(match);
+  return false;
+}
+
+bool HOT_PATH(combo_update)(uint32_t time) {
+  if (pending_count == 0 || time - pending_time <= combo_term_us)
+    return false;
+
+  // Out of time - take the combo we've got, if we've got one
+  combo_resolve();
+  return true;
+}
+
+int combo_config_read(uint8_t config[], int len) {
+  if (len < COMBO_CONFIG_SIZE)
+    return 0;
+
+  memset(config, NO_KEY, COMBO_CONFIG_SIZE);
+  config[0] = combo_term_us / 1000;
+  config[1] = combo_count;
+  for (int c = 0; c < combo_count; c++) {
+    uint8_t *entry = config + 2 + c * COMBO_ENTRY_SIZE;
+    memcpy(entry, combos[c].keys, combos[c].count);
+    entry[COMBO_MAX_KEYS] = combos[c].keycode;
+  }
+
+  return COMBO_CONFIG_SIZE;
+}
+
+bool combo_config_set(uint8_t config[], int len) {
+  bool changed = combo_config_reset();
+  if (len < 2)
+    return changed;
+
+  // Erased flash reads as 0xff, which also lands here
+  int count = config[1];
+  if (count > COMBO_MAX || 2 + count * COMBO_ENTRY_SIZE > len)
+    return changed;
+
+  if (config[0] != 0)
+    combo_term_us = config[0] * 1000;
+
+  for (int c = 0; c < count; c++) {
+    uint8_t *entry = config + 2 + c * COMBO_ENTRY_SIZE;
+    Combo *combo = &combos[combo_count];
+
+    combo->count = 0;
+    for (int k = 0; k < COMBO_MAX_KEYS; k++) {
+      if (entry[k] != NO_KEY && KEY_IN_RANGE(entry[k]))
+        combo->keys[combo->count++] = entry[k];
+    }
+    combo->keycode = entry[COMBO_MAX_KEYS];
+
+    if (combo->count < 2)
+      continue;
+
+    for (int k = 0; k < combo->count; k++) {
+      uint8_t key = combo->keys[k];
+      combo_members[key >> 5] |= 1u << (key & 31);
+      key_combos[key] |= 1 << combo_count;
+    }
+    combo_count++;
+  }
+  return changed;
+}
+
+static struct {
+  uint8_t pending[COMBO_MAX_KEYS];
+  int pending_count;
+  uint8_t candidates;
+  uint32_t pending_time;
+  uint8_t consumed[KEYS];
+  uint8_t active_combos;
+} saved;
+
+void combo_state_save() {
+  memcpy(saved.pending, pending, sizeof(pending));
+  saved.pending_count = pending_count;
+  saved.candidates = candidates;
+  saved.pending_time = pending_time;
+  memcpy(saved.consumed, consumed, sizeof(consumed));
+  saved.active_combos = active_combos;
+}
+
+void combo_state_restore() {
+  memcpy(pending, saved.pending, sizeof(pending));
+  pending_count = saved.pending_count;
+  candidates = saved.candidates;
+  pending_time = saved.pending_time;
+  memcpy(consumed, saved.consumed, sizeof(consumed));
+  active_combos = saved.active_combos;
+}
+
+bool combo_config_reset() {
+  bool changed = pending_count > 0 || active_combos != 0;
+
+  // Anything the old combos were holding goes out as normal
+  combo_flush();
+  for (int c = 0; c < combo_count; c++) {
+    if (active_combos & (1 << c))
+      key_release(combos[c].keycode);
+  }
+
+  combo_count = 0;
+  combo_term_us = COMBO_DEFAULT_TERM_MS * 1000;
+  active_combos = 0;
+  memset(combo_members, 0, sizeof(combo_members));
+  memset(key_combos, 0, sizeof(key_combos));
+  memset(consumed, NO_KEY, sizeof(consumed));
+  return changed;
+}
@@ -0,0 +1,37 @@
+#ifndef COMBO_H_
+#define COMBO_H_
+
+#include "pico/stdlib.h"
+
+// Combos (chords) - two or more keys pressed within the combo term send a
+// different keycode instead
+#define COMBO_MAX 8
+#define COMBO_MAX_KEYS 4
+#define COMBO_DEFAULT_TERM_MS 40
+
+// Config is the term in ms and the combo count, then per combo its keys
+// (padded with NO_KEY, so on a 256 key board key 255 can't be in a combo)
+// and the keycode it sends
+#define COMBO_ENTRY_SIZE (COMBO_MAX_KEYS + 1)
+#define COMBO_CONFIG_SIZE (2 + COMBO_MAX * COMBO_ENTRY_SIZE)
+
+// Called with each debounced edge. Returns true if the caller should handle
+// the edge as normal, false if the combo engine has taken it
+bool combo_edge(uint8_t key, bool down, uint32_t time);
+
+// Called every scan; resolves combos whose term has run out. Returns true if
+// the report changed
+bool combo_update(uint32_t time);
+
+// Setting or resetting sends the keys the old combos were holding back and
+// lets go of any that fired; true if that changed the report
+int combo_config_read(uint8_t config[], int len);
+bool combo_config_set(uint8_t config[], int len);
+bool combo_config_reset();
+
+// For keyboard_benchmark, which pushes made-up edges through here: a copy of
+// what's pressed and pending, put back when it's done
+void combo_state_save();
+void combo_state_restore();
+
+#endif /* COMBO_H_ */
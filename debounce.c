@@ -0,0 +1,51 @@
+/**
+ * Debounce algorithms. These only look at the values they're given, so the
+ * same code runs in the scan loop and in the debounce benchmark.
+ */
+#include "debounce.h"
+#include "hotpath.h" // for HOT_PATH
+
+void debounce_reset(Debounce *d) {
+  d->state = false;
+  d->reported_state = false;
+  d->reported_time = 0;
+  d->changed_time = 0;
+}
+
+int HOT_PATH(debounce_update)(Debounce *d, bool state, uint32_t time, uint32_t window, int algorithm) {
+  bool report = false;
+  bool changed = state != d->state;
+
+  if (changed) {
+    d->changed_time = time;
+
+    // Still settling from the last report - push the window out
+    if (algorithm == DEBOUNCE_EAGER_EXTEND && time - d->reported_time <= window)
+      d->reported_time = time;
+  }
+
+  if (state != d->reported_state) {
+    switch (algorithm) {
+      case DEBOUNCE_NONE:
+        report = true;
+        break;
+      case DEBOUNCE_EAGER:
+      case DEBOUNCE_EAGER_EXTEND:
+        report = time - d->reported_time > window;
+        break;
+      case DEBOUNCE_DEFER:
+        report = time - d->changed_time >= window;
+        break;
+      default: break;
+    }
+  }
+
+  d->state = state;
+
+  if (!report)
+    return 0;
+
+  d->reported_state = state;
+  d->reported_time = time;
+  return d->reported_state ? -1 : 1;
+}
@@ -0,0 +1,29 @@
+#ifndef DEBOUNCE_H_
+#define DEBOUNCE_H_
+
+#include "pico/stdlib.h"
+
+enum {
+  DEBOUNCE_NONE = 0,     // report every change straight away
+  DEBOUNCE_EAGER,        // report the first change, then ignore the pin for the window
+  DEBOUNCE_EAGER_EXTEND, // as eager, but bounces inside the window restart it
+  DEBOUNCE_DEFER,        // report once the pin has been stable for the window
+  DEBOUNCE_ALGORITHMS
+};
+
+typedef struct {
+  bool state;          // physical state at the last scan
+  bool reported_state; // debounced state
+  uint32_t reported_time; // when reported_state last changed, in us
+  uint32_t changed_time;  // when state last changed, in us
+} Debounce;
+
+void debounce_reset(Debounce *d);
+
+// Feeds one scan of a pin through the debouncer; returns the edge this scan
+// (0: nothing, 1: rising / released, -1: falling / pressed). Times are from
+// time_us_32() and only ever compared by difference, so they survive the
+// counter wrapping every ~71 minutes
+int debounce_update(Debounce *d, bool state, uint32_t time, uint32_t window, int algorithm);
+
+#endif /* DEBOUNCE_H_ */
@@ -0,0 +1,85 @@
+/**
+ * Gamepad. Keys bound to buttons or hat directions skip the keyboard path
+ * entirely - no SOCD, combos or tap-hold, and no typematic repeat on the
+ * host - and go out in their own report straight from the debounced state.
+ *
+ * Bindings are turned into a mask per key when the keymap changes, so the
+ * report is an AND and an OR per key with no branches, and the four hat
+ * directions index a table. Opposing directions cancel out, like SOCD_NEUTRAL.
+ */
+#include "gamepad.h"
+#include "keyboard.h" // for KEYS, SPECIAL_KEY_GAMEPAD_, get_raw_report
+#include "hotpath.h" // for HOT_PATH
+#include "tusb.h" // for GAMEPAD_HAT_
+
+uint32_t gamepad_buttons[KEYS]; // report bits per key
+uint8_t gamepad_dirs[KEYS];     // 1 << GAMEPAD_DIR_ per key
+bool gamepad_bound = false;
+
+uint32_t gamepad_state_buttons = 0;
+uint8_t gamepad_state_hat = GAMEPAD_HAT_CENTERED;
+bool gamepad_changed = false;
+
+static const uint8_t hat_table[1 << GAMEPAD_DIRS] = {
+  GAMEPAD_HAT_CENTERED,   // none
+  GAMEPAD_HAT_UP,
+  GAMEPAD_HAT_DOWN,
+  GAMEPAD_HAT_CENTERED,   // up + down
+  GAMEPAD_HAT_LEFT,
+  GAMEPAD_HAT_UP_LEFT,
+  GAMEPAD_HAT_DOWN_LEFT,
+  GAMEPAD_HAT_LEFT,       // up + down + left
+  GAMEPAD_HAT_RIGHT,
+  GAMEPAD_HAT_UP_RIGHT,
+  GAMEPAD_HAT_DOWN_RIGHT,
+  GAMEPAD_HAT_RIGHT,      // up + down + right
+  GAMEPAD_HAT_CENTERED,   // left + right
+  GAMEPAD_HAT_UP,         // left + right + up
+  GAMEPAD_HAT_DOWN,       // left + right + down
+  GAMEPAD_HAT_CENTERED,   // all four
+};
+
+void gamepad_map(int key, uint8_t keycode) {
+  if (key < 0 || key >= KEYS)
+    return;
+
+  gamepad_buttons[key] = 0;
+  gamepad_dirs[key] = 0;
+  if (keycode >= SPECIAL_KEY_GAMEPAD_BUTTON && keycode < SPECIAL_KEY_GAMEPAD_BUTTON + GAMEPAD_BUTTONS)
+    gamepad_buttons[key] = 1u << (keycode - SPECIAL_KEY_GAMEPAD_BUTTON);
+  else if (keycode >= SPECIAL_KEY_GAMEPAD_HAT && keycode < SPECIAL_KEY_GAMEPAD_HAT + GAMEPAD_DIRS)
+    gamepad_dirs[key] = 1 << (keycode - SPECIAL_KEY_GAMEPAD_HAT);
+
+  gamepad_bound = false;
+  for (int i = 0; i < KEYS; i++)
+    gamepad_bound |= gamepad_buttons[i] != 0 || gamepad_dirs[i] != 0;
+}
+
+bool HOT_PATH(gamepad_update)() {
+  if (!gamepad_bound)
+    return false;
+
+  uint8_t *state = get_raw_report();
+  uint32_t buttons = 0;
+  uint32_t dirs = 0;
+  for (int i = 0; i < KEYS; i++) {
+    uint32_t down = -(uint32_t) (state[i] & 1);
+    buttons |= gamepad_buttons[i] & down;
+    dirs |= gamepad_dirs[i] & down;
+  }
+
+  uint8_t hat = hat_table[dirs];
+  gamepad_changed |= buttons != gamepad_state_buttons || hat != gamepad_state_hat;
+  gamepad_state_buttons = buttons;
+  gamepad_state_hat = hat;
+  return gamepad_changed;
+}
+
+void gamepad_state(uint32_t *buttons, uint8_t *hat) {
+  *buttons = gamepad_state_buttons;
+  *hat = gamepad_state_hat;
+}
+
+void gamepad_sent() {
+  gamepad_changed = false;
+}
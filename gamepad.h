@@ -0,0 +1,27 @@
+#ifndef GAMEPAD_H_
+#define GAMEPAD_H_
+
+#include "pico/stdlib.h"
+
+// Keys bound to a gamepad: keycode SPECIAL_KEY_GAMEPAD_BUTTON + n is button
+// n + 1, SPECIAL_KEY_GAMEPAD_HAT + one of these is a hat direction
+enum {
+  GAMEPAD_DIR_UP = 0,
+  GAMEPAD_DIR_DOWN,
+  GAMEPAD_DIR_LEFT,
+  GAMEPAD_DIR_RIGHT,
+  GAMEPAD_DIRS
+};
+
+#define GAMEPAD_BUTTONS 8 // the report has 32, but that's all the keycodes there's room for
+
+// Called for each key whenever the keymap changes
+void gamepad_map(int key, uint8_t keycode);
+
+// Rebuilds the state from the debounced keys; true if it's changed since the
+// last gamepad_sent
+bool gamepad_update();
+void gamepad_state(uint32_t *buttons, uint8_t *hat);
+void gamepad_sent();
+
+#endif /* GAMEPAD_H_ */
@@ -0,0 +1,105 @@
+/**
+ * Clock governor. Full clock only buys anything while there's input to
+ * handle, so we run at the top level while keys are moving or telemetry is
+ * streaming and step down a level at a time once it's been quiet for a
+ * while; any activity goes straight back to the top.
+ *
+ * The scan and report timing is all off the 1MHz timer, which runs from
+ * clk_ref and doesn't care about clk_sys. What does care - the LED pace and
+ * pixel state machine and the pin capture's sample rate, all divided down
+ * from clk_sys - is worked out again after every switch. The core voltage
+ * goes up before the overclock and comes back down after it.
+ *
+ * Switching happens in the main loop between scans. The PLL takes about a
+ * millisecond to relock, and clk_sys runs from the crystal meanwhile.
+ */
+#include "governor.h"
+
+#include "hardware/clocks.h"
+#include "hardware/vreg.h"
+
+#include "led.h"
+#include "capture.h"
+#include "split.h"
+#include "log.h"
+
+#define GOVERNOR_OVERCLOCK_KHZ 133000 // above this the core needs more volts
+
+static const uint32_t governor_khz[GOVERNOR_LEVELS] = GOVERNOR_KHZ;
+
+static int level = GOVERNOR_LEVELS - 1;
+static int target = GOVERNOR_LEVELS - 1;
+static uint32_t last_active_us = 0;
+static uint64_t accounted_us = 0; // residency counted up to here
+static uint64_t residency_us[GOVERNOR_LEVELS + 1]; // the last one's suspend
+static uint32_t switches = 0;
+static bool suspended = false;
+
+static void governor_account() {
+  uint64_t now = time_us_64();
+  residency_us[suspended ? GOVERNOR_LEVELS : level] += now - accounted_us;
+  accounted_us = now;
+}
+
+static void governor_switch(int to) {
+  uint32_t khz = governor_khz[to];
+
+  if (khz > GOVERNOR_OVERCLOCK_KHZ)
+    vreg_set_voltage(VREG_VOLTAGE_1_15);
+  governor_account();
+  if (!set_sys_clock_khz(khz, false))
+    return; // the PLL can't make it; stay put
+  if (khz <= GOVERNOR_OVERCLOCK_KHZ)
+    vreg_set_voltage(VREG_VOLTAGE_DEFAULT);
+
+  level = to;
+  switches++;
+  LOG(LOG_CLOCK, khz, to);
+
+  led_clock_changed();
+  capture_clock_changed();
+  split_clock_changed();
+}
+
+void governor_init() {
+  accounted_us = time_us_64();
+  last_active_us = time_us_32();
+  governor_switch(GOVERNOR_LEVELS - 1);
+  switches = 0;
+}
+
+void governor_activity() {
+  last_active_us = time_us_32();
+  target = GOVERNOR_LEVELS - 1;
+}
+
+void governor_task() {
+  if (suspended)
+    return;
+
+  uint32_t now = time_us_32();
+  if (target > 0 && now - last_active_us > GOVERNOR_IDLE_MS * 1000) {
+    // One step per idle period, so a short lull doesn't go all the way down
+    target--;
+    last_active_us = now;
+  }
+
+  if (target != level)
+    governor_switch(target);
+}
+
+void governor_suspend(bool suspend) {
+  governor_account();
+  suspended = suspend;
+}
+
+void governor_stats(GovernorStats *stats) {
+  governor_account();
+  stats->level = level;
+  stats->switches = switches;
+  stats->suspended_ms = residency_us[GOVERNOR_LEVELS] / 1000;
+  for (int i = 0; i < GOVERNOR_LEVELS; i++) {
+    stats->khz[i] = governor_khz[i];
+    stats->residency_ms[i] = residency_us[i] / 1000;
+  }
+}
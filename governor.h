@@ -0,0 +1,35 @@
+#ifndef GOVERNOR_H_
+#define GOVERNOR_H_
+
+#include "pico/stdlib.h"
+
+// System clock levels, lowest first. We go straight to the top one when keys
+// or telemetry are busy, and down a level after each GOVERNOR_IDLE_MS of quiet
+#define GOVERNOR_LEVELS 3
+#define GOVERNOR_KHZ { 48000, 125000, 200000 }
+#define GOVERNOR_IDLE_MS 2000
+
+// Reply to 'z'
+typedef struct {
+  uint32_t level;       // current, index into khz
+  uint32_t switches;    // clock changes since boot
+  uint32_t khz[GOVERNOR_LEVELS];
+  uint32_t residency_ms[GOVERNOR_LEVELS]; // time at each level since boot
+  uint32_t suspended_ms; // time in USB suspend, which has its own clock
+} GovernorStats;
+
+void governor_init();
+
+// Something wants the fast clock: a key changed, a mouse key is held, or
+// telemetry is going out
+void governor_activity();
+
+// From the main loop; makes any switch that's due
+void governor_task();
+
+// USB suspend takes the clock over, see power.c
+void governor_suspend(bool suspended);
+
+void governor_stats(GovernorStats *stats);
+
+#endif /* GOVERNOR_H_ */
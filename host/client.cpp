@@ -0,0 +1,224 @@
+#include "client.h"
+
+#include <cstring>
+#include <stdexcept>
+
+extern "C" {
+#include "timesync.h"
+}
+
+namespace kb {
+
+Client::Client(Transport &transport, int window, int timeout_ms)
+    : transport_(transport), window_(window < 1 ? 1 : window), timeout_ms_(timeout_ms) {}
+
+// Messages can be split across reads or share one, so they're cut out of a
+// running byte stream by their length byte
+void Client::receive() {
+  std::vector<uint8_t> data = transport_.receive(timeout_ms_);
+  if (data.empty())
+    throw std::runtime_error("timed out waiting for the keyboard");
+  uint64_t host_us = transport_.now_us();
+
+  stream_.insert(stream_.end(), data.begin(), data.end());
+  while (stream_.size() >= 2 && stream_[0] >= 2 && stream_.size() >= stream_[0]) {
+    Message message;
+    message.type = static_cast<char>(stream_[1]);
+    message.data.assign(stream_.begin() + 2, stream_.begin() + stream_[0]);
+    message.host_us = host_us;
+    stream_.erase(stream_.begin(), stream_.begin() + stream_[0]);
+    inbox_.push_back(std::move(message));
+  }
+
+  // A length under 2 can't be a message; drop the byte and resync
+  if (!stream_.empty() && stream_[0] < 2)
+    stream_.erase(stream_.begin());
+}
+
+// Replies come back in command order within a type, so a message goes to the
+// oldest in-flight request of its type. Streams interleave with anything
+// sent after them, which is why it's by type and not strictly in order
+bool Client::deliver(const Message &message, std::deque<Pending> &in_flight,
+                     std::vector<std::vector<Message>> &results) {
+  for (auto it = in_flight.begin(); it != in_flight.end(); ++it) {
+    if (it->request->type() != message.type)
+      continue;
+
+    const Request &request = *it->request;
+    bool done;
+    if (request.reply == Reply::UntilEmpty) {
+      done = message.data.empty();
+      if (!done)
+        it->replies.push_back(message);
+    } else {
+      it->replies.push_back(message);
+      int count = request.reply == Reply::Count ? request.count : 1;
+      done = static_cast<int>(it->replies.size()) >= count;
+    }
+
+    if (done) {
+      results[it->index] = std::move(it->replies);
+      in_flight.erase(it);
+    }
+    return true;
+  }
+  return false;
+}
+
+std::vector<std::vector<Message>> Client::run(const std::vector<Request> &requests) {
+  std::vector<std::vector<Message>> results(requests.size());
+  std::deque<Pending> in_flight;
+  size_t next = 0;
+
+  while (next < requests.size() || !in_flight.empty()) {
+    // Keep the window full, but never two of one stream at once - a second
+    // 'f' would restart the first
+    while (next < requests.size() && static_cast<int>(in_flight.size()) < window_) {
+      const Request &request = requests[next];
+      bool clash = false;
+      for (const Pending &pending : in_flight) {
+        if (pending.request->type() == request.type() &&
+            (request.reply != Reply::Single || pending.request->reply != Reply::Single))
+          clash = true;
+      }
+      if (clash)
+        break;
+
+      transport_.send(request.command);
+      in_flight.push_back(Pending{next, &request, {}});
+      next++;
+    }
+
+    if (inbox_.empty())
+      receive();
+
+    while (!inbox_.empty()) {
+      Message message = std::move(inbox_.front());
+      inbox_.pop_front();
+      if (!deliver(message, in_flight, results) && on_unsolicited)
+        on_unsolicited(message);
+    }
+  }
+
+  return results;
+}
+
+std::vector<Message> Client::run(const Request &request) {
+  return run(std::vector<Request>{request}).at(0);
+}
+
+std::vector<uint8_t> Client::single(char type, const std::vector<uint8_t> &args, char reply_type) {
+  Request request;
+  request.reply_type = reply_type;
+  request.command.push_back(static_cast<uint8_t>(type));
+  request.command.insert(request.command.end(), args.begin(), args.end());
+  return run(request).at(0).data;
+}
+
+std::vector<uint8_t> Client::keymap() {
+  return single('c');
+}
+
+std::vector<uint8_t> Client::set_keymap(const std::vector<uint8_t> &config) {
+  return single('s', config, 'c');
+}
+
+std::vector<uint8_t> Client::reset() {
+  return single('d', {}, 'c');
+}
+
+std::vector<uint8_t> Client::socd(const std::vector<uint8_t> &config) {
+  return single('o', config);
+}
+
+std::vector<uint8_t> Client::combos(const std::vector<uint8_t> &config) {
+  return single('m', config);
+}
+
+std::vector<uint8_t> Client::taphold(const std::vector<uint8_t> &config) {
+  return single('h', config);
+}
+
+std::vector<uint8_t> Client::analog(const std::vector<uint8_t> &config) {
+  return single('v', config);
+}
+
+std::vector<uint8_t> Client::profile(int index, bool persist) {
+  if (index < 0)
+    return single('p');
+  return single('p', {static_cast<uint8_t>(index), static_cast<uint8_t>(persist)});
+}
+
+std::vector<uint8_t> Client::boot_trace() {
+  return single('t');
+}
+
+std::vector<uint8_t> Client::scan_bench() {
+  return single('k');
+}
+
+std::vector<uint8_t> Client::recorder_dump() {
+  std::vector<uint8_t> records;
+  for (const Message &chunk : run(Request{{'f'}, Reply::UntilEmpty}))
+    records.insert(records.end(), chunk.data.begin(), chunk.data.end());
+  return records;
+}
+
+std::vector<Message> Client::debounce_bench() {
+  return run(Request{{'b'}, Reply::UntilEmpty});
+}
+
+// Sent on its own, so the round trip is just this ping. The receive stamp is
+// from when the reply's transfer completed, not when we got round to it
+SyncSample Client::sync_ping(uint32_t tag) {
+  std::vector<uint8_t> command(1 + sizeof(tag), 'y');
+  std::memcpy(command.data() + 1, &tag, sizeof(tag));
+
+  uint64_t send_us = transport_.now_us();
+  std::vector<Message> replies = run(Request{command});
+
+  SyncReply reply;
+  if (replies.at(0).data.size() < sizeof(reply))
+    throw std::runtime_error("short clock sync reply");
+  std::memcpy(&reply, replies[0].data.data(), sizeof(reply));
+  if (reply.tag != tag)
+    throw std::runtime_error("clock sync reply for another ping");
+
+  return SyncSample{send_us, reply.rx_us, reply.tx_us, replies[0].host_us,
+                    reply.sof_us, reply.sof_frame};
+}
+
+std::string to_hex(const std::vector<uint8_t> &data) {
+  static const char digits[] = "0123456789abcdef";
+  std::string text;
+  for (uint8_t byte : data) {
+    text.push_back(digits[byte >> 4]);
+    text.push_back(digits[byte & 0xf]);
+  }
+  return text;
+}
+
+std::vector<uint8_t> from_hex(const std::string &text) {
+  std::vector<uint8_t> data;
+  int nibbles = 0;
+  uint8_t byte = 0;
+  for (char c : text) {
+    int value;
+    if (c >= '0' && c <= '9')
+      value = c - '0';
+    else if (c >= 'a' && c <= 'f')
+      value = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      value = c - 'A' + 10;
+    else
+      continue; // spaces, newlines
+    byte = static_cast<uint8_t>(byte << 4 | value);
+    if (++nibbles % 2 == 0)
+      data.push_back(byte);
+  }
+  if (nibbles % 2)
+    throw std::runtime_error("odd number of hex digits");
+  return data;
+}
+
+} // namespace kb
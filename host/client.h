@@ -0,0 +1,133 @@
+#pragma once
+
+// Host side of the keyboard's vendor (WebUSB) protocol, see webusb.c
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace kb {
+
+struct Message {
+  char type;
+  std::vector<uint8_t> data;
+  uint64_t host_us = 0; // when it came off the endpoint, by Transport::now_us
+};
+
+class Transport {
+ public:
+  virtual ~Transport() = default;
+
+  // One OUT transfer holding a whole command
+  virtual void send(const std::vector<uint8_t> &command) = 0;
+
+  // Whatever has arrived on the IN endpoint, waiting up to timeout_ms for it
+  virtual std::vector<uint8_t> receive(int timeout_ms) = 0;
+
+  // The host clock that messages are stamped with, in us
+  virtual uint64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // Lets time pass without sending anything
+  virtual void wait_us(uint64_t us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+  }
+};
+
+// How the firmware answers a command
+enum class Reply {
+  Single,     // one message
+  Count,      // a fixed number of messages
+  UntilEmpty, // messages until an empty one
+};
+
+// One 'y' clock sync ping: the host's clock either side of it and the
+// device's timestamps from the reply (see timesync.h)
+struct SyncSample {
+  uint64_t host_send_us;
+  uint64_t device_rx_us;
+  uint64_t device_tx_us;
+  uint64_t host_receive_us;
+  uint64_t sof_us;
+  uint16_t sof_frame;
+};
+
+struct Request {
+  std::vector<uint8_t> command;
+  Reply reply = Reply::Single;
+  int count = 1;
+  char reply_type = 0; // if it isn't the command letter, as with 's' and 'd'
+
+  char type() const { return reply_type ? reply_type : static_cast<char>(command.at(0)); }
+};
+
+class Client {
+ public:
+  // window is how many requests may be waiting on replies at once. Commands
+  // have to fit in one packet for that to be safe, as the firmware reads a
+  // packet per command
+  explicit Client(Transport &transport, int window = 4, int timeout_ms = 2000);
+
+  // Runs the requests pipelined and returns each one's replies, in request
+  // order. Throws std::runtime_error if the device stops answering
+  std::vector<std::vector<Message>> run(const std::vector<Request> &requests);
+  std::vector<Message> run(const Request &request);
+
+  // Convenience wrappers; each returns the reply payload. Setters reply with
+  // the config the keyboard ended up with
+  std::vector<uint8_t> keymap();
+  std::vector<uint8_t> set_keymap(const std::vector<uint8_t> &config);
+  std::vector<uint8_t> reset();
+  std::vector<uint8_t> socd(const std::vector<uint8_t> &config = {});
+  std::vector<uint8_t> combos(const std::vector<uint8_t> &config = {});
+  std::vector<uint8_t> taphold(const std::vector<uint8_t> &config = {});
+  std::vector<uint8_t> analog(const std::vector<uint8_t> &config = {});
+  std::vector<uint8_t> profile(int index = -1, bool persist = false);
+  std::vector<uint8_t> boot_trace();
+  std::vector<uint8_t> scan_bench();
+  std::vector<uint8_t> recorder_dump();
+  // Short, or empty, if keys were in use
+  std::vector<Message> debounce_bench();
+  SyncSample sync_ping(uint32_t tag);
+
+  Transport &transport() { return transport_; }
+
+  // Unprompted messages, like the 'r' raw key state
+  std::function<void(const Message &)> on_unsolicited;
+
+ private:
+  struct Pending {
+    size_t index;
+    const Request *request;
+    std::vector<Message> replies;
+  };
+
+  std::vector<uint8_t> single(char type, const std::vector<uint8_t> &args = {}, char reply_type = 0);
+  void receive();
+  bool deliver(const Message &message, std::deque<Pending> &in_flight,
+               std::vector<std::vector<Message>> &results);
+
+  Transport &transport_;
+  int window_;
+  int timeout_ms_;
+  std::vector<uint8_t> stream_;
+  std::deque<Message> inbox_;
+};
+
+// Opens the first keyboard on USB; throws if there isn't one or the build
+// has no libusb
+std::unique_ptr<Transport> open_usb();
+
+// Runs the firmware in-process; see sim.c
+std::unique_ptr<Transport> open_loopback();
+
+std::string to_hex(const std::vector<uint8_t> &data);
+std::vector<uint8_t> from_hex(const std::string &text);
+
+} // namespace kb
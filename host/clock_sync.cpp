@@ -0,0 +1,120 @@
+#include "clock_sync.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace kb {
+
+namespace {
+
+// Time spent on the wire and in the stacks, with the device's own turnaround
+// taken out
+double round_trip(const SyncSample &s) {
+  return static_cast<double>(s.host_receive_us - s.host_send_us) -
+         static_cast<double>(s.device_tx_us - s.device_rx_us);
+}
+
+// Host minus device, assuming the trip out took as long as the trip back
+double offset(const SyncSample &s) {
+  return (static_cast<double>(s.host_send_us) + static_cast<double>(s.host_receive_us)) / 2 -
+         (static_cast<double>(s.device_rx_us) + static_cast<double>(s.device_tx_us)) / 2;
+}
+
+double device_mid(const SyncSample &s) {
+  return (static_cast<double>(s.device_rx_us) + static_cast<double>(s.device_tx_us)) / 2;
+}
+
+} // namespace
+
+void ClockSync::add(const SyncSample &sample) {
+  samples_.push_back(sample);
+  fit();
+}
+
+// A ping sent as soon as the last reply lands goes out at the same point in
+// the frame every time, and so gets the same uneven trip; a varying wait
+// between pings moves them across the frame so some catch the short trip
+void ClockSync::run(Client &client, int count) {
+  for (int i = 0; i < count; i++) {
+    samples_.push_back(client.sync_ping(static_cast<uint32_t>(samples_.size() + 1)));
+    client.transport().wait_us(static_cast<uint64_t>(i * 389 % 1000));
+  }
+  fit();
+}
+
+// Pings that sat in a queue somewhere only have a longer round trip, never a
+// shorter one, so in each stretch of pings the quickest is the one to
+// believe. A line through those gives the offset and the drift between the
+// crystals
+void ClockSync::fit() {
+  fitted_ = false;
+  if (samples_.empty())
+    return;
+
+  size_t bins = std::max<size_t>(1, std::min<size_t>(16, samples_.size() / 8));
+  std::vector<size_t> order;
+  for (size_t bin = 0; bin < bins; bin++) {
+    size_t first = samples_.size() * bin / bins, last = samples_.size() * (bin + 1) / bins;
+    size_t quickest = first;
+    for (size_t i = first; i < last; i++) {
+      if (round_trip(samples_[i]) < round_trip(samples_[quickest]))
+        quickest = i;
+    }
+    order.push_back(quickest);
+  }
+
+  best_ = order[0];
+  for (size_t i : order) {
+    if (round_trip(samples_[i]) < round_trip(samples_[best_]))
+      best_ = i;
+  }
+  used_ = order.size();
+
+  double mean_x = 0, mean_y = 0;
+  for (size_t i : order) {
+    mean_x += device_mid(samples_[i]);
+    mean_y += offset(samples_[i]);
+  }
+  mean_x /= used_;
+  mean_y /= used_;
+
+  double sxx = 0, sxy = 0;
+  for (size_t i : order) {
+    double dx = device_mid(samples_[i]) - mean_x;
+    sxx += dx * dx;
+    sxy += dx * (offset(samples_[i]) - mean_y);
+  }
+
+  // Under a second of pings can't tell drift from jitter
+  drift_ = sxx > 0 && used_ > 2 && samples_.back().device_rx_us - samples_.front().device_rx_us > 1000000
+           ? sxy / sxx : 0;
+  reference_ = static_cast<uint64_t>(mean_x);
+  offset_ = mean_y + drift_ * (reference_ - mean_x);
+
+  double squares = 0;
+  for (size_t i : order) {
+    double r = offset(samples_[i]) - (offset_ + drift_ * (device_mid(samples_[i]) - reference_));
+    squares += r * r;
+  }
+  residual_ = std::sqrt(squares / used_);
+  error_ = round_trip(samples_[best_]) / 2;
+  fitted_ = true;
+}
+
+int64_t ClockSync::to_host(uint64_t device_us) const {
+  double since = static_cast<double>(device_us) - static_cast<double>(reference_);
+  return static_cast<int64_t>(std::llround(static_cast<double>(device_us) + offset_ + drift_ * since));
+}
+
+uint64_t ClockSync::unwrap(uint32_t device_us) const {
+  uint64_t base = reference_ & ~static_cast<uint64_t>(0xffffffff);
+  uint64_t time = base | device_us;
+  // Whichever of this wrap or its neighbours lands nearest the reference
+  if (time > reference_ && time - reference_ > 0x80000000ull && time >= 0x100000000ull)
+    time -= 0x100000000ull;
+  else if (time < reference_ && reference_ - time > 0x80000000ull)
+    time += 0x100000000ull;
+  return time;
+}
+
+} // namespace kb
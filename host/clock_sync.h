@@ -0,0 +1,51 @@
+#pragma once
+
+// Maps the keyboard's time_us_64() onto a host clock, from 'y' pings
+#include <cstdint>
+#include <vector>
+
+#include "client.h"
+
+namespace kb {
+
+class ClockSync {
+ public:
+  void add(const SyncSample &sample);
+
+  // Pings the keyboard count times and fits to the lot
+  void run(Client &client, int count);
+
+  bool ready() const { return fitted_; }
+
+  // Host time for a device time, in the transport's clock
+  int64_t to_host(uint64_t device_us) const;
+
+  // Recorder stamps are time_us_32(); this picks the 64 bit time nearest to
+  // the pings that wraps to it
+  uint64_t unwrap(uint32_t device_us) const;
+
+  double offset_us() const { return offset_; }
+  double drift_ppm() const { return drift_ * 1e6; }
+  // Half the best round trip: how far off the offset can be if the trip out
+  // and back weren't even
+  double error_us() const { return error_; }
+  double residual_us() const { return residual_; }
+  size_t samples() const { return samples_.size(); }
+  size_t used() const { return used_; } // the quickest ping of each stretch
+  const SyncSample &best() const { return samples_.at(best_); }
+
+ private:
+  void fit();
+
+  std::vector<SyncSample> samples_;
+  bool fitted_ = false;
+  uint64_t reference_ = 0; // device time the fit is centred on
+  double offset_ = 0;      // host minus device at reference_
+  double drift_ = 0;       // host us gained per device us
+  double error_ = 0;
+  double residual_ = 0;
+  size_t used_ = 0;
+  size_t best_ = 0;
+};
+
+} // namespace kb
@@ -0,0 +1,483 @@
+// Command line client for the keyboard's vendor protocol:
+//   kbtool [--loopback] [--window N] <command> [args]
+// Configs are read and written as hex, so they can be kept in files and
+// pushed to a whole fleet from a script
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "client.h"
+#include "clock_sync.h"
+#include "sim.h"
+
+extern "C" {
+#include "keyboard.h"
+#include "bench.h"
+#include "recorder.h"
+#include "boot.h"
+#include "capture.h"
+#include "webusb.h"
+#include "mousekeys.h"
+#include "power.h"
+#include "governor.h"
+#include "chatter.h"
+#include "split.h"
+#include "log.h"
+}
+
+namespace {
+
+void usage() {
+  std::fprintf(stderr,
+    "usage: kbtool [--loopback] [--window N] <command> [args]\n"
+    "  keymap                     print the keymap\n"
+    "  set-keymap HEX|@FILE       set the keymap, saved to the active profile\n"
+    "  reset                      back to the default keymap\n"
+    "  socd|combos|taphold|analog [HEX|@FILE]  read, or set, that part of the config\n"
+    "  profile [N [persist]]      active profile, or switch to N\n"
+    "  push @FILE...              set-keymap for each file, pipelined\n"
+    "  trace                      boot trace\n"
+    "  scan-bench                 scan and report path cycle counts\n"
+    "  debounce-bench             debounce algorithm benchmark\n"
+    "  dump [sync]                flight recorder; with sync, on the host clock too\n"
+    "  capture [KEY [any|press|release] [KHZ]]  arm the pin capture on KEY, or its status\n"
+    "  capture-dump               a finished capture, as runs of identical samples\n"
+    "  wake-stats                 how long the last wake from suspend took to reach the host\n"
+    "  clocks                     clock governor levels and time spent at each\n"
+    "  key-health                 bounces, learned debounce window and failing flags per key\n"
+    "  split-stats                frames and errors on the split keyboard link\n"
+    "  log                        what the keyboard has logged since the last time\n"
+    "  tx-stats                   the keyboard's send queue: messages sent and dropped\n"
+    "  sync [N]                   N clock sync pings, and the offset and drift they give\n"
+    "  mouse-curve [MS] [diagonal] the mouse keys' pointer motion over MS ms of holding\n"
+    "  throughput [N]             N keymap pushes and reads on the loopback at each window size\n"
+    "  split-loopback [N] [PPM]   N key changes from a simulated other half, PPM bit errors on the wire\n");
+}
+
+std::vector<uint8_t> config_arg(const std::string &arg) {
+  if (arg.empty() || arg[0] != '@')
+    return kb::from_hex(arg);
+
+  std::ifstream file(arg.substr(1));
+  if (!file)
+    throw std::runtime_error("can't open " + arg.substr(1));
+  std::stringstream text;
+  text << file.rdbuf();
+  return kb::from_hex(text.str());
+}
+
+template <typename T>
+std::vector<T> unpack(const std::vector<uint8_t> &data) {
+  std::vector<T> items(data.size() / sizeof(T));
+  std::memcpy(items.data(), data.data(), items.size() * sizeof(T));
+  return items;
+}
+
+const char *boot_stage_names[BOOT_STAGES] = {
+  "main", "board_init", "flash_read", "keymap_ready", "usb_init",
+  "first_scan", "mounted", "first_report", "config_saved",
+};
+
+const char *record_type_names[] = {
+  "?", "raw_edge", "key_edge", "slot_full", "hid_busy", "hid_sent",
+};
+
+void print_trace(const std::vector<uint8_t> &data) {
+  std::vector<uint32_t> stages = unpack<uint32_t>(data);
+  for (size_t i = 0; i < stages.size() && i < BOOT_STAGES; i++) {
+    if (stages[i] == 0)
+      std::printf("%-14s -\n", boot_stage_names[i]);
+    else
+      std::printf("%-14s %u us\n", boot_stage_names[i], stages[i]);
+  }
+}
+
+void print_scan_bench(const std::vector<uint8_t> &data) {
+  if (data.empty())
+    throw std::runtime_error("keys in use, let go of everything and try again");
+  std::vector<ScanBench> results = unpack<ScanBench>(data);
+  if (results.empty())
+    throw std::runtime_error("short scan benchmark reply");
+
+  const ScanBench &b = results[0];
+  std::printf("keys %u, budget %u cycles\n", b.keys, b.budget);
+  std::printf("update   avg %u max %u\n", b.update_avg, b.update_max);
+  std::printf("cold     avg %u max %u\n", b.update_cold_avg, b.update_cold_max);
+  std::printf("pressed  avg %u max %u\n", b.pressed_avg, b.pressed_max);
+  std::printf("press    avg %u\nrelease  avg %u\nraw      avg %u\n",
+              b.key_press_avg, b.key_release_avg, b.raw_report_avg);
+  std::printf("%s\n", b.over_budget ? "OVER BUDGET" : "within budget");
+}
+
+void print_debounce_bench(const std::vector<kb::Message> &messages) {
+  if (messages.empty())
+    throw std::runtime_error("keys in use, let go of everything and try again");
+
+  std::printf("trace alg window  press min/med/p95/max    release min/med/p95/max  false missed\n");
+  for (const kb::Message &message : messages) {
+    for (const BenchResult &r : unpack<BenchResult>(message.data)) {
+      std::printf("%5u %3u %6u  %5u %5u %5u %5u  %5u %5u %5u %5u  %5u %6u\n",
+                  r.trace, r.algorithm, r.window_us,
+                  r.press_min, r.press_median, r.press_p95, r.press_max,
+                  r.release_min, r.release_median, r.release_p95, r.release_max,
+                  r.false_triggers, r.missed);
+    }
+  }
+  if (messages.size() < BENCH_RESULTS)
+    std::printf("cut short by a key going down, %zu of %d\n", messages.size(), BENCH_RESULTS);
+}
+
+void print_dump(const std::vector<uint8_t> &data, const kb::ClockSync *sync = nullptr) {
+  for (const Record &r : unpack<Record>(data)) {
+    const char *name = r.type < sizeof(record_type_names) / sizeof(*record_type_names)
+                       ? record_type_names[r.type] : "?";
+    if (sync)
+      std::printf("%16lld ", static_cast<long long>(sync->to_host(sync->unwrap(r.time))));
+    std::printf("%10u %-9s key %3u data %u\n", r.time, name, r.key, r.data);
+  }
+}
+
+void print_sync(const kb::ClockSync &sync) {
+  const kb::SyncSample &best = sync.best();
+  std::printf("%zu pings, fitted to the quickest of %zu stretches\n", sync.samples(), sync.used());
+  std::printf("offset   %.1f us (host minus device)\n", sync.offset_us());
+  std::printf("drift    %.2f ppm\n", sync.drift_ppm());
+  std::printf("error    +/- %.1f us, residual %.1f us\n", sync.error_us(), sync.residual_us());
+  std::printf("frame    %u seen at device %llu us\n", best.sof_frame,
+              static_cast<unsigned long long>(best.sof_us));
+}
+
+const char *capture_state_names[] = {"idle", "armed", "triggered", "done"};
+
+void print_capture_status(const std::vector<uint8_t> &data) {
+  std::vector<CaptureStatus> status = unpack<CaptureStatus>(data);
+  if (status.empty())
+    throw std::runtime_error("short capture status reply");
+
+  const CaptureStatus &c = status[0];
+  std::printf("%s, key %u edge %u, %u Hz, %u samples, trigger at %u\n",
+              c.state < 4 ? capture_state_names[c.state] : "?", c.key, c.edge,
+              c.rate_hz, c.samples, c.trigger);
+}
+
+// One line per run: first sample index, length, and the pin bank in hex
+void print_capture_dump(kb::Client &client) {
+  std::vector<uint8_t> status = client.run(kb::Request{{'w'}}).at(0).data;
+  print_capture_status(status);
+
+  uint32_t sample = 0;
+  for (const kb::Message &chunk : client.run(kb::Request{{'g'}, kb::Reply::UntilEmpty})) {
+    for (const CaptureRun &run : unpack<CaptureRun>(chunk.data)) {
+      std::printf("%8u %8u %08x\n", sample, run.count, run.pins);
+      sample += run.count;
+    }
+  }
+}
+
+// The firmware's integrator run on its own, a ms at a time, to see what a
+// change to the speeds or ramp does before flashing it
+void mouse_curve(int ms, bool diagonal) {
+  MouseMotion m = {};
+  m.held = 1 << MOUSE_KEY_RIGHT | (diagonal ? 1 << MOUSE_KEY_DOWN : 0);
+
+  int32_t total = 0;
+  std::printf("    ms  px/s  total px\n");
+  for (int t = 1; t <= ms; t++) {
+    mousekeys_integrate(&m, 1);
+    total += m.x / 65536;
+    m.x %= 65536;
+    if (t % 50 == 0 || t == 1)
+      std::printf("%6d %5d %9d\n", t, static_cast<int>(static_cast<int64_t>(m.speed) * 1000 / 65536), total);
+  }
+}
+
+// Bulk pushes against the in-process firmware, to see what pipelining buys
+// and what the protocol costs without a keyboard on the desk
+void throughput(int pushes) {
+  std::unique_ptr<kb::Transport> transport = kb::open_loopback();
+  kb::Client setup(*transport);
+  std::vector<uint8_t> keymap = setup.keymap();
+
+  std::vector<kb::Request> requests;
+  for (int i = 0; i < pushes; i++) {
+    kb::Request set{{'s'}, kb::Reply::Single, 1, 'c'};
+    set.command.insert(set.command.end(), keymap.begin(), keymap.end());
+    requests.push_back(set);
+    requests.push_back(kb::Request{{'c'}});
+  }
+
+  std::printf("window  requests  sim ms   wall ms\n");
+  for (int window = 1; window <= 8; window *= 2) {
+    kb::Client client(*transport, window);
+    uint64_t sim_start = sim_time_us();
+    auto wall_start = std::chrono::steady_clock::now();
+
+    std::vector<std::vector<kb::Message>> replies = client.run(requests);
+
+    double wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wall_start).count();
+    for (size_t i = 0; i < replies.size(); i++) {
+      if (replies[i].size() != 1 || replies[i][0].data != keymap)
+        throw std::runtime_error("reply " + std::to_string(i) + " doesn't match the keymap");
+    }
+    std::printf("%6d  %8zu  %6.1f  %8.2f\n", window, requests.size(),
+                (sim_time_us() - sim_start) / 1000.0, wall_ms);
+  }
+}
+
+// The firmware only sends format IDs; the strings come from the same table
+#define LOG_STRING(id, format) format,
+const char *log_formats[] = { LOG_FORMATS(LOG_STRING) };
+
+void print_log(const std::vector<kb::Message> &messages) {
+  for (const kb::Message &message : messages) {
+    for (const LogEntry &e : unpack<LogEntry>(message.data)) {
+      char text[128];
+      if (e.id < LOG_FORMAT_COUNT)
+        std::snprintf(text, sizeof(text), log_formats[e.id], e.args[0], e.args[1], e.args[2]);
+      else
+        std::snprintf(text, sizeof(text), "unknown log entry %u: %u %u %u", e.id, e.args[0], e.args[1], e.args[2]);
+      std::printf("%10u %s\n", e.time, text);
+    }
+  }
+}
+
+void print_split_stats(const std::vector<uint8_t> &data) {
+  std::vector<SplitStats> stats = unpack<SplitStats>(data);
+  if (stats.empty())
+    throw std::runtime_error("short split link reply");
+
+  const SplitStats &s = stats[0];
+  std::printf("%s, link %s, %u remote keys\n", s.secondary ? "secondary" : "primary",
+              s.link_up ? "up" : "down", s.keys);
+  std::printf("frames %u, crc errors %u, sequence gaps %u, repaired by full state %u, timeouts %u\n",
+              s.frames, s.crc_errors, s.seq_gaps, s.repairs, s.timeouts);
+}
+
+// Plays the other half of a split board against the in-process firmware:
+// the first few keys are moved to the link, and each change goes over the
+// simulated UART as the secondary would send it, with a full state every
+// SPLIT_STATE_MS. Latency is from the frame starting on the wire to the
+// primary's scan seeing the key, so it includes waiting for that scan
+void split_loopback(int changes, int error_ppm) {
+  const int remote = 4;
+  std::unique_ptr<kb::Transport> transport = kb::open_loopback();
+  kb::Client client(*transport);
+
+  std::vector<uint8_t> keymap = client.keymap();
+  for (int i = 0; i < remote; i++)
+    keymap[i * KEY_CONFIG_SIZE] = SPLIT_PIN_BASE + i;
+  client.set_keymap(keymap);
+
+  std::mt19937 rng(1);
+  SplitTx tx = {};
+  uint8_t state[SPLIT_MAX_KEYS / 8] = {};
+  uint64_t state_sent = 0;
+
+  auto send = [&](uint8_t frame[], int length) {
+    for (int i = 0; i < length; i++) {
+      if (static_cast<int>(rng() % 1000000) < error_ppm * 8)
+        frame[i] ^= 1 << (rng() % 8);
+    }
+    sim_split_write(frame, length);
+  };
+  auto step = [&]() {
+    sim_step();
+    if (sim_time_us() - state_sent >= SPLIT_STATE_MS * 1000) {
+      uint8_t frame[SPLIT_FRAME_MAX];
+      send(frame, split_encode_state(&tx, state, remote, frame));
+      state_sent = sim_time_us();
+    }
+  };
+
+  std::vector<uint64_t> latency;
+  int lost = 0;
+  for (int c = 0; c < changes; c++) {
+    for (int wait = 40 + rng() % 200; wait > 0; wait--)
+      step();
+
+    int key = rng() % remote;
+    bool down = !(state[0] & 1 << key);
+    state[0] ^= 1 << key;
+
+    uint8_t event = key | (down ? SPLIT_KEY_DOWN : 0);
+    uint8_t frame[SPLIT_FRAME_MAX];
+    send(frame, split_encode_delta(&tx, &event, 1, frame));
+
+    uint64_t start = sim_time_us();
+    while (get_raw_report()[key] != down && sim_time_us() - start < SPLIT_TIMEOUT_MS * 1000)
+      step();
+    if (get_raw_report()[key] == down)
+      latency.push_back(sim_time_us() - start);
+    else
+      lost++;
+  }
+
+  std::sort(latency.begin(), latency.end());
+  auto at = [&](size_t percent) { return latency.empty() ? 0 : latency[(latency.size() - 1) * percent / 100]; };
+  std::printf("%d changes, %zu seen, %d never; a delta is %d us on the wire, scans every %d us\n",
+              changes, latency.size(), lost, 3 * 10 * 1000000 / SPLIT_BAUD, KEYBOARD_SCAN_RATE_US);
+  std::printf("latency min %llu median %llu p99 %llu max %llu us\n",
+              static_cast<unsigned long long>(at(0)), static_cast<unsigned long long>(at(50)),
+              static_cast<unsigned long long>(at(99)), static_cast<unsigned long long>(at(100)));
+  print_split_stats(client.run(kb::Request{{'n'}}).at(0).data);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  bool loopback = false;
+  int window = 4;
+  std::vector<std::string> args;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--loopback")
+      loopback = true;
+    else if (arg == "--window" && i + 1 < argc)
+      window = std::stoi(argv[++i]);
+    else
+      args.push_back(arg);
+  }
+
+  if (args.empty()) {
+    usage();
+    return 2;
+  }
+
+  try {
+    const std::string &command = args[0];
+    std::string arg = args.size() > 1 ? args[1] : "";
+
+    if (command == "mouse-curve") {
+      mouse_curve(arg.empty() ? 1000 : std::stoi(arg), args.size() > 2 && args[2] == "diagonal");
+      return 0;
+    }
+    if (command == "throughput") {
+      throughput(arg.empty() ? 100 : std::stoi(arg));
+      return 0;
+    }
+    if (command == "split-loopback") {
+      split_loopback(arg.empty() ? 1000 : std::stoi(arg), args.size() > 2 ? std::stoi(args[2]) : 0);
+      return 0;
+    }
+
+    std::unique_ptr<kb::Transport> transport = loopback ? kb::open_loopback() : kb::open_usb();
+    kb::Client client(*transport, window);
+
+    if (command == "keymap") {
+      std::printf("%s\n", kb::to_hex(client.keymap()).c_str());
+    } else if (command == "set-keymap" && !arg.empty()) {
+      std::printf("%s\n", kb::to_hex(client.set_keymap(config_arg(arg))).c_str());
+    } else if (command == "reset") {
+      std::printf("%s\n", kb::to_hex(client.reset()).c_str());
+    } else if (command == "socd") {
+      std::printf("%s\n", kb::to_hex(client.socd(arg.empty() ? std::vector<uint8_t>{} : config_arg(arg))).c_str());
+    } else if (command == "combos") {
+      std::printf("%s\n", kb::to_hex(client.combos(arg.empty() ? std::vector<uint8_t>{} : config_arg(arg))).c_str());
+    } else if (command == "taphold") {
+      std::printf("%s\n", kb::to_hex(client.taphold(arg.empty() ? std::vector<uint8_t>{} : config_arg(arg))).c_str());
+    } else if (command == "analog") {
+      std::printf("%s\n", kb::to_hex(client.analog(arg.empty() ? std::vector<uint8_t>{} : config_arg(arg))).c_str());
+    } else if (command == "profile") {
+      bool persist = args.size() > 2 && args[2] == "persist";
+      std::vector<uint8_t> reply = client.profile(arg.empty() ? -1 : std::stoi(arg), persist);
+      if (reply.size() < 2)
+        throw std::runtime_error("short profile reply");
+      std::printf("active %u, saved mask 0x%02x\n", reply[0], reply[1]);
+    } else if (command == "push") {
+      std::vector<kb::Request> requests;
+      for (size_t i = 1; i < args.size(); i++) {
+        kb::Request set{{'s'}, kb::Reply::Single, 1, 'c'};
+        std::vector<uint8_t> config = config_arg(args[i]);
+        set.command.insert(set.command.end(), config.begin(), config.end());
+        requests.push_back(set);
+      }
+      std::vector<std::vector<kb::Message>> replies = client.run(requests);
+      for (size_t i = 0; i < replies.size(); i++)
+        std::printf("%s %s\n", args[i + 1].c_str(), kb::to_hex(replies[i].at(0).data).c_str());
+    } else if (command == "trace") {
+      print_trace(client.boot_trace());
+    } else if (command == "scan-bench") {
+      // SysTick doesn't run in the sim, so every count would be zero
+      if (loopback)
+        throw std::runtime_error("no cycle counter on the loopback; ctest -R scan_scaling times the scan on the host");
+      print_scan_bench(client.scan_bench());
+    } else if (command == "debounce-bench") {
+      print_debounce_bench(client.debounce_bench());
+    } else if (command == "capture") {
+      kb::Request request{{'w'}};
+      if (!arg.empty()) {
+        request.command.push_back(static_cast<uint8_t>(std::stoi(arg)));
+        std::string edge = args.size() > 2 ? args[2] : "any";
+        request.command.push_back(edge == "press" ? CAPTURE_EDGE_PRESS :
+                                  edge == "release" ? CAPTURE_EDGE_RELEASE : CAPTURE_EDGE_ANY);
+        int khz = args.size() > 3 ? std::stoi(args[3]) : CAPTURE_DEFAULT_KHZ;
+        request.command.push_back(static_cast<uint8_t>(khz & 0xff));
+        request.command.push_back(static_cast<uint8_t>(khz >> 8));
+      }
+      print_capture_status(client.run(request).at(0).data);
+    } else if (command == "capture-dump") {
+      print_capture_dump(client);
+    } else if (command == "wake-stats") {
+      std::vector<WakeStats> stats = unpack<WakeStats>(client.run(kb::Request{{'u'}}).at(0).data);
+      if (stats.empty())
+        throw std::runtime_error("short wake stats reply");
+      const WakeStats &w = stats[0];
+      std::printf("%u wakes; last: key to resume %u us, resume to report %u us, %u us in all; worst %u us\n",
+                  w.wakes, w.wake_to_resume, w.resume_to_report, w.wake_to_report, w.worst_wake_to_report);
+    } else if (command == "clocks") {
+      std::vector<GovernorStats> stats = unpack<GovernorStats>(client.run(kb::Request{{'z'}}).at(0).data);
+      if (stats.empty())
+        throw std::runtime_error("short clock governor reply");
+      const GovernorStats &g = stats[0];
+      for (int i = 0; i < GOVERNOR_LEVELS; i++)
+        std::printf("%c %6u kHz %10u ms\n", static_cast<int>(g.level) == i ? '*' : ' ', g.khz[i], g.residency_ms[i]);
+      std::printf("  suspended  %10u ms\n%u switches\n", g.suspended_ms, g.switches);
+    } else if (command == "key-health") {
+      std::printf("key  presses  bounces escapes settle   max window\n");
+      for (const kb::Message &chunk : client.run(kb::Request{{'a'}, kb::Reply::UntilEmpty})) {
+        for (const ChatterStats &s : unpack<ChatterStats>(chunk.data)) {
+          std::printf("%3u %8u %8u %7u %6u %5u %6u %s%s\n", s.key, s.presses, s.bounces, s.escapes,
+                      s.settle_us, s.settle_max_us, s.window_us,
+                      s.flags & CHATTER_SLOW ? " slow" : "", s.flags & CHATTER_ESCAPING ? " escaping" : "");
+        }
+      }
+    } else if (command == "split-stats") {
+      print_split_stats(client.run(kb::Request{{'n'}}).at(0).data);
+    } else if (command == "log") {
+      print_log(client.run(kb::Request{{'l'}, kb::Reply::UntilEmpty}));
+    } else if (command == "tx-stats") {
+      std::vector<WebusbStats> stats = unpack<WebusbStats>(client.run(kb::Request{{'q'}}).at(0).data);
+      if (stats.empty())
+        throw std::runtime_error("short send queue reply");
+      std::printf("sent %u, dropped %u, %u bytes queued, high water %u of %u\n",
+                  stats[0].sent, stats[0].dropped, stats[0].queued, stats[0].high_water, WEBUSB_TX_RING);
+    } else if (command == "sync") {
+      kb::ClockSync sync;
+      sync.run(client, arg.empty() ? 100 : std::stoi(arg));
+      print_sync(sync);
+    } else if (command == "dump") {
+      // Synced before the dump, as the dump only ends once it's all read
+      kb::ClockSync sync;
+      if (arg == "sync")
+        sync.run(client, 100);
+      print_dump(client.recorder_dump(), sync.ready() ? &sync : nullptr);
+    } else {
+      usage();
+      return 2;
+    }
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "kbtool: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
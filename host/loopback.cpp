@@ -0,0 +1,50 @@
+#include "client.h"
+#include "sim.h"
+
+namespace kb {
+
+namespace {
+
+// Time only passes while we wait on a reply, a scan per simulated 125us
+class LoopbackTransport : public Transport {
+ public:
+  LoopbackTransport() { sim_reboot(); }
+
+  void send(const std::vector<uint8_t> &command) override {
+    while (!sim_host_write(command.data(), command.size()))
+      sim_step(); // the firmware hasn't caught up with our earlier writes
+  }
+
+  std::vector<uint8_t> receive(int timeout_ms) override {
+    uint64_t deadline = sim_time_us() + static_cast<uint64_t>(timeout_ms) * 1000;
+    std::vector<uint8_t> data(SIM_PACKET_SIZE * 16);
+    uint32_t len = 0;
+    while (len == 0 && sim_time_us() < deadline) {
+      sim_step();
+      len = sim_host_read(data.data(), data.size());
+    }
+    data.resize(len);
+    return data;
+  }
+
+  void wait_us(uint64_t us) override {
+    uint64_t until = sim_time_us() + us;
+    while (sim_time_us() < until)
+      sim_step();
+  }
+
+  // A host clock that's a long way from the simulated device's and runs a
+  // little fast, so clock sync has something to find
+  uint64_t now_us() override {
+    uint64_t device_us = sim_time_us();
+    return 1700000000000ull + device_us + device_us * 37 / 1000000;
+  }
+};
+
+} // namespace
+
+std::unique_ptr<Transport> open_loopback() {
+  return std::make_unique<LoopbackTransport>();
+}
+
+} // namespace kb
@@ -0,0 +1,21 @@
+#ifndef HOST_HARDWARE_ADC_H_
+#define HOST_HARDWARE_ADC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+  volatile uint32_t cs, result, fcs, fifo, div, intr, inte, intf, ints;
+} adc_hw_t;
+
+extern adc_hw_t *adc_hw;
+
+void adc_init(void);
+void adc_gpio_init(unsigned pin);
+void adc_select_input(unsigned input);
+void adc_set_round_robin(unsigned input_mask);
+void adc_fifo_setup(bool en, bool dreq_en, uint16_t dreq_thresh, bool err_in_fifo, bool byte_shift);
+void adc_set_clkdiv(float clkdiv);
+void adc_run(bool run);
+
+#endif
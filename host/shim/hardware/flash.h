@@ -0,0 +1,13 @@
+#ifndef HOST_HARDWARE_FLASH_H_
+#define HOST_HARDWARE_FLASH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FLASH_PAGE_SIZE 256
+#define FLASH_SECTOR_SIZE 4096
+
+void flash_range_erase(uint32_t offset, size_t count);
+void flash_range_program(uint32_t offset, const uint8_t *data, size_t count);
+
+#endif
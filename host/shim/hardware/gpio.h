@@ -0,0 +1,17 @@
+#ifndef HOST_HARDWARE_GPIO_H_
+#define HOST_HARDWARE_GPIO_H_
+
+#include "pico/stdlib.h"
+
+
+#define GPIO_FUNC_SIO 5
+
+#define GPIO_IRQ_EDGE_FALL 0x4u
+#define GPIO_IRQ_EDGE_RISE 0x8u
+
+// sim_pin calls the callback for a pin going low with its interrupt enabled
+typedef void (*gpio_irq_callback_t)(uint gpio, uint32_t events);
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t events, bool enabled, gpio_irq_callback_t callback);
+void gpio_acknowledge_irq(uint gpio, uint32_t events);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef HOST_HARDWARE_PIO_H_
+#define HOST_HARDWARE_PIO_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+typedef struct {
+  volatile uint32_t ctrl, fstat, fdebug, flevel;
+  volatile uint32_t txf[4];
+  volatile uint32_t rxf[4];
+} pio_hw_t;
+
+typedef pio_hw_t *PIO;
+
+extern pio_hw_t sim_pio[2];
+#define pio0 (&sim_pio[0])
+#define pio1 (&sim_pio[1])
+
+typedef struct {
+  float clkdiv;
+} pio_sm_config;
+
+typedef struct pio_program {
+  const uint16_t *instructions;
+  uint8_t length;
+  int8_t origin;
+} pio_program_t;
+
+enum pio_fifo_join { PIO_FIFO_JOIN_NONE = 0, PIO_FIFO_JOIN_TX = 1, PIO_FIFO_JOIN_RX = 2 };
+
+uint pio_add_program(PIO pio, const pio_program_t *program);
+int pio_claim_unused_sm(PIO pio, bool required);
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx);
+
+pio_sm_config pio_get_default_sm_config(void);
+void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap);
+void sm_config_set_in_pins(pio_sm_config *c, uint in_base);
+void sm_config_set_in_shift(pio_sm_config *c, bool shift_right, bool autopush, uint push_threshold);
+void sm_config_set_fifo_join(pio_sm_config *c, enum pio_fifo_join join);
+void sm_config_set_clkdiv(pio_sm_config *c, float div);
+void pio_sm_set_clkdiv(PIO pio, uint sm, float div);
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm);
+
+#endif
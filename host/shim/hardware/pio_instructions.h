@@ -0,0 +1,11 @@
+#ifndef HOST_HARDWARE_PIO_INSTRUCTIONS_H_
+#define HOST_HARDWARE_PIO_INSTRUCTIONS_H_
+
+#include <stdint.h>
+#include "hardware/pio.h"
+
+enum pio_src_dest { pio_pins = 0 };
+
+uint16_t pio_encode_in(enum pio_src_dest src, uint count);
+
+#endif
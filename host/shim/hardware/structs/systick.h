@@ -0,0 +1,12 @@
+#ifndef HOST_HARDWARE_STRUCTS_SYSTICK_H_
+#define HOST_HARDWARE_STRUCTS_SYSTICK_H_
+
+#include <stdint.h>
+
+typedef struct {
+  volatile uint32_t csr, rvr, cvr, calib;
+} systick_hw_t;
+
+extern systick_hw_t *systick_hw;
+
+#endif
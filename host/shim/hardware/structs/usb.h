@@ -0,0 +1,15 @@
+#ifndef HOST_HARDWARE_STRUCTS_USB_H_
+#define HOST_HARDWARE_STRUCTS_USB_H_
+
+#include <stdint.h>
+
+#define USB_SOF_RD_BITS 0x000007ffu
+
+// Only the frame counter; sim.c sets it from the simulated 1ms frames
+typedef struct {
+  volatile uint32_t sof_rd;
+} usb_hw_t;
+
+extern usb_hw_t *usb_hw;
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef HOST_HARDWARE_STRUCTS_XIP_CTRL_H_
+#define HOST_HARDWARE_STRUCTS_XIP_CTRL_H_
+
+#include <stdint.h>
+
+typedef struct {
+  volatile uint32_t ctrl, flush, stat, ctr_hit, ctr_acc, stream_addr, stream_ctr, stream_fifo;
+} xip_ctrl_hw_t;
+
+extern xip_ctrl_hw_t *xip_ctrl_hw;
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef HOST_HARDWARE_SYNC_H_
+#define HOST_HARDWARE_SYNC_H_
+
+#include <stdint.h>
+
+// Nothing to sleep on in the sim; the loop just goes round again
+static inline void __wfe(void) {}
+static inline void __sev(void) {}
+
+// No interrupts either, the sim is one thread
+static inline uint32_t save_and_disable_interrupts(void) { return 0; }
+static inline void restore_interrupts(uint32_t status) { (void) status; }
+
+#endif
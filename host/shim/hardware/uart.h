@@ -0,0 +1,21 @@
+#ifndef HOST_HARDWARE_UART_H_
+#define HOST_HARDWARE_UART_H_
+
+#include "pico/stdlib.h"
+
+// One UART, whose receive side is fed by sim_split_write at the link's baud
+// rate; what's written is kept for sim_split_read
+typedef struct uart_inst uart_inst_t;
+#define uart0 ((uart_inst_t *) 0)
+#define uart1 ((uart_inst_t *) 1)
+
+#define GPIO_FUNC_UART 2
+void gpio_set_function(unsigned pin, unsigned function);
+
+uint uart_init(uart_inst_t *uart, uint baudrate);
+uint uart_set_baudrate(uart_inst_t *uart, uint baudrate);
+bool uart_is_readable(uart_inst_t *uart);
+char uart_getc(uart_inst_t *uart);
+void uart_write_blocking(uart_inst_t *uart, const uint8_t *src, size_t len);
+
+#endif
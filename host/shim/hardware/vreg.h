@@ -0,0 +1,12 @@
+#ifndef HOST_HARDWARE_VREG_H_
+#define HOST_HARDWARE_VREG_H_
+
+enum vreg_voltage {
+  VREG_VOLTAGE_1_10 = 0b1011,
+  VREG_VOLTAGE_1_15 = 0b1100,
+  VREG_VOLTAGE_DEFAULT = VREG_VOLTAGE_1_10,
+};
+
+void vreg_set_voltage(enum vreg_voltage voltage);
+
+#endif
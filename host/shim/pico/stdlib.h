@@ -0,0 +1,36 @@
+// Just enough of the Pico SDK to build the firmware's portable modules on the
+// host; sim.c provides the implementations
+#ifndef HOST_PICO_STDLIB_H_
+#define HOST_PICO_STDLIB_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef unsigned int uint;
+
+#define GPIO_IN 0
+#define GPIO_OUT 1
+
+// Flash reads go through XIP; on the host that's a plain array
+extern uint8_t sim_flash[];
+#define XIP_BASE ((uintptr_t) sim_flash)
+
+// No flash to run from on the host
+#define __not_in_flash_func(name) name
+
+void gpio_init(unsigned pin);
+void gpio_set_dir(unsigned pin, bool out);
+void gpio_pull_up(unsigned pin);
+bool gpio_get(unsigned pin);
+
+static inline void tight_loop_contents(void) {}
+
+// Only change what clock_get_hz(clk_sys) says
+bool set_sys_clock_khz(uint32_t freq_khz, bool required);
+void set_sys_clock_48mhz(void);
+
+uint32_t time_us_32(void);
+uint64_t time_us_64(void);
+
+#endif
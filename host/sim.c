@@ -0,0 +1,589 @@
+/**
+ * Simulated hardware for running the firmware on the host. Time only moves
+ * when sim_step runs a scan, so everything is deterministic. The vendor
+ * endpoint behaves like TinyUSB's at full speed: host writes arrive on the
+ * next 1ms frame, the OUT side hands the firmware one packet per read (the
+ * 64 byte RX FIFO can't hold more), and the IN side is a 64 byte FIFO that
+ * the host empties after every scan.
+ */
+#include "sim.h"
+
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/systick.h"
+#include "hardware/structs/xip_ctrl.h"
+#include "hardware/structs/usb.h"
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+#include "hardware/pio_instructions.h"
+#include "hardware/gpio.h"
+#include "hardware/vreg.h"
+#include "hardware/uart.h"
+#include "tusb.h"
+
+#include "keyboard.h"
+#include "webusb.h"
+#include "power.h"
+#include "governor.h"
+#include "chatter.h"
+#include "split.h"
+
+#define SIM_FLASH_BASE (256 * 1024) // FLASH_TARGET_OFFSET in save.c
+#define SIM_FLASH_SIZE (SIM_FLASH_BASE + 16 * FLASH_SECTOR_SIZE)
+#define SIM_RX_PACKETS 64
+#define SIM_HOST_BUFFER 65536
+#define SIM_RESUME_US 20000 // host resume signalling after a remote wakeup
+#define SIM_UART_BUFFER 4096
+
+uint8_t sim_flash[SIM_FLASH_SIZE];
+bool sim_flash_ready = false;
+
+uint64_t now_us = 0;
+bool pins[32];
+unsigned pin_functions[32]; // GPIO_FUNC_, 0 until the firmware sets a pin up
+bool vbus = true;           // high on the half with USB, see split.h
+
+typedef struct {
+  uint8_t data[SIM_PACKET_SIZE];
+  uint32_t len;
+  uint64_t due; // host writes land on the next 1ms USB frame
+} Packet;
+
+Packet rx[SIM_RX_PACKETS];
+int rx_head = 0;
+int rx_count = 0;
+
+uint8_t tx[SIM_PACKET_SIZE];
+uint32_t tx_count = 0;
+
+uint8_t host_buffer[SIM_HOST_BUFFER];
+uint32_t host_count = 0;
+
+uint32_t sys_clock_hz = 125000000;
+gpio_irq_callback_t gpio_callback = NULL;
+uint32_t gpio_irqs = 0; // pins with a falling edge interrupt enabled
+uint64_t resume_at = 0; // when the host resumes us after a remote wakeup
+
+// A keyboard report handed to the stack reaches the host on the next frame
+bool report_in_flight = false;
+uint64_t report_due = 0;
+uint32_t reports_sent = 0;
+
+// Bytes from the other half of a split board, each readable once it's
+// finished arriving
+typedef struct {
+  uint8_t data;
+  uint64_t due;
+} UartByte;
+
+UartByte uart_rx[SIM_UART_BUFFER];
+uint32_t uart_head = 0;
+uint32_t uart_tail = 0;
+uint64_t uart_line_free = 0; // when the last byte queued is done
+
+// And what we've sent it, as the secondary
+uint8_t uart_tx[SIM_UART_BUFFER];
+uint32_t uart_tx_count = 0;
+
+//--------------------------------------------------------------------+
+// Pico SDK
+//--------------------------------------------------------------------+
+void gpio_init(unsigned pin) {
+  if (pin < 32)
+    pin_functions[pin] = GPIO_FUNC_SIO;
+}
+
+void gpio_set_dir(unsigned pin, bool out) {}
+void gpio_pull_up(unsigned pin) {}
+
+// Keys pull the pin low
+bool gpio_get(unsigned pin) {
+  if (pin == SPLIT_VBUS_PIN)
+    return vbus;
+  return pin < 32 ? !pins[pin] : true;
+}
+
+uint32_t time_us_32(void) {
+  return (uint32_t) now_us;
+}
+
+uint64_t time_us_64(void) {
+  return now_us;
+}
+
+void flash_range_erase(uint32_t offset, size_t count) {
+  if (offset + count <= SIM_FLASH_SIZE)
+    memset(sim_flash + offset, 0xff, count);
+}
+
+// Programming can only clear bits, as on the real part
+void flash_range_program(uint32_t offset, const uint8_t *data, size_t count) {
+  if (offset + count > SIM_FLASH_SIZE)
+    return;
+  for (size_t i = 0; i < count; i++)
+    sim_flash[offset + i] &= data[i];
+}
+
+uint32_t clock_get_hz(enum clock_index clk) {
+  return clk == clk_sys ? sys_clock_hz : 125000000;
+}
+
+bool set_sys_clock_khz(uint32_t freq_khz, bool required) {
+  sys_clock_hz = freq_khz * 1000;
+  return true;
+}
+
+void set_sys_clock_48mhz(void) {
+  sys_clock_hz = 48000000;
+}
+
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t events, bool enabled, gpio_irq_callback_t callback) {
+  if (gpio >= 32 || !(events & GPIO_IRQ_EDGE_FALL))
+    return;
+  gpio_callback = callback;
+  if (enabled)
+    gpio_irqs |= 1u << gpio;
+  else
+    gpio_irqs &= ~(1u << gpio);
+}
+
+void gpio_acknowledge_irq(uint gpio, uint32_t events) {}
+
+void gpio_set_function(unsigned pin, unsigned function) {
+  if (pin < 32)
+    pin_functions[pin] = function;
+}
+
+uint uart_init(uart_inst_t *uart, uint baudrate) {
+  return baudrate;
+}
+
+uint uart_set_baudrate(uart_inst_t *uart, uint baudrate) {
+  return baudrate;
+}
+
+bool uart_is_readable(uart_inst_t *uart) {
+  return uart_head != uart_tail && uart_rx[uart_head % SIM_UART_BUFFER].due <= now_us;
+}
+
+char uart_getc(uart_inst_t *uart) {
+  return uart_rx[uart_head++ % SIM_UART_BUFFER].data;
+}
+
+void uart_write_blocking(uart_inst_t *uart, const uint8_t *src, size_t len) {
+  if (len > SIM_UART_BUFFER - uart_tx_count)
+    len = SIM_UART_BUFFER - uart_tx_count;
+  memcpy(uart_tx + uart_tx_count, src, len);
+  uart_tx_count += len;
+}
+
+void vreg_set_voltage(enum vreg_voltage voltage) {}
+
+// No status LED or pixels to re-time
+void led_clock_changed() {}
+
+systick_hw_t sim_systick;
+systick_hw_t *systick_hw = &sim_systick;
+
+// No cache to flush, everything's already in RAM
+xip_ctrl_hw_t sim_xip_ctrl;
+xip_ctrl_hw_t *xip_ctrl_hw = &sim_xip_ctrl;
+
+// Frame number, moved on by sim_step every simulated 1ms
+usb_hw_t sim_usb;
+usb_hw_t *usb_hw = &sim_usb;
+
+// No analog keys on the host; these only get called if a key is mapped to an
+// ADC pin, and nothing fills the sample buffer so the key reads as up
+adc_hw_t sim_adc;
+adc_hw_t *adc_hw = &sim_adc;
+
+void adc_init(void) {}
+void adc_gpio_init(unsigned pin) {}
+void adc_select_input(unsigned input) {}
+void adc_set_round_robin(unsigned input_mask) {}
+void adc_fifo_setup(bool en, bool dreq_en, uint16_t dreq_thresh, bool err_in_fifo, bool byte_shift) {}
+void adc_set_clkdiv(float clkdiv) {}
+void adc_run(bool run) {}
+
+// Just enough DMA and PIO for the pin capture: a channel reading the RX FIFO
+// of an enabled state machine gets one sample of the pins per PIO clock
+#define SIM_DMA_CHANNELS 12
+
+typedef struct {
+  bool busy;
+  uint8_t *write;
+  const volatile void *read;
+  uint32_t ring_bits;
+  uint32_t offset; // bytes written, for the ring
+} SimDma;
+
+typedef struct {
+  bool enabled;
+  float clkdiv;
+  double phase; // fraction of a sample left over from the last scan
+} SimStateMachine;
+
+dma_hw_t sim_dma;
+dma_hw_t *dma_hw = &sim_dma;
+SimDma sim_dma_channels[SIM_DMA_CHANNELS];
+int sim_dma_claimed = 0;
+
+pio_hw_t sim_pio[2];
+SimStateMachine sim_sm[2][4];
+int sim_sm_claimed[2];
+
+int dma_claim_unused_channel(bool required) {
+  return sim_dma_claimed < SIM_DMA_CHANNELS ? sim_dma_claimed++ : -1;
+}
+
+dma_channel_config dma_channel_get_default_config(unsigned channel) {
+  dma_channel_config config = { 0 };
+  return config;
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size) {}
+void channel_config_set_read_increment(dma_channel_config *c, bool incr) {}
+void channel_config_set_write_increment(dma_channel_config *c, bool incr) {}
+void channel_config_set_dreq(dma_channel_config *c, unsigned dreq) {}
+void channel_config_set_chain_to(dma_channel_config *c, unsigned chain_to) {}
+
+void channel_config_set_ring(dma_channel_config *c, bool write, unsigned size_bits) {
+  c->ring_write = write;
+  c->ring_bits = size_bits;
+}
+
+void dma_channel_configure(unsigned channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, unsigned transfer_count, bool trigger) {
+  SimDma *dma = &sim_dma_channels[channel];
+  dma->write = (uint8_t *) write_addr;
+  dma->read = read_addr;
+  dma->ring_bits = config->ring_write ? config->ring_bits : 0;
+  dma->offset = 0;
+  dma->busy = trigger;
+  sim_dma.ch[channel].transfer_count = transfer_count;
+}
+
+void dma_channel_start(unsigned channel) {
+  sim_dma_channels[channel].busy = true;
+}
+
+void dma_channel_abort(unsigned channel) {
+  sim_dma_channels[channel].busy = false;
+}
+
+bool dma_channel_is_busy(unsigned channel) {
+  return sim_dma_channels[channel].busy && sim_dma.ch[channel].transfer_count > 0;
+}
+
+dma_channel_hw_t *dma_channel_hw_addr(unsigned channel) {
+  return &sim_dma.ch[channel];
+}
+
+uint pio_add_program(PIO pio, const pio_program_t *program) {
+  return 0;
+}
+
+int pio_claim_unused_sm(PIO pio, bool required) {
+  int p = pio == pio1;
+  return sim_sm_claimed[p] < 4 ? sim_sm_claimed[p]++ : -1;
+}
+
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx) {
+  return 0;
+}
+
+pio_sm_config pio_get_default_sm_config(void) {
+  pio_sm_config config = { 1.0f };
+  return config;
+}
+
+void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap) {}
+void sm_config_set_in_pins(pio_sm_config *c, uint in_base) {}
+void sm_config_set_in_shift(pio_sm_config *c, bool shift_right, bool autopush, uint push_threshold) {}
+void sm_config_set_fifo_join(pio_sm_config *c, enum pio_fifo_join join) {}
+
+void sm_config_set_clkdiv(pio_sm_config *c, float div) {
+  c->clkdiv = div;
+}
+
+void pio_sm_set_clkdiv(PIO pio, uint sm, float div) {
+  sim_sm[pio == pio1][sm].clkdiv = div;
+}
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config) {
+  SimStateMachine *state = &sim_sm[pio == pio1][sm];
+  state->enabled = false;
+  state->clkdiv = config->clkdiv;
+  state->phase = 0;
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {
+  sim_sm[pio == pio1][sm].enabled = enabled;
+}
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm) {
+  return true;
+}
+
+uint16_t pio_encode_in(enum pio_src_dest src, uint count) {
+  return 0x4000 | (src << 5) | (count & 0x1f);
+}
+
+// Keys pull their pin low
+static uint32_t sim_pin_bank() {
+  uint32_t bank = 0;
+  for (int pin = 0; pin < 30; pin++) {
+    if (!pins[pin])
+      bank |= 1u << pin;
+  }
+  return bank;
+}
+
+static void sim_sample(uint32_t us) {
+  for (int c = 0; c < sim_dma_claimed; c++) {
+    SimDma *dma = &sim_dma_channels[c];
+    if (!dma->busy)
+      continue;
+
+    for (int p = 0; p < 2; p++) {
+      for (int sm = 0; sm < 4; sm++) {
+        SimStateMachine *state = &sim_sm[p][sm];
+        if (dma->read != &sim_pio[p].rxf[sm] || !state->enabled)
+          continue;
+
+        state->phase += (double) us * clock_get_hz(clk_sys) / 1000000 / state->clkdiv;
+        uint32_t bank = sim_pin_bank();
+        while (state->phase >= 1 && sim_dma.ch[c].transfer_count > 0) {
+          uint32_t offset = dma->ring_bits ? dma->offset & ((1u << dma->ring_bits) - 1) : dma->offset;
+          memcpy(dma->write + offset, &bank, sizeof(bank));
+          dma->offset += sizeof(bank);
+          sim_dma.ch[c].transfer_count--;
+          state->phase -= 1;
+        }
+      }
+    }
+  }
+}
+
+//--------------------------------------------------------------------+
+// TinyUSB device
+//--------------------------------------------------------------------+
+bool tud_remote_wakeup(void) {
+  if (resume_at == 0)
+    resume_at = now_us + SIM_RESUME_US;
+  return true;
+}
+
+//--------------------------------------------------------------------+
+// TinyUSB vendor endpoint
+//--------------------------------------------------------------------+
+uint32_t tud_vendor_available(void) {
+  return rx_count > 0 && rx[rx_head].due <= now_us ? rx[rx_head].len : 0;
+}
+
+uint32_t tud_vendor_read(void *buffer, uint32_t bufsize) {
+  if (tud_vendor_available() == 0)
+    return 0;
+
+  Packet *packet = &rx[rx_head];
+  uint32_t len = packet->len < bufsize ? packet->len : bufsize;
+  memcpy(buffer, packet->data, len);
+
+  rx_head = (rx_head + 1) % SIM_RX_PACKETS;
+  rx_count--;
+  return len;
+}
+
+uint32_t tud_vendor_write_available(void) {
+  return SIM_PACKET_SIZE - tx_count;
+}
+
+// Like TinyUSB, anything that doesn't fit in the FIFO is dropped
+uint32_t tud_vendor_write(void const *buffer, uint32_t bufsize) {
+  uint32_t len = bufsize < tud_vendor_write_available() ? bufsize : tud_vendor_write_available();
+  memcpy(tx + tx_count, buffer, len);
+  tx_count += len;
+  return len;
+}
+
+uint32_t tud_vendor_flush(void) {
+  return 0;
+}
+
+//--------------------------------------------------------------------+
+// Simulation
+//--------------------------------------------------------------------+
+void sim_erase() {
+  memset(sim_flash, 0xff, sizeof(sim_flash));
+  sim_flash_ready = true;
+}
+
+void sim_reboot() {
+  if (!sim_flash_ready)
+    sim_erase();
+
+  // Board and USB bring-up, so boot trace stamps aren't zero
+  now_us += 1000;
+
+  memset(pins, 0, sizeof(pins));
+  memset(pin_functions, 0, sizeof(pin_functions));
+  gpio_irqs = 0;
+  resume_at = 0;
+  report_in_flight = false;
+  uart_head = uart_tail = 0;
+  uart_line_free = 0;
+  uart_tx_count = 0;
+  rx_head = rx_count = 0;
+  tx_count = host_count = 0;
+
+  split_init();
+  keyboard_init();
+  governor_init();
+  webserial_connect(true);
+}
+
+// The IN endpoint gets polled faster than we can fill it
+static void sim_host_poll() {
+  uint32_t len = tx_count;
+  if (len > SIM_HOST_BUFFER - host_count)
+    len = SIM_HOST_BUFFER - host_count;
+
+  memcpy(host_buffer + host_count, tx, len);
+  host_count += len;
+  memmove(tx, tx + len, tx_count - len);
+  tx_count -= len;
+}
+
+void sim_step() {
+  now_us += KEYBOARD_SCAN_RATE_US;
+  usb_hw->sof_rd = (now_us / 1000) & USB_SOF_RD_BITS;
+  sim_sample(KEYBOARD_SCAN_RATE_US);
+
+  // Suspended, the main loop only waits for the host to resume us
+  if (power_suspended()) {
+    power_task();
+    if (resume_at != 0 && now_us >= resume_at) {
+      resume_at = 0;
+      power_resume();
+    }
+    sim_host_poll();
+    return;
+  }
+
+  if (report_in_flight && now_us >= report_due) {
+    report_in_flight = false;
+    power_report_delivered();
+  }
+
+  // The half of a split board without USB only sends its keys over
+  if (split_secondary()) {
+    split_secondary_task();
+    return;
+  }
+
+  // Same order as the main loop, with the keyboard mounted from the start
+  if (keyboard_update()) {
+    governor_activity();
+    keyboard_report_sent();
+    reports_sent++;
+    report_in_flight = true;
+    report_due = (now_us / 1000 + 1) * 1000;
+    send_webusb_report();
+  }
+  webserial_task();
+  if (keyboard_config_save_pending())
+    keyboard_config_flash_save();
+  if (chatter_save_pending())
+    chatter_flash_save();
+  governor_task();
+
+  sim_host_poll();
+}
+
+uint32_t sim_reports_sent() {
+  return reports_sent;
+}
+
+uint64_t sim_time_us() {
+  return now_us;
+}
+
+void sim_advance_us(uint32_t us) {
+  now_us += us;
+}
+
+void sim_pin(int pin, bool down) {
+  if (pin < 0 || pin >= 32)
+    return;
+
+  bool falling = down && !pins[pin];
+  pins[pin] = down;
+  if (falling && (gpio_irqs & (1u << pin)) && gpio_callback)
+    gpio_callback(pin, GPIO_IRQ_EDGE_FALL);
+}
+
+// 10 bits a byte on the wire, start and stop included
+bool sim_split_write(const uint8_t *data, uint32_t len) {
+  if (uart_tail - uart_head + len > SIM_UART_BUFFER)
+    return false;
+
+  if (uart_line_free < now_us)
+    uart_line_free = now_us;
+  for (uint32_t i = 0; i < len; i++) {
+    uart_line_free += 10 * 1000000 / SPLIT_BAUD;
+    uart_rx[uart_tail++ % SIM_UART_BUFFER] = (UartByte) { data[i], uart_line_free };
+  }
+  return true;
+}
+
+uint32_t sim_split_read(uint8_t *data, uint32_t max) {
+  uint32_t len = uart_tx_count < max ? uart_tx_count : max;
+  memcpy(data, uart_tx, len);
+  memmove(uart_tx, uart_tx + len, uart_tx_count - len);
+  uart_tx_count -= len;
+  return len;
+}
+
+void sim_vbus(bool present) {
+  vbus = present;
+}
+
+unsigned sim_pin_function(int pin) {
+  return pin >= 0 && pin < 32 ? pin_functions[pin] : 0;
+}
+
+void sim_suspend(bool remote_wakeup) {
+  power_suspend(remote_wakeup);
+}
+
+void sim_resume() {
+  resume_at = 0;
+  power_resume();
+}
+
+bool sim_host_write(const uint8_t *data, uint32_t len) {
+  if (rx_count + (len + SIM_PACKET_SIZE - 1) / SIM_PACKET_SIZE > SIM_RX_PACKETS)
+    return false;
+
+  for (uint32_t offset = 0; offset < len; offset += SIM_PACKET_SIZE) {
+    Packet *packet = &rx[(rx_head + rx_count) % SIM_RX_PACKETS];
+    packet->len = len - offset < SIM_PACKET_SIZE ? len - offset : SIM_PACKET_SIZE;
+    packet->due = (now_us / 1000 + 1) * 1000;
+    memcpy(packet->data, data + offset, packet->len);
+    rx_count++;
+  }
+  return true;
+}
+
+uint32_t sim_host_read(uint8_t *data, uint32_t max) {
+  uint32_t len = host_count < max ? host_count : max;
+  memcpy(data, host_buffer, len);
+  memmove(host_buffer, host_buffer + len, host_count - len);
+  host_count -= len;
+  return len;
+}
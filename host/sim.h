@@ -0,0 +1,58 @@
+#ifndef SIM_H_
+#define SIM_H_
+
+// The firmware's keyboard and vendor protocol code running in-process on the
+// host, against simulated pins, flash and vendor endpoint
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_PACKET_SIZE 64 // full speed bulk, same as CFG_TUD_VENDOR_*_BUFSIZE
+
+// Power on; flash survives sim_reboot, sim_erase blanks it
+void sim_reboot();
+void sim_erase();
+
+// One scan period of the main loop
+void sim_step();
+uint64_t sim_time_us();
+
+// Moves the clock on without running anything, for code that calls
+// keyboard_update itself
+void sim_advance_us(uint32_t us);
+
+void sim_pin(int pin, bool down);
+
+// Keyboard reports the main loop has handed to the stack since power on
+uint32_t sim_reports_sent();
+
+// Bytes from the other half of a split board, arriving on the primary's
+// UART at SPLIT_BAUD from now (or from when the line's free)
+bool sim_split_write(const uint8_t *data, uint32_t len);
+
+// As the other half: what we've sent over the link since power on, drained
+// by reading, and whether we have USB power, which is read once at boot
+uint32_t sim_split_read(uint8_t *data, uint32_t max);
+void sim_vbus(bool present);
+
+// GPIO_FUNC_ the firmware last gave a pin, 0 if it hasn't set it up
+unsigned sim_pin_function(int pin);
+
+// The host suspending the bus, and resuming it. After a remote wakeup the
+// host resumes us by itself, 20ms later
+void sim_suspend(bool remote_wakeup);
+void sim_resume();
+
+// The host's end of the vendor endpoint. A write is one OUT transfer, which
+// reaches the firmware a packet at a time; reads drain the IN endpoint
+bool sim_host_write(const uint8_t *data, uint32_t len);
+uint32_t sim_host_read(uint8_t *data, uint32_t max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIM_H_ */
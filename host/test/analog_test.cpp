@@ -0,0 +1,163 @@
+// Analog key thresholds, driven with synthetic travel curves, and their config
+// over the vendor interface
+#include <memory>
+#include <vector>
+
+#include "client.h"
+#include "test.h"
+
+extern "C" {
+#include "analog.h"
+}
+
+namespace {
+
+// Feeds travel from one point to another a step at a time and returns where
+// the key changed state, or -1 if it didn't
+int sweep(AnalogKey *key, int from, int to) {
+  int step = from < to ? 1 : -1;
+  bool was = key->pressed;
+  for (int travel = from;; travel += step) {
+    if (analog_key_update(key, travel) != was)
+      return travel;
+    if (travel == to)
+      return -1;
+  }
+}
+
+AnalogKey make_key(uint8_t actuation, uint8_t release, uint8_t rapid_trigger) {
+  AnalogKey key = {};
+  analog_key_config(&key, actuation, release, rapid_trigger);
+  analog_key_calibrate(&key, 2000);
+  return key;
+}
+
+// Without rapid trigger it's plain hysteresis between the two points
+void test_hysteresis() {
+  AnalogKey key = make_key(128, 96, 0);
+  CHECK_EQ(sweep(&key, 0, 255), 128);
+  CHECK_EQ(sweep(&key, 128, 255), -1);
+  CHECK_EQ(sweep(&key, 255, 97), -1);
+  CHECK_EQ(sweep(&key, 97, 0), 96);
+  CHECK_EQ(sweep(&key, 96, 127), -1);
+
+  // Wobbling between the points doesn't chatter
+  CHECK_EQ(sweep(&key, 127, 128), 128);
+  CHECK_EQ(sweep(&key, 128, 100), -1);
+}
+
+void test_rapid_trigger() {
+  AnalogKey key = make_key(128, 96, 16);
+  CHECK_EQ(sweep(&key, 0, 200), 128);
+
+  // Lifting by rapid_trigger from the deepest point releases, well above
+  // actuation, and pushing back down by the same amount presses again
+  CHECK_EQ(sweep(&key, 200, 150), 184);
+  CHECK_EQ(sweep(&key, 184, 150), -1);
+  CHECK_EQ(sweep(&key, 150, 200), 166);
+
+  // Small wobbles stay under the threshold either way
+  CHECK_EQ(sweep(&key, 166, 152), -1);
+  CHECK_EQ(sweep(&key, 152, 170), -1);
+
+  // Shallow in the travel: it re-presses below actuation, but never at or
+  // below the release point, which always releases
+  CHECK_EQ(sweep(&key, 170, 100), 154);
+  CHECK_EQ(sweep(&key, 100, 116), 116);
+  CHECK_EQ(sweep(&key, 116, 0), 100);
+  CHECK_EQ(sweep(&key, 0, 127), -1);
+  CHECK_EQ(sweep(&key, 127, 200), 128);
+
+  // A lift that crosses the release point releases there, before rapid
+  // trigger would have
+  key = make_key(128, 96, 64);
+  CHECK_EQ(sweep(&key, 0, 140), 128);
+  CHECK_EQ(sweep(&key, 140, 0), 96);
+}
+
+// The release point has to sit between rest and actuation
+void test_config_clamped() {
+  AnalogKey key = make_key(0, 0, 0);
+  CHECK_EQ(key.actuation, 1);
+  CHECK_EQ(key.release, 0);
+
+  key = make_key(100, 200, 8);
+  CHECK_EQ(key.actuation, 100);
+  CHECK_EQ(key.release, 99);
+  CHECK_EQ(sweep(&key, 0, 255), 100);
+  CHECK_EQ(sweep(&key, 255, 0), 247);
+}
+
+// Raw readings to travel: either direction from rest, scaled to the furthest
+// reading yet, with ANALOG_MIN_RANGE until a full keystroke has been seen
+void test_travel() {
+  AnalogKey key = make_key(128, 96, 0);
+  CHECK_EQ(analog_key_travel(&key, 2000), 0);
+  CHECK_EQ(analog_key_travel(&key, 2000 + ANALOG_MIN_RANGE / 2), ANALOG_TRAVEL_MAX * (ANALOG_MIN_RANGE / 2) / ANALOG_MIN_RANGE);
+  CHECK_EQ(analog_key_travel(&key, 2000 + 2 * ANALOG_MIN_RANGE), ANALOG_TRAVEL_MAX);
+  CHECK_EQ(analog_key_travel(&key, 2000 + ANALOG_MIN_RANGE), ANALOG_TRAVEL_MAX / 2);
+
+  // A sensor that reads down as the magnet comes closer
+  AnalogKey inverted = make_key(128, 96, 0);
+  CHECK_EQ(analog_key_travel(&inverted, 2000 - 1200), ANALOG_TRAVEL_MAX);
+  CHECK_EQ(analog_key_travel(&inverted, 2000 - 600), ANALOG_TRAVEL_MAX / 2);
+  CHECK_EQ(analog_key_travel(&inverted, 2000), 0);
+
+  // And a full press through travel and the thresholds
+  CHECK(!analog_key_update(&inverted, analog_key_travel(&inverted, 2000 - 500)));
+  CHECK(analog_key_update(&inverted, analog_key_travel(&inverted, 2000 - 700)));
+  CHECK(!analog_key_update(&inverted, analog_key_travel(&inverted, 2000 - 400)));
+}
+
+// Per pin thresholds through 'v', saved to flash with the rest of the config
+void test_config() {
+  sim_erase();
+  std::unique_ptr<kb::Transport> transport = kb::open_loopback();
+  kb::Client client(*transport);
+
+  std::vector<uint8_t> config = client.analog();
+  CHECK_EQ(config.size(), ANALOG_CONFIG_SIZE);
+  CHECK_EQ(config.at(0), ANALOG_CHANNELS);
+  for (int c = 0; c < ANALOG_CHANNELS; c++) {
+    CHECK_EQ(config.at(1 + c * ANALOG_ENTRY_SIZE), ANALOG_PIN_BASE + c);
+    CHECK_EQ(config.at(2 + c * ANALOG_ENTRY_SIZE), ANALOG_DEFAULT_ACTUATION);
+    CHECK_EQ(config.at(3 + c * ANALOG_ENTRY_SIZE), ANALOG_DEFAULT_RELEASE);
+    CHECK_EQ(config.at(4 + c * ANALOG_ENTRY_SIZE), ANALOG_DEFAULT_RAPID_TRIGGER);
+  }
+
+  // Pins left out get the defaults; release is clamped under actuation
+  std::vector<uint8_t> reply = client.analog({2, ANALOG_PIN_BASE + 1, 60, 40, 0, ANALOG_PIN_BASE + 3, 200, 220, 4});
+  std::vector<uint8_t> expected = config;
+  expected[2 + ANALOG_ENTRY_SIZE] = 60;
+  expected[3 + ANALOG_ENTRY_SIZE] = 40;
+  expected[4 + ANALOG_ENTRY_SIZE] = 0;
+  expected[2 + 3 * ANALOG_ENTRY_SIZE] = 200;
+  expected[3 + 3 * ANALOG_ENTRY_SIZE] = 199;
+  expected[4 + 3 * ANALOG_ENTRY_SIZE] = 4;
+  CHECK(reply == expected);
+
+  std::unique_ptr<kb::Transport> rebooted = kb::open_loopback();
+  kb::Client after(*rebooted);
+  CHECK(after.analog() == expected);
+
+  // The socd, combo and tap-hold sections are untouched
+  CHECK_EQ(after.socd().at(0), 0);
+
+  // A count that can't be right, like erased flash, is the defaults
+  CHECK(after.analog({0xff}) == config);
+
+  after.analog({1, ANALOG_PIN_BASE, 50, 10, 0});
+  after.reset();
+  CHECK(after.analog() == config);
+}
+
+} // namespace
+
+int main() {
+  test_hysteresis();
+  test_rapid_trigger();
+  test_config_clamped();
+  test_travel();
+  test_config();
+  return kbtest::result("analog_test");
+}
@@ -0,0 +1,81 @@
+// The learned settle times through a save to flash and a reboot, every key's
+// of them. Built at the board's KEYS and again at 256, where they take more
+// than the one flash page
+#include <cstdint>
+#include <vector>
+
+#include "test.h"
+
+extern "C" {
+#include "chatter.h"
+#include "save.h"
+}
+
+namespace {
+
+const uint32_t CHATTER_MAGIC = 0x43484154; // chatter.c's "CHAT"
+
+// chatter.c's ChatterSave, as it lands in flash
+struct Save {
+  uint32_t magic;
+  uint16_t keys;
+  uint16_t reserved;
+  uint16_t settle_us[KEYS];
+};
+
+uint16_t settle_for(int key) {
+  return DEBOUNCE_MIN_US + key * 7;
+}
+
+uint16_t settle_of(int key) {
+  ChatterStats stats;
+  chatter_stats(key, &stats);
+  return stats.settle_us;
+}
+
+// Settle times of its own for each key, from flash at boot, and then saved
+// back over a blank sector by chatter itself: they all come back the same
+void test_round_trip() {
+  sim_erase();
+  Save save = {CHATTER_MAGIC, KEYS, 0, {}};
+  for (int i = 0; i < KEYS; i++)
+    save.settle_us[i] = settle_for(i);
+  flash_debounce_write(reinterpret_cast<uint8_t *>(&save), sizeof(save));
+  sim_reboot();
+  for (int i = 0; i < KEYS; i++)
+    CHECK_EQ(settle_of(i), settle_for(i));
+
+  std::vector<uint8_t> blank(sizeof(save), 0);
+  flash_debounce_write(blank.data(), blank.size());
+  chatter_flash_save();
+  sim_reboot();
+  for (int i = 0; i < KEYS; i++)
+    CHECK_EQ(settle_of(i), settle_for(i));
+}
+
+// Nothing saved, or saved for another key count: every key on the default
+void test_invalid() {
+  sim_erase();
+  sim_reboot();
+  CHECK_EQ(settle_of(0), DEBOUNCE_US / 2);
+  CHECK_EQ(settle_of(KEYS - 1), DEBOUNCE_US / 2);
+
+  Save save = {CHATTER_MAGIC, KEYS - 1, 0, {}};
+  for (int i = 0; i < KEYS; i++)
+    save.settle_us[i] = settle_for(i);
+  flash_debounce_write(reinterpret_cast<uint8_t *>(&save), sizeof(save));
+  sim_reboot();
+  CHECK_EQ(settle_of(KEYS - 1), DEBOUNCE_US / 2);
+}
+
+} // namespace
+
+int main() {
+  test_round_trip();
+  test_invalid();
+#if KEYS == 256
+  return kbtest::result("chatter_test_256");
+#else
+  return kbtest::result("chatter_test");
+#endif
+}
@@ -0,0 +1,238 @@
+// Combos on W, S and X, through the scan: when they fire, when a bigger one
+// wins over a smaller, and when the keys go out as themselves instead. Built
+// at the board's KEYS and again at 256, where a key number is the whole byte
+#include <initializer_list>
+#include <map>
+#include <vector>
+
+#include "test.h"
+
+extern "C" {
+#include "combo.h"
+#include "tusb.h"
+}
+
+namespace {
+
+// Keys 4, 6, 7 and 8 in the default map
+const int KEY_W = 6, PIN_W = 8;
+const int KEY_S = 7, PIN_S = 9;
+const int KEY_X = 8, PIN_X = 10;
+const int PIN_A = 5;
+
+const int TERM_MS = 100;
+const int WS_CODE = HID_KEY_ENTER;
+const int WSX_CODE = HID_KEY_BACKSPACE;
+
+// Long enough for a press or release to get through the debounce
+const int SETTLE_MS = DEBOUNCE_MAX_US / 1000 + 5;
+
+std::vector<uint8_t> combo(std::initializer_list<uint8_t> keys, uint8_t code) {
+  std::vector<uint8_t> entry(keys);
+  entry.resize(COMBO_MAX_KEYS, NO_KEY);
+  entry.push_back(code);
+  return entry;
+}
+
+void configure(std::initializer_list<std::vector<uint8_t>> combos) {
+  sim_erase();
+  sim_reboot();
+  std::vector<uint8_t> config = {TERM_MS, static_cast<uint8_t>(combos.size())};
+  for (const std::vector<uint8_t> &entry : combos)
+    config.insert(config.end(), entry.begin(), entry.end());
+  combo_config_set(config.data(), config.size());
+
+  std::vector<uint8_t> read(COMBO_CONFIG_SIZE);
+  CHECK_EQ(combo_config_read(read.data(), read.size()), COMBO_CONFIG_SIZE);
+  CHECK(std::vector<uint8_t>(read.begin(), read.begin() + config.size()) == config);
+  kbtest::run_ms(SETTLE_MS);
+}
+
+void configure_both() {
+  configure({combo({KEY_W, KEY_S}, WS_CODE), combo({KEY_W, KEY_S, KEY_X}, WSX_CODE)});
+}
+
+// The first ms each code was in the report, -1 if it never was
+std::map<int, int> watch(int ms, std::initializer_list<int> codes) {
+  std::map<int, int> first;
+  for (int code : codes)
+    first[code] = -1;
+  for (int i = 0; i < ms * 1000 / KEYBOARD_SCAN_RATE_US; i++) {
+    sim_step();
+    for (auto &[code, at] : first) {
+      if (at < 0 && kbtest::reported(code))
+        at = i * KEYBOARD_SCAN_RATE_US / 1000;
+    }
+  }
+  return first;
+}
+
+void set(int pin, bool down, int ms = SETTLE_MS) {
+  sim_pin(pin, down);
+  kbtest::run_ms(ms);
+}
+
+// In the slots or, for keys past the sixth, the NKRO bitmap
+bool nothing_reported() {
+  for (int i = 0; i < KEYBOARD_REPORT_SIZE; i++) {
+    if (get_keycode_report()[i])
+      return false;
+  }
+  for (int i = 0; i < KEYBOARD_NKRO_KEYS / 8; i++) {
+    if (get_nkro_report()[i])
+      return false;
+  }
+  return true;
+}
+
+void release_all() {
+  for (int pin : {PIN_W, PIN_S, PIN_X, PIN_A})
+    sim_pin(pin, false);
+  kbtest::run_ms(SETTLE_MS);
+  CHECK(nothing_reported());
+}
+
+// Both keys down fires it straight away, and the first one up lets go of it
+void test_plain() {
+  configure({combo({KEY_W, KEY_S}, WS_CODE)});
+  set(PIN_W, true, 5);
+  CHECK(nothing_reported());
+  sim_pin(PIN_S, true);
+  auto seen = watch(SETTLE_MS, {WS_CODE, HID_KEY_W, HID_KEY_S});
+  CHECK(seen[WS_CODE] >= 0 && seen[WS_CODE] <= 1);
+  CHECK_EQ(seen[HID_KEY_W], -1);
+  CHECK_EQ(seen[HID_KEY_S], -1);
+
+  set(PIN_W, false);
+  CHECK(nothing_reported());
+  set(PIN_S, false);
+  CHECK(nothing_reported());
+}
+
+// W+S waits while W+S+X is still possible, and X makes it the bigger one
+void test_bigger() {
+  configure_both();
+  set(PIN_W, true, 2);
+  set(PIN_S, true, 5);
+  CHECK(nothing_reported());
+  sim_pin(PIN_X, true);
+  auto seen = watch(SETTLE_MS, {WS_CODE, WSX_CODE, HID_KEY_W, HID_KEY_S, HID_KEY_X});
+  CHECK(seen[WSX_CODE] >= 0 && seen[WSX_CODE] <= 1);
+  CHECK_EQ(seen[WS_CODE], -1);
+  CHECK_EQ(seen[HID_KEY_W], -1);
+  CHECK_EQ(seen[HID_KEY_S], -1);
+  CHECK_EQ(seen[HID_KEY_X], -1);
+  release_all();
+}
+
+// Without X inside the term, W+S is what it was
+void test_bigger_times_out() {
+  configure_both();
+  sim_pin(PIN_W, true);
+  sim_pin(PIN_S, true);
+  auto seen = watch(TERM_MS + SETTLE_MS, {WS_CODE, WSX_CODE, HID_KEY_W, HID_KEY_S});
+  CHECK(seen[WS_CODE] >= TERM_MS - 1 && seen[WS_CODE] <= TERM_MS + 2);
+  CHECK_EQ(seen[WSX_CODE], -1);
+  CHECK_EQ(seen[HID_KEY_W], -1);
+  CHECK_EQ(seen[HID_KEY_S], -1);
+  release_all();
+}
+
+// Another key ends the wait for a bigger combo: W+S fires before it, as it
+// would have when the term ran out. With only W down, W goes out as itself
+void test_interrupt() {
+  configure_both();
+  set(PIN_W, true, 2);
+  set(PIN_S, true, 5);
+  sim_pin(PIN_A, true);
+  auto seen = watch(SETTLE_MS, {WS_CODE, HID_KEY_A, HID_KEY_W, HID_KEY_S});
+  CHECK(seen[WS_CODE] >= 0 && seen[WS_CODE] <= 1);
+  CHECK(seen[HID_KEY_A] >= seen[WS_CODE]);
+  CHECK_EQ(seen[HID_KEY_W], -1);
+  CHECK_EQ(seen[HID_KEY_S], -1);
+  release_all();
+
+  set(PIN_W, true, 5);
+  sim_pin(PIN_A, true);
+  seen = watch(SETTLE_MS, {WS_CODE, HID_KEY_A, HID_KEY_W});
+  CHECK(seen[HID_KEY_W] >= 0 && seen[HID_KEY_W] <= 1);
+  CHECK(seen[HID_KEY_A] >= seen[HID_KEY_W]);
+  CHECK_EQ(seen[WS_CODE], -1);
+  release_all();
+}
+
+// A key let go before its combo completes is a tap of that key, pressed and
+// released in reports of its own, even when the keys down so far are a
+// smaller combo
+void test_tap() {
+  configure_both();
+  set(PIN_W, true);
+  sim_pin(PIN_W, false);
+  auto seen = watch(SETTLE_MS, {WS_CODE, HID_KEY_W});
+  CHECK(seen[HID_KEY_W] >= 0);
+  CHECK_EQ(seen[WS_CODE], -1);
+  CHECK(nothing_reported());
+
+  set(PIN_W, true, 2);
+  set(PIN_S, true);
+  sim_pin(PIN_W, false);
+  seen = watch(SETTLE_MS, {WS_CODE, HID_KEY_W, HID_KEY_S});
+  CHECK(seen[HID_KEY_W] >= 0);
+  CHECK(seen[HID_KEY_S] >= seen[HID_KEY_W]);
+  CHECK_EQ(seen[WS_CODE], -1);
+  CHECK(!kbtest::reported(HID_KEY_W));
+  CHECK(kbtest::reported(HID_KEY_S));
+  release_all();
+}
+
+// A member on its own goes out as itself once the term runs out
+void test_term() {
+  configure({combo({KEY_W, KEY_S}, WS_CODE)});
+  sim_pin(PIN_W, true);
+  auto seen = watch(TERM_MS + SETTLE_MS, {WS_CODE, HID_KEY_W});
+  CHECK(seen[HID_KEY_W] >= TERM_MS - 1 && seen[HID_KEY_W] <= TERM_MS + 2);
+  CHECK_EQ(seen[WS_CODE], -1);
+  release_all();
+}
+
+#if KEYS == 256
+// Keys past the board's 19 work in a combo, and the NO_KEY padding isn't
+// taken for key 255
+void test_high_key() {
+  const int KEY_HIGH = 200, PIN_HIGH = 7;
+  configure({combo({KEY_W, KEY_HIGH}, WS_CODE)});
+
+  std::vector<uint8_t> keymap(KEYMAP_CONFIG_SIZE);
+  keyboard_config_read(keymap.data(), keymap.size());
+  keymap[KEY_HIGH * KEY_CONFIG_SIZE + 0] = PIN_HIGH;
+  keymap[KEY_HIGH * KEY_CONFIG_SIZE + 1] = HID_KEY_G;
+  keyboard_config_set(keymap.data(), keymap.size());
+  kbtest::run_ms(SETTLE_MS);
+
+  set(PIN_W, true, 2);
+  sim_pin(PIN_HIGH, true);
+  auto seen = watch(SETTLE_MS, {WS_CODE, HID_KEY_W, HID_KEY_G});
+  CHECK(seen[WS_CODE] >= 0 && seen[WS_CODE] <= 1);
+  CHECK_EQ(seen[HID_KEY_W], -1);
+  CHECK_EQ(seen[HID_KEY_G], -1);
+  sim_pin(PIN_HIGH, false);
+  release_all();
+}
+#endif
+
+} // namespace
+
+int main() {
+  test_plain();
+  test_bigger();
+  test_bigger_times_out();
+  test_interrupt();
+  test_tap();
+  test_term();
+#if KEYS == 256
+  test_high_key();
+  return kbtest::result("combo_test_256");
+#else
+  return kbtest::result("combo_test");
+#endif
+}
@@ -0,0 +1,275 @@
+// The client and the vendor protocol end to end, against the firmware running
+// in-process: config round trips, pipelining, streams and unprompted messages
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "client.h"
+#include "test.h"
+
+extern "C" {
+#include "bench.h"
+#include "combo.h"
+#include "mousekeys.h"
+#include "recorder.h"
+#include "socd.h"
+#include "taphold.h"
+#include "tusb.h"
+}
+
+namespace {
+
+// In the default map
+const int PIN_Q = 4;  // key 3, HID_KEY_Q
+const int PIN_A = 5;  // key 4, HID_KEY_A
+const int PIN_D = 14; // key 11, HID_KEY_D
+
+void test_keymap_round_trip() {
+  sim_erase();
+  std::unique_ptr<kb::Transport> transport = kb::open_loopback();
+  kb::Client client(*transport);
+
+  std::vector<uint8_t> keymap = client.keymap();
+  CHECK_EQ(keymap.size(), KEYMAP_CONFIG_SIZE);
+
+  keymap[4 * KEY_CONFIG_SIZE + 1] = HID_KEY_B;
+  CHECK(client.set_keymap(keymap) == keymap);
+
+  // Saved to flash, so it's still there after a restart
+  std::unique_ptr<kb::Transport> rebooted = kb::open_loopback();
+  kb::Client after(*rebooted);
+  CHECK(after.keymap() == keymap);
+
+  // Keys go live once the debounce window from power on has passed
+  kbtest::run_ms(DEBOUNCE_MAX_US / 1000);
+  sim_pin(PIN_A, true);
+  kbtest::run_ms(5);
+  CHECK(kbtest::reported(HID_KEY_B));
+  sim_pin(PIN_A, false);
+  kbtest::run_ms(30);
+  CHECK(!kbtest::reported(HID_KEY_B));
+
+  CHECK(after.reset().at(4 * KEY_CONFIG_SIZE + 1) == HID_KEY_A);
+}
+
+// Each reply goes to its own request, whatever the window
+void test_pipelined_push() {
+  sim_erase();
+  std::unique_ptr<kb::Transport> transport = kb::open_loopback();
+  kb::Client setup(*transport);
+  std::vector<uint8_t> keymap = setup.keymap();
+
+  for (int window = 1; window <= 8; window *= 2) {
+    kb::Client client(*transport, window);
+    std::vector<kb::Request> requests;
+    std::vector<std::vector<uint8_t>> sent;
+    for (int i = 0; i < 16; i++) {
+      std::vector<uint8_t> config = keymap;
+      config[1] = static_cast<uint8_t>(HID_KEY_A + i);
+      kb::Request set{{'s'}, kb::Reply::Single, 1, 'c'};
+      set.command.insert(set.command.end(), config.begin(), config.end());
+      requests.push_back(set);
+      sent.push_back(config);
+    }
+
+    std::vector<std::vector<kb::Message>> replies = client.run(requests);
+    CHECK_EQ(replies.size(), sent.size());
+    for (size_t i = 0; i < replies.size() && i < sent.size(); i++)
+      CHECK(replies[i].size() == 1 && replies[i][0].data == sent[i]);
+  }
+}
+
+// A stream ends with an empty message and can interleave with single replies
+void test_stream() {
+  sim_erase();
+  std::unique_ptr<kb::Transport> transport = kb::open_loopback();
+  kb::Client client(*transport);
+  kbtest::run_ms(DEBOUNCE_MAX_US / 1000);
+
+  // The sim's RAM outlives sim_reboot, so earlier tests' records are there too
+  uint32_t start = sim_time_us();
+  sim_pin(PIN_A, true);
+  kbtest::run_ms(5);
+  sim_pin(PIN_A, false);
+  kbtest::run_ms(30);
+
+  std::vector<std::vector<kb::Message>> replies =
+      client.run({kb::Request{{'f'}, kb::Reply::UntilEmpty}, kb::Request{{'q'}}});
+  CHECK_EQ(replies.size(), 2);
+  CHECK_EQ(replies[1].size(), 1);
+
+  int presses = 0, releases = 0;
+  for (const kb::Message &chunk : replies[0]) {
+    CHECK_EQ(chunk.data.size() % sizeof(Record), 0);
+    for (size_t i = 0; i + sizeof(Record) <= chunk.data.size(); i += sizeof(Record)) {
+      const Record *record = reinterpret_cast<const Record *>(chunk.data.data() + i);
+      if (record->type == RECORD_KEY_EDGE && record->key == 4 && record->time >= start)
+        (record->data ? presses : releases)++;
+    }
+  }
+  CHECK_EQ(presses, 1);
+  CHECK_EQ(releases, 1);
+}
+
+// The raw key state goes out unprompted whenever it changes
+void test_unsolicited() {
+  sim_erase();
+  std::unique_ptr<kb::Transport> transport = kb::open_loopback();
+  kb::Client client(*transport);
+
+  std::vector<std::vector<uint8_t>> states;
+  client.on_unsolicited = [&](const kb::Message &message) {
+    if (message.type == 'r')
+      states.push_back(message.data);
+  };
+
+  sim_pin(PIN_A, true);
+  kbtest::run_ms(5);
+  client.run(kb::Request{{'q'}});
+
+  CHECK(!states.empty());
+  if (!states.empty()) {
+    CHECK_EQ(states.back().size(), KEYS);
+    CHECK_EQ(states.back().at(4), 1);
+  }
+  sim_pin(PIN_A, false);
+  kbtest::run_ms(30);
+}
+
+// Remapping a held key swaps its code in the report, and that has to go out
+// as a report of its own even though no key changed
+void test_held_key_remap() {
+  sim_erase();
+  std::unique_ptr<kb::Transport> transport = kb::open_loopback();
+  kb::Client client(*transport);
+  kbtest::run_ms(DEBOUNCE_MAX_US / 1000);
+
+  int reports = 0;
+  client.on_unsolicited = [&](const kb::Message &message) {
+    if (message.type == 'r')
+      reports++;
+  };
+
+  sim_pin(PIN_A, true);
+  kbtest::run_ms(5);
+  client.run(kb::Request{{'q'}});
+  CHECK(kbtest::reported(HID_KEY_A));
+
+  reports = 0;
+  std::vector<uint8_t> keymap = client.keymap();
+  keymap[4 * KEY_CONFIG_SIZE + 1] = HID_KEY_B;
+  client.set_keymap(keymap);
+  kbtest::run_ms(5);
+  client.run(kb::Request{{'q'}});
+  CHECK(kbtest::reported(HID_KEY_B));
+  CHECK(!kbtest::reported(HID_KEY_A));
+  CHECK_EQ(reports, 1);
+
+  sim_pin(PIN_A, false);
+  kbtest::run_ms(30);
+  CHECK(!kbtest::reported(HID_KEY_B));
+}
+
+// The debounce benchmark stalls the scan, so it won't run with a key down
+void test_debounce_bench() {
+  sim_erase();
+  std::unique_ptr<kb::Transport> transport = kb::open_loopback();
+  kb::Client client(*transport);
+  kbtest::run_ms(DEBOUNCE_MAX_US / 1000);
+
+  sim_pin(PIN_A, true);
+  kbtest::run_ms(5);
+  CHECK(client.debounce_bench().empty());
+  sim_pin(PIN_A, false);
+  kbtest::run_ms(30);
+
+  std::vector<kb::Message> results = client.debounce_bench();
+  CHECK_EQ(results.size(), BENCH_RESULTS);
+  for (const kb::Message &message : results) {
+    CHECK_EQ(message.data.size(), sizeof(BenchResult));
+    BenchResult r;
+    std::memcpy(&r, message.data.data(), sizeof(r));
+    if (r.keystrokes - r.missed < 20)
+      continue; // too few for the percentiles to mean much
+    CHECK(r.press_min <= r.press_median && r.press_median <= r.press_p95 && r.press_p95 <= r.press_max);
+    CHECK(r.release_min <= r.release_median && r.release_median <= r.release_p95 && r.release_p95 <= r.release_max);
+  }
+}
+
+// The scan benchmark pushes made-up edges through every feature, none of
+// which may leak out into what the host sees afterwards
+void test_scan_bench_isolated() {
+  sim_erase();
+  std::unique_ptr<kb::Transport> transport = kb::open_loopback();
+  kb::Client client(*transport);
+
+  std::vector<uint8_t> keymap = client.keymap();
+  keymap[1 * KEY_CONFIG_SIZE + 1] = SPECIAL_KEY_PROFILE + 1;
+  keymap[2 * KEY_CONFIG_SIZE + 1] = SPECIAL_KEY_MOUSE + MOUSE_KEY_RIGHT;
+  client.set_keymap(keymap);
+  client.socd({1, 4, 11, SOCD_LAST_INPUT});                   // A and D
+  client.combos({0, 1, 6, 7, NO_KEY, NO_KEY, HID_KEY_ENTER}); // W and S
+  client.taphold({0, 1, 3, HID_KEY_SHIFT_LEFT, TAPHOLD_PERMISSIVE}); // Q
+  kbtest::run_ms(DEBOUNCE_MAX_US / 1000);
+
+  sim_pin(PIN_A, true);
+  kbtest::run_ms(5);
+  CHECK(client.scan_bench().empty());
+  sim_pin(PIN_A, false);
+  kbtest::run_ms(30);
+
+  uint32_t start = sim_time_us();
+  CHECK_EQ(client.scan_bench().size(), sizeof(ScanBench));
+  kbtest::run_ms(TAPHOLD_DEFAULT_TERM_MS + 50);
+
+  CHECK(!keyboard_keys_down());
+  for (int i = 0; i < KEYBOARD_REPORT_SIZE; i++)
+    CHECK_EQ(get_keycode_report()[i], 0);
+  for (int i = 0; i < KEYBOARD_NKRO_SIZE; i++)
+    CHECK_EQ(get_nkro_report()[i], 0);
+  CHECK_EQ(client.profile().at(0), 0);
+  CHECK(!mousekeys_update(sim_time_us()));
+
+  std::vector<uint8_t> dump = client.recorder_dump();
+  int records = 0;
+  for (size_t i = 0; i + sizeof(Record) <= dump.size(); i += sizeof(Record)) {
+    Record record;
+    std::memcpy(&record, dump.data() + i, sizeof(record));
+    if (record.time >= start && record.type != RECORD_HID_SENT)
+      records++;
+  }
+  CHECK_EQ(records, 0);
+
+  // And everything still works
+  sim_pin(PIN_A, true);
+  kbtest::run_ms(5);
+  CHECK(kbtest::reported(HID_KEY_A));
+  sim_pin(PIN_D, true);
+  kbtest::run_ms(5);
+  CHECK(!kbtest::reported(HID_KEY_A));
+  CHECK(kbtest::reported(HID_KEY_D));
+  sim_pin(PIN_A, false);
+  sim_pin(PIN_D, false);
+  kbtest::run_ms(30);
+  CHECK(!kbtest::reported(HID_KEY_D));
+
+  sim_pin(PIN_Q, true);
+  kbtest::run_ms(TAPHOLD_DEFAULT_TERM_MS + 10);
+  CHECK(kbtest::reported(HID_KEY_SHIFT_LEFT));
+  sim_pin(PIN_Q, false);
+  kbtest::run_ms(30);
+  CHECK(!kbtest::reported(HID_KEY_SHIFT_LEFT));
+}
+
+} // namespace
+
+int main() {
+  test_keymap_round_trip();
+  test_pipelined_push();
+  test_stream();
+  test_unsolicited();
+  test_held_key_remap();
+  test_debounce_bench();
+  test_scan_bench_isolated();
+  return kbtest::result("loopback_test");
+}
@@ -0,0 +1,146 @@
+// The mouse keys acceleration curve in its 16.16 fixed point, straight through
+// the integrator and then with a key held down through the scan
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#include "client.h"
+#include "test.h"
+
+extern "C" {
+#include "mousekeys.h"
+
+extern MouseMotion mouse;
+extern uint32_t mouse_time_us;
+}
+
+namespace {
+
+// Key 2 in the default map
+const int KEY_RIGHT = 2, PIN_RIGHT = 2;
+
+const int32_t ONE = 65536;
+
+MouseMotion holding(std::initializer_list<int> keys) {
+  MouseMotion m = {};
+  for (int key : keys)
+    m.held |= 1 << key;
+  return m;
+}
+
+// The first ms moves at the start speed, and it climbs from there to the cap
+// over the ramp and stays there
+void test_ramp() {
+  MouseMotion m = holding({MOUSE_KEY_RIGHT});
+  mousekeys_integrate(&m, 1);
+  CHECK_EQ(m.speed, MOUSEKEYS_SPEED_START);
+  CHECK_EQ(m.x, MOUSEKEYS_SPEED_START);
+  CHECK_EQ(m.y, 0);
+
+  // Halfway along the ramp it's halfway there, give or take the rounding
+  mousekeys_integrate(&m, MOUSEKEYS_RAMP_MS / 2 - 1);
+  int32_t half = (MOUSEKEYS_SPEED_START + MOUSEKEYS_SPEED_MAX) / 2;
+  CHECK(m.speed > half - half / 100 && m.speed < half + half / 100);
+
+  mousekeys_integrate(&m, MOUSEKEYS_RAMP_MS / 2 - 1);
+  CHECK(m.speed < MOUSEKEYS_SPEED_MAX);
+  mousekeys_integrate(&m, 5);
+  CHECK_EQ(m.speed, MOUSEKEYS_SPEED_MAX);
+
+  int32_t x = m.x;
+  mousekeys_integrate(&m, 100);
+  CHECK_EQ(m.speed, MOUSEKEYS_SPEED_MAX);
+  CHECK_EQ(m.x - x, 100 * MOUSEKEYS_SPEED_MAX);
+}
+
+// Left is negative, a diagonal goes at the same speed as a straight line, and
+// opposite keys cancel out and don't ramp
+void test_directions() {
+  MouseMotion m = holding({MOUSE_KEY_LEFT, MOUSE_KEY_DOWN});
+  mousekeys_integrate(&m, 1);
+  CHECK_EQ(m.x, -(MOUSEKEYS_SPEED_START * 181 / 256));
+  CHECK_EQ(m.y, MOUSEKEYS_SPEED_START * 181 / 256);
+
+  m = holding({MOUSE_KEY_LEFT, MOUSE_KEY_RIGHT});
+  mousekeys_integrate(&m, 100);
+  CHECK_EQ(m.speed, 0);
+  CHECK_EQ(m.x, 0);
+}
+
+// A notch every 60ms, with no acceleration, and no pointer motion from it
+void test_wheel() {
+  MouseMotion m = holding({MOUSE_KEY_WHEEL_UP});
+  mousekeys_integrate(&m, 59);
+  CHECK(m.wheel < ONE);
+  mousekeys_integrate(&m, 2);
+  CHECK(m.wheel >= ONE);
+  CHECK_EQ(m.speed, 0);
+
+  m = holding({MOUSE_KEY_WHEEL_DOWN});
+  mousekeys_integrate(&m, 600);
+  CHECK_EQ(m.wheel, -600 * MOUSEKEYS_WHEEL_SPEED);
+}
+
+// Motion reported as the main loop would, after each scan
+int run_reporting(int ms, int *x) {
+  int reports = 0;
+  for (int i = 0; i < ms * 1000 / KEYBOARD_SCAN_RATE_US; i++) {
+    sim_step();
+    uint8_t buttons;
+    int8_t dx, dy, wheel;
+    if (mousekeys_update(sim_time_us()) && mousekeys_report(&buttons, &dx, &dy, &wheel)) {
+      *x += dx;
+      reports++;
+    }
+  }
+  return reports;
+}
+
+// Through the scan: held for a second it moves as far as the integrator says,
+// and with nothing held the integrator doesn't run at all, so a later press
+// starts slow again rather than catching up on the time in between
+void test_held() {
+  sim_erase();
+  std::unique_ptr<kb::Transport> transport = kb::open_loopback();
+  kb::Client client(*transport);
+  std::vector<uint8_t> keymap = client.keymap();
+  keymap[KEY_RIGHT * KEY_CONFIG_SIZE + 1] = SPECIAL_KEY_MOUSE + MOUSE_KEY_RIGHT;
+  client.set_keymap(keymap);
+  kbtest::run_ms(DEBOUNCE_MAX_US / 1000);
+
+  for (int round = 0; round < 2; round++) {
+    MouseMotion idle = mouse;
+    uint32_t idle_time_us = mouse_time_us;
+    int x = 0;
+    CHECK_EQ(run_reporting(1000, &x), 0);
+    CHECK(std::memcmp(&idle, &mouse, sizeof(mouse)) == 0);
+    CHECK_EQ(mouse_time_us, idle_time_us);
+
+    sim_pin(PIN_RIGHT, true);
+    CHECK(run_reporting(5, &x) <= 2);
+    CHECK(x <= 2);
+    run_reporting(995, &x);
+
+    MouseMotion expected = holding({MOUSE_KEY_RIGHT});
+    mousekeys_integrate(&expected, 1000);
+    CHECK(x >= expected.x / ONE - 2 && x <= expected.x / ONE);
+
+    sim_pin(PIN_RIGHT, false);
+    run_reporting(DEBOUNCE_MAX_US / 1000 + 5, &x);
+    CHECK_EQ(mouse.speed, 0);
+    CHECK_EQ(mouse.held, 0);
+    int after = 0;
+    CHECK_EQ(run_reporting(100, &after), 0);
+  }
+}
+
+} // namespace
+
+int main() {
+  test_ramp();
+  test_directions();
+  test_wheel();
+  test_held();
+  return kbtest::result("mousekeys_test");
+}
@@ -0,0 +1,129 @@
+// Remote wakeup, through the sim's suspend and resume: the key that wakes the
+// host is in the first report after the resume, and goes through everything
+// a scanned press does on its way there
+#include <vector>
+
+#include "test.h"
+
+extern "C" {
+#include "combo.h"
+#include "tusb.h"
+}
+
+namespace {
+
+// In the default map
+const int PIN_Q = 4;   // key 3, HID_KEY_Q
+const int PIN_A = 5;   // key 4, HID_KEY_A / HID_KEY_F1
+const int KEY_MOD = 9, PIN_MOD = 11; // SPECIAL_KEY_MOD
+const int KEY_W = 6, PIN_W = 8;
+const int KEY_S = 7, PIN_S = 9;
+
+// Long enough for a press or release to get through the debounce
+const int SETTLE_MS = DEBOUNCE_MAX_US / 1000 + 5;
+
+// Past the host resuming us, 20ms after the remote wakeup
+const int RESUME_MS = 30;
+
+void boot() {
+  sim_erase();
+  sim_reboot();
+  kbtest::run_ms(SETTLE_MS);
+}
+
+// Runs for ms and says whether code was in the report at any point
+bool seen_within(int ms, int code) {
+  bool seen = false;
+  for (int i = 0; i < ms * 1000 / KEYBOARD_SCAN_RATE_US; i++) {
+    sim_step();
+    seen |= kbtest::reported(code);
+  }
+  return seen;
+}
+
+// In the slots or, for keys past the sixth, the NKRO bitmap
+bool nothing_reported() {
+  for (int i = 0; i < KEYBOARD_REPORT_SIZE; i++) {
+    if (get_keycode_report()[i])
+      return false;
+  }
+  for (int i = 0; i < KEYBOARD_NKRO_KEYS / 8; i++) {
+    if (get_nkro_report()[i])
+      return false;
+  }
+  return true;
+}
+
+// A tap that's over before the host is back still gets its report
+void test_tap_wakes() {
+  boot();
+  sim_suspend(true);
+  kbtest::run_ms(5);
+  sim_pin(PIN_Q, true);
+  kbtest::run_ms(2);
+  sim_pin(PIN_Q, false);
+  CHECK(seen_within(RESUME_MS, HID_KEY_Q));
+  kbtest::run_ms(SETTLE_MS);
+  CHECK(nothing_reported());
+}
+
+// The mod key only switches the layer, so waking with it sends nothing, even
+// with a code in the map that it never sends, and a key pressed while it's
+// held gets its alternate code
+void test_mod_wakes() {
+  boot();
+  std::vector<uint8_t> keymap(KEYMAP_CONFIG_SIZE);
+  keyboard_config_read(keymap.data(), keymap.size());
+  keymap[KEY_MOD * KEY_CONFIG_SIZE + 2] = HID_KEY_G;
+  keyboard_config_set(keymap.data(), keymap.size());
+  kbtest::run_ms(SETTLE_MS);
+
+  sim_suspend(true);
+  kbtest::run_ms(5);
+  sim_pin(PIN_MOD, true);
+  CHECK(!seen_within(RESUME_MS, HID_KEY_G));
+  CHECK(nothing_reported());
+
+  sim_pin(PIN_A, true);
+  kbtest::run_ms(SETTLE_MS);
+  CHECK(kbtest::reported(HID_KEY_F1));
+  CHECK(!kbtest::reported(HID_KEY_A));
+  sim_pin(PIN_A, false);
+  sim_pin(PIN_MOD, false);
+  kbtest::run_ms(SETTLE_MS);
+  CHECK(nothing_reported());
+}
+
+// A combo member that wakes the host waits for the rest of its combo like
+// one that was scanned
+void test_combo_member_wakes() {
+  boot();
+  std::vector<uint8_t> config = {0, 1, KEY_W, KEY_S, NO_KEY, NO_KEY, HID_KEY_ENTER};
+  combo_config_set(config.data(), config.size());
+  kbtest::run_ms(SETTLE_MS);
+
+  sim_suspend(true);
+  kbtest::run_ms(5);
+  sim_pin(PIN_W, true);
+  CHECK(!seen_within(RESUME_MS, HID_KEY_W));
+
+  sim_pin(PIN_S, true);
+  kbtest::run_ms(2);
+  CHECK(kbtest::reported(HID_KEY_ENTER));
+  CHECK(!kbtest::reported(HID_KEY_W));
+  CHECK(!kbtest::reported(HID_KEY_S));
+
+  sim_pin(PIN_W, false);
+  sim_pin(PIN_S, false);
+  kbtest::run_ms(SETTLE_MS);
+  CHECK(nothing_reported());
+}
+
+} // namespace
+
+int main() {
+  test_tap_wakes();
+  test_mod_wakes();
+  test_combo_member_wakes();
+  return kbtest::result("power_test");
+}
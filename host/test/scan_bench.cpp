@@ -0,0 +1,149 @@
+// The scan's cost per key, at whatever KEYS this copy of the firmware was built
+// with, timed against the host clock. The keyboard's own 'k' benchmark counts
+// cycles on SysTick, which the sim doesn't run, so this is where the scaling
+// gets checked: with the paths of the other builds as arguments, runs them
+// too and fails if a frame costs more per key than it does at this size
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "test.h"
+
+extern "C" {
+#include "tusb.h"
+}
+
+namespace {
+
+// Away from the analog pins and the split UART
+const int BENCH_PINS = 20;
+
+// Per key, lowest of the batches so a busy host doesn't count against us
+struct Costs {
+  int keys;
+  double idle_ns;
+  double busy_ns;
+  double raw_ns;
+};
+
+template <typename Setup, typename Timed>
+double per_call_ns(int batches, int calls, Setup setup, Timed timed) {
+  double best = 1e18;
+  for (int b = 0; b < batches; b++) {
+    std::chrono::nanoseconds total{0};
+    for (int c = 0; c < calls; c++) {
+      setup();
+      auto start = std::chrono::steady_clock::now();
+      timed();
+      total += std::chrono::steady_clock::now() - start;
+    }
+    double ns = static_cast<double>(total.count()) / calls;
+    if (ns < best)
+      best = ns;
+  }
+  return best;
+}
+
+// Every key on its own usage, spread over the pins so toggling them all puts
+// an edge on every key at once
+void set_bench_keymap() {
+  std::vector<uint8_t> config(KEYMAP_CONFIG_SIZE);
+  for (int i = 0; i < KEYS; i++) {
+    config[i * KEY_CONFIG_SIZE + 0] = i % BENCH_PINS;
+    config[i * KEY_CONFIG_SIZE + 1] = HID_KEY_A + i % 0xa0;
+    config[i * KEY_CONFIG_SIZE + 2] = HID_KEY_NONE;
+  }
+  keyboard_config_set(config.data(), config.size());
+}
+
+int keys_down() {
+  int down = 0;
+  for (int i = 0; i < KEYS; i++)
+    down += get_raw_report()[i];
+  return down;
+}
+
+Costs measure() {
+  sim_erase();
+  sim_reboot();
+  set_bench_keymap();
+  keyboard_update();
+  sim_advance_us(DEBOUNCE_MAX_US);
+
+  Costs costs{KEYS, 0, 0, 0};
+
+  // Nothing changing, the common case
+  costs.idle_ns = per_call_ns(20, 2000, [] { sim_advance_us(KEYBOARD_SCAN_RATE_US); },
+                              [] { keyboard_update(); }) / KEYS;
+
+  // Every key pressing, then every key releasing, far enough apart to clear
+  // the longest debounce window
+  bool down = false;
+  costs.busy_ns = per_call_ns(20, 20,
+                              [&] {
+                                down = !down;
+                                for (int pin = 0; pin < BENCH_PINS; pin++)
+                                  sim_pin(pin, down);
+                                sim_advance_us(DEBOUNCE_MAX_US + 5000);
+                              },
+                              [] { keyboard_update(); }) / KEYS;
+  CHECK_EQ(keys_down(), down ? KEYS : 0);
+
+  costs.raw_ns = per_call_ns(20, 2000, [] {}, [] { get_raw_report(); }) / KEYS;
+  return costs;
+}
+
+void print(const Costs &costs) {
+  std::printf("keys %d idle %.3f busy %.3f raw %.3f ns per key\n", costs.keys, costs.idle_ns, costs.busy_ns,
+              costs.raw_ns);
+}
+
+bool run_other(const std::string &path, Costs *costs) {
+  FILE *pipe = popen(path.c_str(), "r");
+  if (!pipe)
+    return false;
+  char line[256];
+  bool parsed = false;
+  while (std::fgets(line, sizeof(line), pipe)) {
+    if (std::sscanf(line, "keys %d idle %lf busy %lf raw %lf", &costs->keys, &costs->idle_ns, &costs->busy_ns,
+                    &costs->raw_ns) == 4)
+      parsed = true;
+  }
+  return pclose(pipe) == 0 && parsed;
+}
+
+// Fixed costs spread over fewer keys make the small build dearer per key, so
+// anything over this is a path that grows faster than the key count
+const double MAX_GROWTH = 2.0;
+
+void check_growth(const char *path, const char *name, double small, double big) {
+  double growth = big / small;
+  std::printf("  %-5s x%.2f per key\n", name, growth);
+  if (growth > MAX_GROWTH) {
+    std::fprintf(stderr, "%s: %s costs %.2fx as much per key as at %d keys\n", path, name, growth, KEYS);
+    kbtest::failures++;
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Costs base = measure();
+  print(base);
+
+  for (int i = 1; i < argc; i++) {
+    Costs other;
+    if (!run_other(argv[i], &other)) {
+      std::fprintf(stderr, "%s didn't run\n", argv[i]);
+      kbtest::failures++;
+      continue;
+    }
+    print(other);
+    check_growth(argv[i], "idle", base.idle_ns, other.idle_ns);
+    check_growth(argv[i], "busy", base.busy_ns, other.busy_ns);
+    check_growth(argv[i], "raw", base.raw_ns, other.raw_ns);
+  }
+
+  return kbtest::result(argc > 1 ? "scan_scaling" : "scan_bench");
+}
@@ -0,0 +1,173 @@
+// SOCD resolution on A/D, through the scan: each mode with the keys pressed
+// one after the other and in the same scan, and released in either order
+#include <memory>
+#include <vector>
+
+#include "client.h"
+#include "test.h"
+
+extern "C" {
+#include "socd.h"
+#include "tusb.h"
+}
+
+namespace {
+
+// Keys 4 and 11 in the default map
+const int KEY_A = 4, PIN_A = 5;
+const int KEY_D = 11, PIN_D = 14;
+
+// Long enough for a press or release to get through the debounce
+const int SETTLE_MS = DEBOUNCE_MAX_US / 1000 + 5;
+
+std::unique_ptr<kb::Transport> transport;
+
+void configure(uint8_t mode) {
+  sim_erase();
+  transport = kb::open_loopback();
+  kb::Client client(*transport);
+  std::vector<uint8_t> config = {1, KEY_A, KEY_D, mode};
+  std::vector<uint8_t> reply = client.socd(config);
+  CHECK_EQ(reply.size(), SOCD_CONFIG_SIZE);
+  CHECK(std::vector<uint8_t>(reply.begin(), reply.begin() + 4) == config);
+  kbtest::run_ms(SETTLE_MS);
+}
+
+void set(int pin, bool down) {
+  sim_pin(pin, down);
+  kbtest::run_ms(SETTLE_MS);
+}
+
+void set_both(bool down) {
+  sim_pin(PIN_A, down);
+  sim_pin(PIN_D, down);
+  kbtest::run_ms(SETTLE_MS);
+}
+
+#define CHECK_AD(a, d)                         \
+  do {                                         \
+    CHECK_EQ(kbtest::reported(HID_KEY_A), a);  \
+    CHECK_EQ(kbtest::reported(HID_KEY_D), d);  \
+  } while (0)
+
+void test_off() {
+  configure(SOCD_OFF);
+  set(PIN_A, true);
+  set(PIN_D, true);
+  CHECK_AD(true, true);
+  set(PIN_A, false);
+  CHECK_AD(false, true);
+  set(PIN_D, false);
+  CHECK_AD(false, false);
+}
+
+void test_last_input() {
+  configure(SOCD_LAST_INPUT);
+  set(PIN_A, true);
+  CHECK_AD(true, false);
+  set(PIN_D, true);
+  CHECK_AD(false, true);
+  // Letting go of the winner hands back to the key still held
+  set(PIN_D, false);
+  CHECK_AD(true, false);
+  set(PIN_D, true);
+  CHECK_AD(false, true);
+  // Letting go of the loser changes nothing
+  set(PIN_A, false);
+  CHECK_AD(false, true);
+  set(PIN_D, false);
+  CHECK_AD(false, false);
+
+  // In the same scan the edges go in key order, so D is the later one
+  set_both(true);
+  CHECK_AD(false, true);
+  set_both(false);
+  CHECK_AD(false, false);
+}
+
+void test_neutral() {
+  configure(SOCD_NEUTRAL);
+  set(PIN_D, true);
+  CHECK_AD(false, true);
+  set(PIN_A, true);
+  CHECK_AD(false, false);
+  set(PIN_A, false);
+  CHECK_AD(false, true);
+  set(PIN_A, true);
+  CHECK_AD(false, false);
+  set(PIN_D, false);
+  CHECK_AD(true, false);
+  set(PIN_A, false);
+  CHECK_AD(false, false);
+
+  set_both(true);
+  CHECK_AD(false, false);
+  set_both(false);
+  CHECK_AD(false, false);
+}
+
+void test_first_input() {
+  configure(SOCD_FIRST_INPUT);
+  set(PIN_D, true);
+  set(PIN_A, true);
+  CHECK_AD(false, true);
+  // Letting go of the winner hands over to the other key
+  set(PIN_D, false);
+  CHECK_AD(true, false);
+  set(PIN_D, true);
+  CHECK_AD(true, false);
+  // Letting go of the loser changes nothing
+  set(PIN_D, false);
+  CHECK_AD(true, false);
+  set(PIN_A, false);
+  CHECK_AD(false, false);
+
+  // In the same scan A goes first, so it holds
+  set_both(true);
+  CHECK_AD(true, false);
+  set_both(false);
+  CHECK_AD(false, false);
+}
+
+// Taking the pair away with both keys held reports the one that was losing
+void test_cleared_while_held() {
+  configure(SOCD_LAST_INPUT);
+  set(PIN_A, true);
+  set(PIN_D, true);
+  CHECK_AD(false, true);
+  uint32_t reports = sim_reports_sent();
+  kb::Client(*transport).socd({0});
+  kbtest::run_ms(2);
+  CHECK_AD(true, true);
+  CHECK(sim_reports_sent() > reports);
+  set_both(false);
+  CHECK_AD(false, false);
+}
+
+// Pairs that can't be right are dropped, the rest kept
+void test_config() {
+  sim_erase();
+  transport = kb::open_loopback();
+  kb::Client client(*transport);
+  std::vector<uint8_t> reply = client.socd({4, KEY_A, KEY_D, SOCD_NEUTRAL, KEY_A, 3, SOCD_NEUTRAL,
+                                            5, 5, SOCD_NEUTRAL, 6, KEYS, SOCD_NEUTRAL});
+  CHECK_EQ(reply.at(0), 1);
+  CHECK_EQ(reply.at(1), KEY_A);
+  CHECK_EQ(reply.at(2), KEY_D);
+
+  std::unique_ptr<kb::Transport> rebooted = kb::open_loopback();
+  kb::Client after(*rebooted);
+  CHECK(after.socd() == reply);
+}
+
+} // namespace
+
+int main() {
+  test_off();
+  test_last_input();
+  test_neutral();
+  test_first_input();
+  test_cleared_while_held();
+  test_config();
+  return kbtest::result("socd_test");
+}
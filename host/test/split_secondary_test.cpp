@@ -0,0 +1,120 @@
+// The half of a split board without USB, with the test playing the primary:
+// it sends its own keys over the link and leaves its keymap alone, though the
+// default map has keys on the link's TX pin and on the pins of its own keys
+#include <cstdint>
+
+#include "test.h"
+
+extern "C" {
+#include "hardware/gpio.h"
+#include "hardware/uart.h"
+#include "split.h"
+#include "tusb.h"
+}
+
+namespace {
+
+// The secondary's keys are on 4, 5, 8 and 9, which are Q, A, W and S in the
+// default map, and TX is on 20, which is F
+const int PIN_Q = 4, PIN_W = 8;
+
+// Long enough for a press or release to get through the debounce
+const int SETTLE_MS = DEBOUNCE_MAX_US / 1000 + 5;
+
+SplitRx link;
+
+// With the default map saved, as it would be from the first boot
+void boot_secondary() {
+  sim_erase();
+  sim_vbus(false);
+  sim_reboot();
+  keyboard_config_flash_save();
+  sim_reboot();
+  split_rx_reset(&link);
+}
+
+// Whatever it's sent since last time, through the primary's decoder; the
+// number of good frames
+int receive() {
+  uint8_t data[256];
+  int frames = 0;
+  for (uint32_t len; (len = sim_split_read(data, sizeof(data))) > 0;) {
+    for (uint32_t i = 0; i < len; i++)
+      frames += split_decode(&link, data[i]);
+  }
+  return frames;
+}
+
+bool link_down(int key) {
+  return link.state[key >> 3] & (1 << (key & 7));
+}
+
+// The TX pin stays on the UART, and the keymap's pins aren't touched: the
+// secondary's own keys are plain inputs and the rest were never set up
+void test_pins() {
+  boot_secondary();
+  CHECK(split_secondary());
+  CHECK_EQ(sim_pin_function(SPLIT_TX_PIN), GPIO_FUNC_UART);
+  CHECK_EQ(sim_pin_function(PIN_Q), GPIO_FUNC_SIO);
+  CHECK_EQ(sim_pin_function(0), 0);
+  CHECK_EQ(sim_pin_function(19), 0);
+
+  SplitStats stats;
+  split_stats(&stats);
+  CHECK(stats.secondary);
+}
+
+// A press goes over the link the scan it's seen, and never into a report of
+// our own, though Q is on its pin in the keymap
+void test_keys() {
+  boot_secondary();
+  kbtest::run_ms(SETTLE_MS);
+  receive();
+
+  sim_pin(PIN_Q, true);
+  sim_step();
+  CHECK(receive() > 0);
+  CHECK(link_down(0));
+  CHECK(!link_down(2));
+
+  sim_pin(PIN_W, true);
+  kbtest::run_ms(SETTLE_MS);
+  receive();
+  CHECK(link_down(0));
+  CHECK(link_down(2));
+
+  sim_pin(PIN_Q, false);
+  sim_pin(PIN_W, false);
+  kbtest::run_ms(SETTLE_MS);
+  receive();
+  CHECK(!link_down(0));
+  CHECK(!link_down(2));
+
+  CHECK_EQ(sim_reports_sent(), 0);
+  CHECK(!kbtest::reported(HID_KEY_Q));
+  CHECK(!kbtest::reported(HID_KEY_W));
+  CHECK_EQ(link.stats.crc_errors, 0);
+  CHECK_EQ(link.stats.seq_gaps, 0);
+}
+
+// With nothing changing, the full state still goes out every SPLIT_STATE_MS
+void test_state() {
+  boot_secondary();
+  kbtest::run_ms(SETTLE_MS);
+  receive();
+  uint32_t frames = link.stats.frames;
+  kbtest::run_ms(10 * SPLIT_STATE_MS);
+  receive();
+  CHECK(link.stats.frames - frames >= 9 && link.stats.frames - frames <= 11);
+  CHECK_EQ(link.stats.keys, 8);
+  CHECK_EQ(link.state[0], 0);
+}
+
+} // namespace
+
+int main() {
+  test_pins();
+  test_keys();
+  test_state();
+  return kbtest::result("split_secondary_test");
+}
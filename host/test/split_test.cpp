@@ -0,0 +1,182 @@
+// The split keyboard link, with the test playing the other half: every change
+// has to arrive, on a clean wire and through bit errors, and the keys let go
+// if the other half goes quiet
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "client.h"
+#include "test.h"
+
+extern "C" {
+#include "split.h"
+}
+
+namespace {
+
+const int REMOTE_KEYS = 4;
+
+class OtherHalf {
+ public:
+  explicit OtherHalf(int error_ppm) : error_ppm_(error_ppm) {}
+
+  void send(uint8_t frame[], int length) {
+    for (int i = 0; i < length; i++) {
+      if (static_cast<int>(rng_() % 1000000) < error_ppm_ * 8)
+        frame[i] ^= 1 << (rng_() % 8);
+    }
+    sim_split_write(frame, length);
+  }
+
+  // A scan, with the full state going out every SPLIT_STATE_MS like the
+  // secondary's main loop
+  void step() {
+    sim_step();
+    if (!quiet && sim_time_us() - state_sent_ >= SPLIT_STATE_MS * 1000) {
+      uint8_t frame[SPLIT_FRAME_MAX];
+      send(frame, split_encode_state(&tx_, state_, REMOTE_KEYS, frame));
+      state_sent_ = sim_time_us();
+    }
+  }
+
+  void change(int key, bool down) {
+    if (down)
+      state_[0] |= 1 << key;
+    else
+      state_[0] &= ~(1 << key);
+
+    uint8_t event = key | (down ? SPLIT_KEY_DOWN : 0);
+    uint8_t frame[SPLIT_FRAME_MAX];
+    send(frame, split_encode_delta(&tx_, &event, 1, frame));
+  }
+
+  bool down(int key) const { return state_[0] & 1 << key; }
+
+  std::mt19937 &rng() { return rng_; }
+
+  bool quiet = false;
+
+ private:
+  int error_ppm_;
+  std::mt19937 rng_{1};
+  SplitTx tx_ = {};
+  uint8_t state_[SPLIT_MAX_KEYS / 8] = {};
+  uint64_t state_sent_ = 0;
+};
+
+// The first REMOTE_KEYS keys of the map moved over to the other half
+std::unique_ptr<kb::Transport> open_split() {
+  sim_erase();
+  std::unique_ptr<kb::Transport> transport = kb::open_loopback();
+  kb::Client client(*transport);
+  std::vector<uint8_t> keymap = client.keymap();
+  for (int i = 0; i < REMOTE_KEYS; i++)
+    keymap[i * KEY_CONFIG_SIZE] = SPLIT_PIN_BASE + i;
+  client.set_keymap(keymap);
+  return transport;
+}
+
+SplitStats split_stats(kb::Transport &transport) {
+  kb::Client client(transport);
+  std::vector<uint8_t> data = client.run(kb::Request{{'n'}}).at(0).data;
+  SplitStats stats = {};
+  CHECK_EQ(data.size(), sizeof(stats));
+  std::memcpy(&stats, data.data(), std::min(data.size(), sizeof(stats)));
+  return stats;
+}
+
+struct Result {
+  int lost = 0;
+  uint64_t max_latency = 0;
+};
+
+// Random changes at random intervals, each waited on until it shows in the
+// raw state or the link would have timed out
+Result run_changes(OtherHalf &half, int changes) {
+  Result result;
+  for (int c = 0; c < changes; c++) {
+    for (int wait = 40 + half.rng()() % 200; wait > 0; wait--)
+      half.step();
+
+    int key = half.rng()() % REMOTE_KEYS;
+    bool down = !half.down(key);
+    half.change(key, down);
+
+    uint64_t start = sim_time_us();
+    while (get_raw_report()[key] != down && sim_time_us() - start < SPLIT_TIMEOUT_MS * 1000)
+      half.step();
+    if (get_raw_report()[key] == down) {
+      uint64_t latency = sim_time_us() - start;
+      if (latency > result.max_latency)
+        result.max_latency = latency;
+    } else {
+      result.lost++;
+    }
+  }
+  return result;
+}
+
+// Each delta is in the next scan after it's on the wire
+void test_clean() {
+  std::unique_ptr<kb::Transport> transport = open_split();
+  OtherHalf half(0);
+  Result result = run_changes(half, 500);
+  CHECK_EQ(result.lost, 0);
+  CHECK(result.max_latency <= 2 * KEYBOARD_SCAN_RATE_US);
+
+  SplitStats stats = split_stats(*transport);
+  CHECK(stats.link_up);
+  CHECK(!stats.secondary);
+  CHECK(stats.frames >= 500);
+  CHECK_EQ(stats.crc_errors, 0);
+  CHECK_EQ(stats.seq_gaps, 0);
+  CHECK_EQ(stats.repairs, 0);
+  CHECK_EQ(stats.timeouts, 0);
+}
+
+// With a bit error every 60 bytes or so deltas get lost, and a later full
+// state puts the key right before the timeout would have let go of it
+void test_bit_errors() {
+  std::unique_ptr<kb::Transport> transport = open_split();
+  OtherHalf half(2000);
+  Result result = run_changes(half, 1000);
+  CHECK_EQ(result.lost, 0);
+  CHECK(result.max_latency > 2 * KEYBOARD_SCAN_RATE_US);
+
+  SplitStats stats = split_stats(*transport);
+  CHECK(stats.crc_errors > 0);
+  CHECK(stats.seq_gaps > 0);
+  CHECK(stats.repairs > 0);
+  CHECK_EQ(stats.timeouts, 0);
+}
+
+// Nothing from the other half for SPLIT_TIMEOUT_MS lets go of its keys
+void test_timeout() {
+  std::unique_ptr<kb::Transport> transport = open_split();
+  OtherHalf half(0);
+  for (int i = 0; i < 100; i++)
+    half.step();
+  half.change(1, true);
+  for (int i = 0; i < 4; i++)
+    half.step();
+  CHECK(get_raw_report()[1]);
+
+  half.quiet = true;
+  for (int i = 0; i < (SPLIT_TIMEOUT_MS + 5) * 1000 / KEYBOARD_SCAN_RATE_US; i++)
+    half.step();
+  CHECK(!get_raw_report()[1]);
+
+  SplitStats stats = split_stats(*transport);
+  CHECK_EQ(stats.timeouts, 1);
+  CHECK(!stats.link_up);
+}
+
+} // namespace
+
+int main() {
+  test_clean();
+  test_bit_errors();
+  test_timeout();
+  return kbtest::result("split_test");
+}
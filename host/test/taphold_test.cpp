@@ -0,0 +1,258 @@
+// Tap-hold on Q, through the scan: when each mode decides between tap and
+// hold, and that nothing is lost or left down when the buffers fill up
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "client.h"
+#include "test.h"
+
+extern "C" {
+#include "taphold.h"
+#include "tusb.h"
+}
+
+namespace {
+
+// Key 3 in the default map, and the keys after it
+const int KEY_Q = 3, PIN_Q = 4;
+const int PIN_W = 8;
+const int OTHER_PINS[] = {8, 9, 10, 13, 14, 15, 19, 20};
+const int OTHER_CODES[] = {HID_KEY_W, HID_KEY_S, HID_KEY_X, HID_KEY_E,
+                           HID_KEY_D, HID_KEY_C, HID_KEY_V, HID_KEY_F};
+
+const int TERM_MS = 200;
+const int HOLD_CODE = HID_KEY_SHIFT_LEFT;
+
+// Long enough for a press or release to get through the debounce
+const int SETTLE_MS = DEBOUNCE_MAX_US / 1000 + 5;
+
+std::unique_ptr<kb::Transport> transport;
+
+void configure(uint8_t mode) {
+  sim_erase();
+  transport = kb::open_loopback();
+  kb::Client client(*transport);
+  std::vector<uint8_t> config = {TERM_MS, 1, KEY_Q, HOLD_CODE, mode};
+  std::vector<uint8_t> reply = client.taphold(config);
+  CHECK_EQ(reply.size(), TAPHOLD_CONFIG_SIZE);
+  CHECK(std::vector<uint8_t>(reply.begin(), reply.begin() + 5) == config);
+  kbtest::run_ms(SETTLE_MS);
+}
+
+// The first and last ms each code was in the report, -1 if it never was
+struct Seen {
+  int first = -1;
+  int last = -1;
+};
+
+std::map<int, Seen> watch(int ms, std::initializer_list<int> codes) {
+  std::map<int, Seen> seen;
+  for (int code : codes)
+    seen[code];
+  for (int i = 0; i < ms * 1000 / KEYBOARD_SCAN_RATE_US; i++) {
+    sim_step();
+    for (auto &[code, s] : seen) {
+      if (kbtest::reported(code)) {
+        if (s.first < 0)
+          s.first = i * KEYBOARD_SCAN_RATE_US / 1000;
+        s.last = i * KEYBOARD_SCAN_RATE_US / 1000;
+      }
+    }
+  }
+  return seen;
+}
+
+void set(int pin, bool down, int ms = SETTLE_MS) {
+  sim_pin(pin, down);
+  kbtest::run_ms(ms);
+}
+
+// In the slots or, for keys past the sixth, the NKRO bitmap
+bool nothing_reported() {
+  for (int i = 0; i < KEYBOARD_REPORT_SIZE; i++) {
+    if (get_keycode_report()[i])
+      return false;
+  }
+  for (int i = 0; i < KEYBOARD_NKRO_KEYS / 8; i++) {
+    if (get_nkro_report()[i])
+      return false;
+  }
+  return true;
+}
+
+// Let go inside the term: the tap, pressed and released in reports of its own
+void test_tap() {
+  configure(TAPHOLD_TERM);
+  set(PIN_Q, true, 50);
+  CHECK(nothing_reported());
+  sim_pin(PIN_Q, false);
+  auto seen = watch(SETTLE_MS, {HID_KEY_Q, HOLD_CODE});
+  CHECK(seen[HID_KEY_Q].first >= 0);
+  CHECK(!kbtest::reported(HID_KEY_Q));
+  CHECK_EQ(seen[HOLD_CODE].first, -1);
+}
+
+// Held on its own, it turns into the hold when the term runs out
+void test_term() {
+  configure(TAPHOLD_TERM);
+  sim_pin(PIN_Q, true);
+  auto seen = watch(TERM_MS + SETTLE_MS, {HID_KEY_Q, HOLD_CODE});
+  CHECK(seen[HOLD_CODE].first >= TERM_MS - 1 && seen[HOLD_CODE].first <= TERM_MS + 1);
+  CHECK_EQ(seen[HID_KEY_Q].first, -1);
+  set(PIN_Q, false);
+  CHECK(nothing_reported());
+}
+
+// Plain term mode waits out a roll over another key, then types both in order
+void test_term_roll() {
+  configure(TAPHOLD_TERM);
+  set(PIN_Q, true);
+  set(PIN_W, true);
+  set(PIN_W, false);
+  CHECK(nothing_reported());
+  sim_pin(PIN_Q, false);
+  auto seen = watch(SETTLE_MS, {HID_KEY_Q, HID_KEY_W, HOLD_CODE});
+  CHECK(seen[HID_KEY_Q].first >= 0);
+  CHECK(seen[HID_KEY_W].first >= seen[HID_KEY_Q].first);
+  CHECK_EQ(seen[HOLD_CODE].first, -1);
+  CHECK(nothing_reported());
+}
+
+// Another key tapped inside the term is a hold the moment it's released, with
+// the other key's tap coming after the hold code
+void test_permissive() {
+  configure(TAPHOLD_PERMISSIVE);
+  set(PIN_Q, true);
+  sim_pin(PIN_W, true);
+  auto pressed = watch(SETTLE_MS, {HID_KEY_W, HOLD_CODE});
+  CHECK_EQ(pressed[HID_KEY_W].first, -1);
+  CHECK_EQ(pressed[HOLD_CODE].first, -1);
+
+  sim_pin(PIN_W, false);
+  auto released = watch(SETTLE_MS, {HID_KEY_Q, HID_KEY_W, HOLD_CODE});
+  CHECK(released[HOLD_CODE].first >= 0 && released[HOLD_CODE].first <= 1);
+  CHECK(released[HID_KEY_W].first >= released[HOLD_CODE].first);
+  CHECK(!kbtest::reported(HID_KEY_W));
+  CHECK_EQ(released[HID_KEY_Q].first, -1);
+  CHECK(kbtest::reported(HOLD_CODE));
+
+  set(PIN_Q, false);
+  CHECK(nothing_reported());
+}
+
+// Letting go of the tap-hold key first is still a tap
+void test_permissive_roll() {
+  configure(TAPHOLD_PERMISSIVE);
+  set(PIN_Q, true);
+  set(PIN_W, true);
+  sim_pin(PIN_Q, false);
+  auto seen = watch(SETTLE_MS, {HID_KEY_Q, HID_KEY_W, HOLD_CODE});
+  CHECK(seen[HID_KEY_Q].first >= 0);
+  CHECK(seen[HID_KEY_W].first >= seen[HID_KEY_Q].first);
+  CHECK_EQ(seen[HOLD_CODE].first, -1);
+  CHECK(kbtest::reported(HID_KEY_W));
+  set(PIN_W, false);
+  CHECK(nothing_reported());
+}
+
+// Another key going down inside the term is a hold straight away
+void test_hold_on_other() {
+  configure(TAPHOLD_HOLD_ON_OTHER);
+  set(PIN_Q, true);
+  sim_pin(PIN_W, true);
+  auto seen = watch(SETTLE_MS, {HID_KEY_Q, HID_KEY_W, HOLD_CODE});
+  CHECK(seen[HOLD_CODE].first >= 0 && seen[HOLD_CODE].first <= 1);
+  CHECK(seen[HID_KEY_W].first >= seen[HOLD_CODE].first);
+  CHECK_EQ(seen[HID_KEY_Q].first, -1);
+
+  set(PIN_W, false);
+  CHECK(kbtest::reported(HOLD_CODE));
+  set(PIN_Q, false);
+  CHECK(nothing_reported());
+}
+
+// More edges inside the term than the buffer holds force the hold, and the
+// edge that didn't fit goes out after the rest
+void test_buffer_full() {
+  configure(TAPHOLD_TERM);
+  set(PIN_Q, true);
+  for (int pin : OTHER_PINS)
+    set(pin, true, 1);
+  kbtest::run_ms(SETTLE_MS);
+  CHECK(nothing_reported());
+
+  sim_pin(OTHER_PINS[0], false);
+  auto seen = watch(SETTLE_MS, {HOLD_CODE, OTHER_CODES[0], OTHER_CODES[1], OTHER_CODES[2], OTHER_CODES[3],
+                                OTHER_CODES[4], OTHER_CODES[5], OTHER_CODES[6], OTHER_CODES[7]});
+  CHECK(seen[HOLD_CODE].first >= 0 && seen[HOLD_CODE].first <= 1);
+  for (int code : OTHER_CODES)
+    CHECK(seen[code].first >= 0);
+  CHECK(!kbtest::reported(OTHER_CODES[0]));
+  CHECK(kbtest::reported(OTHER_CODES[1]));
+
+  for (int pin : OTHER_PINS)
+    sim_pin(pin, false);
+  set(PIN_Q, false);
+  CHECK(nothing_reported());
+}
+
+// More releases deferred in one report than the queue holds: none get lost
+void test_deferred_full() {
+  configure(TAPHOLD_TERM);
+  const int keys[] = {4, 5, 6, 7, 8, 10, 11, 12, 16, 17};
+  for (int key : keys) {
+    keyboard_activate_event(key, true);
+    keyboard_defer_event(key, false);
+  }
+  keyboard_report_sent();
+  kbtest::run_ms(SETTLE_MS);
+  CHECK(nothing_reported());
+  CHECK(!keyboard_keys_down());
+}
+
+// A new config lets go of the old one's hold straight away, and sends what
+// it was holding back, rather than leaving it all until the next key edge
+void test_config_change() {
+  configure(TAPHOLD_TERM);
+  set(PIN_Q, true, TERM_MS + SETTLE_MS);
+  CHECK(kbtest::reported(HOLD_CODE));
+  uint32_t reports = sim_reports_sent();
+  kb::Client(*transport).taphold({0, 0});
+  kbtest::run_ms(2);
+  CHECK(!kbtest::reported(HOLD_CODE));
+  CHECK(sim_reports_sent() > reports);
+  set(PIN_Q, false);
+  CHECK(nothing_reported());
+
+  configure(TAPHOLD_TERM);
+  set(PIN_Q, true);
+  set(PIN_W, true);
+  CHECK(nothing_reported());
+  reports = sim_reports_sent();
+  kb::Client(*transport).taphold({0, 0});
+  kbtest::run_ms(2);
+  CHECK(sim_reports_sent() > reports);
+  CHECK(kbtest::reported(HID_KEY_Q));
+  CHECK(kbtest::reported(HID_KEY_W));
+  CHECK(!kbtest::reported(HOLD_CODE));
+  sim_pin(PIN_W, false);
+  set(PIN_Q, false);
+  CHECK(nothing_reported());
+}
+
+} // namespace
+
+int main() {
+  test_tap();
+  test_term();
+  test_term_roll();
+  test_permissive();
+  test_permissive_roll();
+  test_hold_on_other();
+  test_buffer_full();
+  test_deferred_full();
+  test_config_change();
+  return kbtest::result("taphold_test");
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+// Just enough of a test framework for ctest: CHECK reports a failure and
+// carries on, and main returns test_result() so the run fails if any did.
+// The helpers drive the in-process firmware a scan at a time (see sim.h)
+#include <cstdio>
+
+#include "sim.h"
+
+extern "C" {
+#include "keyboard.h"
+}
+
+namespace kbtest {
+
+inline int failures = 0;
+
+// Runs the main loop for ms of simulated time
+inline void run_ms(int ms) {
+  for (int i = 0; i < ms * 1000 / KEYBOARD_SCAN_RATE_US; i++)
+    sim_step();
+}
+
+// In the boot report's slots or the NKRO bitmap
+inline bool reported(int key_code) {
+  const uint8_t *report = get_keycode_report();
+  for (int i = 0; i < KEYBOARD_REPORT_SIZE; i++) {
+    if (report[i] == key_code)
+      return true;
+  }
+  return key_code < KEYBOARD_NKRO_KEYS && (get_nkro_report()[key_code >> 3] & (1 << (key_code & 7)));
+}
+
+inline int result(const char *name) {
+  if (failures == 0)
+    std::printf("%s: all passed\n", name);
+  else
+    std::printf("%s: %d failed\n", name, failures);
+  return failures == 0 ? 0 : 1;
+}
+
+} // namespace kbtest
+
+#define CHECK(condition)                                                         \
+  do {                                                                           \
+    if (!(condition)) {                                                          \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      kbtest::failures++;                                                        \
+    }                                                                            \
+  } while (0)
+
+#define CHECK_EQ(actual, expected)                                               \
+  do {                                                                           \
+    long long actual_ = (long long) (actual), expected_ = (long long) (expected); \
+    if (actual_ != expected_) {                                                  \
+      std::fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, \
+                   #actual, actual_, expected_);                                 \
+      kbtest::failures++;                                                        \
+    }                                                                            \
+  } while (0)
@@ -0,0 +1,128 @@
+#include "client.h"
+
+#include <stdexcept>
+
+#ifdef KB_HAVE_LIBUSB
+#include <libusb.h>
+#endif
+
+namespace kb {
+
+#ifdef KB_HAVE_LIBUSB
+
+namespace {
+
+// usb_descriptors.c: TinyUSB's test VID, and the PID it builds from the
+// classes in use (HID and vendor)
+const uint16_t KEYBOARD_VID = 0xCAFE;
+const uint16_t KEYBOARD_PID = 0x5014;
+
+class UsbTransport : public Transport {
+ public:
+  UsbTransport() {
+    if (libusb_init(&context_) != 0)
+      throw std::runtime_error("libusb_init failed");
+
+    handle_ = libusb_open_device_with_vid_pid(context_, KEYBOARD_VID, KEYBOARD_PID);
+    if (!handle_) {
+      libusb_exit(context_);
+      throw std::runtime_error("no keyboard found");
+    }
+
+    find_vendor_interface();
+    libusb_set_auto_detach_kernel_driver(handle_, 1);
+    if (libusb_claim_interface(handle_, interface_) != 0) {
+      close();
+      throw std::runtime_error("couldn't claim the vendor interface");
+    }
+
+    // What the WebUSB page does to connect: a CDC-style set line state. The
+    // firmware answers it with a greeting that isn't a framed message, so
+    // let that go by
+    libusb_control_transfer(handle_, LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE,
+                            0x22, 1, interface_, nullptr, 0, 1000);
+    uint8_t discard[64];
+    int got;
+    while (libusb_bulk_transfer(handle_, in_, discard, sizeof(discard), &got, 50) == 0 && got > 0) {
+    }
+  }
+
+  ~UsbTransport() override {
+    libusb_control_transfer(handle_, LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE,
+                            0x22, 0, interface_, nullptr, 0, 1000);
+    libusb_release_interface(handle_, interface_);
+    close();
+  }
+
+  void send(const std::vector<uint8_t> &command) override {
+    int sent = 0;
+    int result = libusb_bulk_transfer(handle_, out_, const_cast<uint8_t *>(command.data()),
+                                      static_cast<int>(command.size()), &sent, 1000);
+    if (result != 0 || sent != static_cast<int>(command.size()))
+      throw std::runtime_error(std::string("write failed: ") + libusb_error_name(result));
+  }
+
+  std::vector<uint8_t> receive(int timeout_ms) override {
+    std::vector<uint8_t> data(512);
+    int got = 0;
+    int result = libusb_bulk_transfer(handle_, in_, data.data(), static_cast<int>(data.size()),
+                                      &got, timeout_ms);
+    if (result != 0 && result != LIBUSB_ERROR_TIMEOUT)
+      throw std::runtime_error(std::string("read failed: ") + libusb_error_name(result));
+    data.resize(got);
+    return data;
+  }
+
+ private:
+  void find_vendor_interface() {
+    libusb_config_descriptor *config;
+    if (libusb_get_active_config_descriptor(libusb_get_device(handle_), &config) != 0)
+      throw std::runtime_error("no config descriptor");
+
+    for (int i = 0; i < config->bNumInterfaces; i++) {
+      const libusb_interface_descriptor &alt = config->interface[i].altsetting[0];
+      if (alt.bInterfaceClass != LIBUSB_CLASS_VENDOR_SPEC)
+        continue;
+
+      interface_ = alt.bInterfaceNumber;
+      for (int e = 0; e < alt.bNumEndpoints; e++) {
+        uint8_t address = alt.endpoint[e].bEndpointAddress;
+        if (address & LIBUSB_ENDPOINT_IN)
+          in_ = address;
+        else
+          out_ = address;
+      }
+    }
+    libusb_free_config_descriptor(config);
+
+    if (interface_ < 0)
+      throw std::runtime_error("no vendor interface");
+  }
+
+  void close() {
+    libusb_close(handle_);
+    libusb_exit(context_);
+  }
+
+  libusb_context *context_ = nullptr;
+  libusb_device_handle *handle_ = nullptr;
+  int interface_ = -1;
+  uint8_t in_ = 0;
+  uint8_t out_ = 0;
+};
+
+} // namespace
+
+std::unique_ptr<Transport> open_usb() {
+  return std::make_unique<UsbTransport>();
+}
+
+#else
+
+std::unique_ptr<Transport> open_usb() {
+  throw std::runtime_error("built without libusb, only --loopback is available");
+}
+
+#endif
+
+} // namespace kb
@@ -0,0 +1,17 @@
+#ifndef HOTPATH_H_
+#define HOTPATH_H_
+
+#include "pico/stdlib.h"
+
+// Marks a function on the scan and report path. With cmake -DKEYBOARD_RAM=hot
+// these are placed in SRAM instead of running through the XIP cache; whether
+// that's worth the SRAM is for the 'k' benchmark's cold numbers to show. It
+// doesn't help with flash writes, which take XIP away altogether; save.c keeps
+// interrupts off around each erase and program so nothing runs from it then
+#ifdef KEYBOARD_RAM_HOT_PATH
+#define HOT_PATH(name) __not_in_flash_func(name)
+#else
+#define HOT_PATH(name) name
+#endif
+
+#endif /* HOTPATH_H_ */
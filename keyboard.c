@@ -6,57 +6,175 @@
 #include "keyboard.h"
 
 #include "pico/stdlib.h"
-#include <string.h> // for memset
+#include <string.h> // for memcpy, memset
 #include <stdlib.h> // malloc
 
-#include "bsp/board.h" // for board_get_millis
+#include "hardware/clocks.h" // for clock_get_hz
+#include "hardware/structs/systick.h" // for cycle counting in the benchmark
+#include "hardware/structs/xip_ctrl.h" // for flushing the XIP cache in the benchmark
 #include "tusb.h" // for keyboard keys
 #include "save.h" // for saving / loading state across restarts
+#include "analog.h" // for Hall-effect switches
+#include "socd.h" // for opposing key resolution
+#include "combo.h" // for chords
+#include "taphold.h" // for mod-tap keys
+#include "mousekeys.h" // for keys mapped to the mouse
+#include "gamepad.h" // for keys mapped to the gamepad
+#include "debounce.h"
+#include "chatter.h" // for per-key debounce windows
+#include "recorder.h" // for the flight recorder
+#include "capture.h" // for raw pin capture
+#include "split.h" // for keys on the other half
+#include "boot.h" // for the boot trace
+#include "log.h"
+#include "hotpath.h" // for HOT_PATH
 
 typedef struct {
-  int pin;
-  bool state;
-  bool reported_state;
-  int reported_time;
-  int current_edge; // 0: nothing, 1 - rising, -1: falling
+  uint8_t pin;
+  uint8_t keycode;
+  uint8_t keycode_alt;
+} KeyConfig;
 
-  int keycode;
-  int keycode_alt;
+typedef struct {
+  int pin; // the pin we've set up for this key
+  bool ready; // false until the pin has been set up
+  Debounce debounce;
+  int current_edge; // 0: nothing, 1 - rising, -1: falling
+  bool analog; // read through the ADC rather than as a digital pin
+  bool remote; // on the other half of a split board, already debounced there
 } Key;
 
 Key keys[KEYS];
 uint8_t keycode_report[KEYBOARD_REPORT_SIZE];
+uint8_t nkro_report[KEYBOARD_NKRO_SIZE];
+
+// Config changes are built up in the shadow keymap and swapped in at the
+// start of the next scan, so the scan never sees a half-applied config
+KeyConfig keymaps[2][KEYS];
+KeyConfig * keymap = keymaps[0];
+KeyConfig * shadow = keymaps[1];
+bool keymap_pending = false;
+
+int modifier_key = NO_KEY_INDEX;
+
+// Set by keyboard_wake, for the next scan
+int woken_by = NO_KEY_INDEX;
+uint32_t woken_time = 0;
+
+// Key events that have to go out in a later report than the current one, like
+// the release half of a tap that was held back
+#define DEFERRED_EVENTS 8
+typedef struct {
+  uint8_t key;
+  bool down;
+} KeyEvent;
+
+KeyEvent deferred[DEFERRED_EVENTS];
+int deferred_count = 0;
+bool report_sent = false;
 
-int modifier_key = NO_KEY;
+// Start of the current scan, for edges that come out of the deferred queue
+uint32_t scan_time = 0;
+
+// A scan the benchmark ran found a real change, which goes out with the next
+bool benchmark_changed = false;
+
+// So does a config change between scans that let go of, or sent, something
+bool config_changed = false;
 
 
 void set_key(uint8_t id, uint8_t pin, uint8_t key_code, uint8_t keycode_alt) {
-  if (id >= KEYS)
+  if (!KEY_IN_RANGE(id))
     return;
 
-  // If we're erasing the key
-  if (key_code == HID_KEY_NONE && keycode_alt == HID_KEY_NONE) {
-    if (modifier_key == id)
-      modifier_key = NO_KEY;
+  if (!keymap_pending) {
+    memcpy(shadow, keymap, sizeof(keymaps[0]));
+    keymap_pending = true;
+  }
 
-    return;
+  shadow[id].pin = pin;
+  shadow[id].keycode = key_code;
+  shadow[id].keycode_alt = keycode_alt;
+}
+
+static bool nkro_reported(int key_code) {
+  return key_code < KEYBOARD_NKRO_KEYS && (nkro_report[key_code >> 3] & (1 << (key_code & 7)));
+}
+
+bool key_reported(int key_code) {
+  for (int i = 0; i < KEYBOARD_REPORT_SIZE; i++) {
+    if (keycode_report[i] == key_code)
+      return true;
   }
+  return nkro_reported(key_code);
+}
 
-  gpio_init(pin);
-  gpio_set_dir(pin, GPIO_IN);
-  gpio_pull_up(pin);
+void key_setup_pin(int id, int pin) {
+  bool remote = pin >= SPLIT_PIN_BASE && pin < SPLIT_PIN_BASE + SPLIT_MAX_KEYS;
 
-  if (key_code == SPECIAL_KEY_MOD) {
-    modifier_key = id;
+  if (remote) {
+    split_listen();
+  } else if (analog_pin(pin)) {
+    analog_enable(pin);
+  } else {
+    gpio_init(pin);
+    gpio_set_dir(pin, GPIO_IN);
+    gpio_pull_up(pin);
   }
 
   keys[id].pin = pin;
-  keys[id].state = false;
-  keys[id].reported_state = false;
-  keys[id].reported_time = 0;
+  keys[id].ready = true;
+  keys[id].analog = analog_pin(pin);
+  keys[id].remote = remote;
   keys[id].current_edge = 0;
-  keys[id].keycode = key_code;
-  keys[id].keycode_alt = keycode_alt;
+  debounce_reset(&keys[id].debounce);
+}
+
+// Makes the shadow keymap live. Only keys that actually changed are touched:
+// a new pin gets set up (and anything the old one had down is let go), a
+// held key with new codes swaps them in the report, and everything else -
+// including the debounce state of held keys - carries on as if nothing happened.
+// Returns true if that changed the report
+bool keymap_swap() {
+  bool changed = false;
+
+  for (int i = 0; i < KEYS; i++) {
+    KeyConfig *old = &keymap[i];
+    KeyConfig *new = &shadow[i];
+    bool erased = new->keycode == HID_KEY_NONE && new->keycode_alt == HID_KEY_NONE;
+    bool codes_changed = old->keycode != new->keycode || old->keycode_alt != new->keycode_alt;
+
+    // Erased keys leave their pin alone; they can't send anything anyway
+    bool pin_changed = (!keys[i].ready || keys[i].pin != new->pin) && !erased;
+
+    if (!codes_changed && !pin_changed)
+      continue;
+
+    bool alt = old->keycode_alt != HID_KEY_NONE && key_reported(old->keycode_alt);
+    bool held = alt || key_reported(old->keycode);
+    key_release(old->keycode);
+    key_release(old->keycode_alt);
+    changed |= held;
+
+    if (pin_changed)
+      key_setup_pin(i, new->pin);
+    else if (held)
+      key_press(alt ? new->keycode_alt : new->keycode);
+  }
+
+  KeyConfig * live = shadow;
+  shadow = keymap;
+  keymap = live;
+  keymap_pending = false;
+
+  modifier_key = NO_KEY_INDEX;
+  for (int i = 0; i < KEYS; i++) {
+    if (keymap[i].keycode == SPECIAL_KEY_MOD)
+      modifier_key = i;
+    gamepad_map(i, keymap[i].keycode);
+  }
+
+  return changed;
 }
 
 void keyboard_set_default() {
@@ -91,31 +209,114 @@ void keyboard_set_default() {
 #endif
 }
 
-bool keyboard_config_flash_valid() {
-  uint8_t config[KEYS * KEY_CONFIG_SIZE]; 
-  flash_read(config, sizeof(config));
+// Flash holds the keymap followed by the SOCD pairs, the combos, the
+// tap-hold keys and the analog thresholds; older saves have zeros after the
+// keymap, which reads as none (or, for analog keys, the defaults)
+#define SOCD_CONFIG_OFFSET KEYMAP_CONFIG_SIZE
+#define COMBO_CONFIG_OFFSET (SOCD_CONFIG_OFFSET + SOCD_CONFIG_SIZE)
+#define TAPHOLD_CONFIG_OFFSET (COMBO_CONFIG_OFFSET + COMBO_CONFIG_SIZE)
+#define ANALOG_CONFIG_OFFSET (TAPHOLD_CONFIG_OFFSET + TAPHOLD_CONFIG_SIZE)
+#define FLASH_CONFIG_SIZE (ANALOG_CONFIG_OFFSET + ANALOG_CONFIG_SIZE)
+
+bool config_save_pending = false;
+
+// The profile that saves go to; a switch from a key waits for the next scan
+// so it never lands in the middle of the combo or tap-hold code that sent it
+int profile = 0;
+int profile_request = -1;
+
+// Blank or foreign flash won't have our pins where we expect them
+bool keyboard_config_valid(uint8_t config[]) {
+  KeyConfig *map = keymap_pending ? shadow : keymap;
   for (int i = 0; i < KEYS; i++) {
-    if (keys[i].pin != config[i * KEY_CONFIG_SIZE]) {
+    if (map[i].pin != config[i * KEY_CONFIG_SIZE]) {
       return false;
     }
   }
   return true;
 }
 
+// True if it changed the report; the keymap's changes wait for the swap
+bool keyboard_config_apply(uint8_t config[]) {
+  bool changed = false;
+  keyboard_config_set(config, KEYMAP_CONFIG_SIZE);
+  changed |= socd_config_set(config + SOCD_CONFIG_OFFSET, SOCD_CONFIG_SIZE);
+  changed |= combo_config_set(config + COMBO_CONFIG_OFFSET, COMBO_CONFIG_SIZE);
+  changed |= taphold_config_set(config + TAPHOLD_CONFIG_OFFSET, TAPHOLD_CONFIG_SIZE);
+  analog_config_set(config + ANALOG_CONFIG_OFFSET, ANALOG_CONFIG_SIZE);
+  return changed;
+}
+
 void keyboard_config_flash_save() {
-  uint8_t config[KEYS * KEY_CONFIG_SIZE];
-  keyboard_config_read(config, sizeof(config));
-  flash_write(config, sizeof(config));
+  uint8_t config[FLASH_CONFIG_SIZE];
+  keyboard_config_read(config, KEYMAP_CONFIG_SIZE);
+  socd_config_read(config + SOCD_CONFIG_OFFSET, SOCD_CONFIG_SIZE);
+  combo_config_read(config + COMBO_CONFIG_OFFSET, COMBO_CONFIG_SIZE);
+  taphold_config_read(config + TAPHOLD_CONFIG_OFFSET, TAPHOLD_CONFIG_SIZE);
+  analog_config_read(config + ANALOG_CONFIG_OFFSET, ANALOG_CONFIG_SIZE);
+  flash_write(profile, config, sizeof(config));
+  config_save_pending = false;
+  LOG(LOG_CONFIG_SAVED, profile);
 }
 
 void keyboard_config_flash_load() {
-  uint8_t config[KEYS * KEY_CONFIG_SIZE];
-  flash_read(config, sizeof(config));
-  keyboard_config_set(config, sizeof(config));
+  uint8_t config[FLASH_CONFIG_SIZE];
+  flash_read(profile, config, sizeof(config));
+  config_changed |= keyboard_config_apply(config);
+}
+
+// Stages the stored image without erasing or programming anything; the keymap
+// swap at the start of the next scan makes it live. A profile that's never
+// been saved keeps the current config, and the next save fills it in
+bool keyboard_profile_select(int index, bool persist) {
+  uint8_t config[FLASH_CONFIG_SIZE];
+
+  if (index < 0 || index >= FLASH_PROFILES)
+    return false;
+
+  flash_read(index, config, sizeof(config));
+  if (keyboard_config_valid(config))
+    config_changed |= keyboard_config_apply(config);
+
+  profile = index;
+  if (persist)
+    flash_selection_write(index);
+  LOG(LOG_PROFILE, index, persist);
+  return true;
+}
+
+int keyboard_profile() {
+  return profile;
+}
+
+// Bit n set if profile n has a saved config
+uint8_t keyboard_profiles_saved() {
+  uint8_t config[KEYMAP_CONFIG_SIZE];
+  uint8_t saved = 0;
+
+  for (int i = 0; i < FLASH_PROFILES; i++) {
+    flash_read(i, config, sizeof(config));
+    if (keyboard_config_valid(config))
+      saved |= 1 << i;
+  }
+  return saved;
+}
+
+void keyboard_config_changed(bool changed) {
+  config_changed |= changed;
+}
+
+// True if we booted without a saved config and still need to write one
+bool keyboard_config_save_pending() {
+  return config_save_pending;
 }
 
 void keyboard_config_reset() {
   keyboard_set_default();
+  config_changed |= socd_config_reset();
+  config_changed |= combo_config_reset();
+  config_changed |= taphold_config_reset();
+  analog_config_reset();
   keyboard_config_flash_save();
 }
 
@@ -123,19 +324,22 @@ int min(int a, int b) {
   return (a < b) ? a : b;
 }
 
-int keyboard_config_read(uint8_t config[], uint8_t len) {
+int keyboard_config_read(uint8_t config[], int len) {
   int size = min(len, KEYS * KEY_CONFIG_SIZE); // stops overflows
+  size -= size % KEY_CONFIG_SIZE; // whole keys only
 
+  // A config that's been set but not swapped in yet is still the current one
+  KeyConfig *map = keymap_pending ? shadow : keymap;
   for (int i = 0; i < size / 3; i++) {
-    config[i * KEY_CONFIG_SIZE + 0] = keys[i].pin;
-    config[i * KEY_CONFIG_SIZE + 1] = keys[i].keycode;
-    config[i * KEY_CONFIG_SIZE + 2] = keys[i].keycode_alt;
+    config[i * KEY_CONFIG_SIZE + 0] = map[i].pin;
+    config[i * KEY_CONFIG_SIZE + 1] = map[i].keycode;
+    config[i * KEY_CONFIG_SIZE + 2] = map[i].keycode_alt;
   }
 
   return size;
 }
 
-void keyboard_config_set(uint8_t config[], uint8_t len) {
+void keyboard_config_set(uint8_t config[], int len) {
   int end = min(len, KEYS * KEY_CONFIG_SIZE); // stops overflows
 
   for (int index = 0; index < end; index += KEY_CONFIG_SIZE) {
@@ -147,23 +351,70 @@ void keyboard_config_set(uint8_t config[], uint8_t len) {
   }
 }
 
+// One pass: the defaults and the saved config are both merged into the shadow
+// keymap before anything touches GPIO, then a single swap sets up each pin
+// once. Writing the defaults out on first boot (an erase and program, each
+// with interrupts off, see save.c) is left to the main loop so it doesn't hold
+// up enumeration
 void keyboard_init() {
-  for (int i = 0; i < KEYS; i++) {
-    keys[i].keycode = 0;
-    keys[i].keycode_alt = 0;
-  }
-
+  uint8_t config[FLASH_CONFIG_SIZE];
+
+  // As at power on, so no key's pin counts as set up yet; the host sim
+  // reboots without clearing memory
+  memset(keys, 0, sizeof(keys));
+  socd_config_reset();
+  combo_config_reset();
+  taphold_config_reset();
+  analog_config_reset();
   keyboard_set_default();
-  if (keyboard_config_flash_valid()) {
-    keyboard_config_flash_load();
-  } else {
-    keyboard_config_flash_save();
+
+  // Boot into the last persisted profile, or the first if that one's blank
+  profile = flash_selection_read();
+  flash_read(profile, config, sizeof(config));
+  if (!keyboard_config_valid(config) && profile != 0) {
+    profile = 0;
+    flash_read(profile, config, sizeof(config));
   }
+  chatter_init();
+  boot_mark(BOOT_FLASH_READ);
+
+  if (keyboard_config_valid(config))
+    keyboard_config_apply(config);
+  else
+    config_save_pending = true;
+
+  // The half of a split board without USB scans its own pins, see split.c, and
+  // the keymap's could be anything there, the link's TX pin included
+  if (!split_secondary())
+    keymap_swap();
+  boot_mark(BOOT_KEYMAP_READY);
+}
+
+static bool keyboard_gamepad_code(int key_code) {
+  return (key_code >= SPECIAL_KEY_GAMEPAD_BUTTON && key_code < SPECIAL_KEY_GAMEPAD_BUTTON + GAMEPAD_BUTTONS) ||
+         (key_code >= SPECIAL_KEY_GAMEPAD_HAT && key_code < SPECIAL_KEY_GAMEPAD_HAT + GAMEPAD_DIRS);
 }
 
-void key_press(int key_code) {
+void HOT_PATH(key_press)(int key_code) {
   if (key_code == HID_KEY_NONE) return;
 
+  if (key_code >= SPECIAL_KEY_PROFILE && key_code < SPECIAL_KEY_PROFILE + FLASH_PROFILES) {
+    profile_request = key_code - SPECIAL_KEY_PROFILE;
+    return;
+  }
+
+  if (key_code >= SPECIAL_KEY_MOUSE && key_code < SPECIAL_KEY_MOUSE + MOUSE_KEYS) {
+    mousekeys_press(key_code - SPECIAL_KEY_MOUSE);
+    return;
+  }
+
+  // Gamepad keys are read straight from the key state, see gamepad.c
+  if (keyboard_gamepad_code(key_code))
+    return;
+
+  if (nkro_reported(key_code))
+    return;
+
   int index = -1;
   for (int i = 0; i < KEYBOARD_REPORT_SIZE; i++) {
     // Check to see if key is already pressed
@@ -176,42 +427,135 @@ void key_press(int key_code) {
       index = i;
   }
 
-  if (index != -1)
+  if (index != -1) {
     keycode_report[index] = key_code;
+    return;
+  }
+
+  // It stays in the bitmap until it's released, even if a slot frees up
+  recorder_add(time_us_32(), RECORD_SLOT_FULL, 0, key_code);
+  if (key_code < KEYBOARD_NKRO_KEYS)
+    nkro_report[key_code >> 3] |= 1 << (key_code & 7);
 }
 
-void key_release(int key_code) {
+void HOT_PATH(key_release)(int key_code) {
   if (key_code == HID_KEY_NONE) return;
 
+  if (key_code >= SPECIAL_KEY_MOUSE && key_code < SPECIAL_KEY_MOUSE + MOUSE_KEYS) {
+    mousekeys_release(key_code - SPECIAL_KEY_MOUSE);
+    return;
+  }
+
+  if (keyboard_gamepad_code(key_code))
+    return;
+
   for (int i = 0; i < KEYBOARD_REPORT_SIZE; i++) {
     if (keycode_report[i] == key_code) {
       keycode_report[i] = 0;
       return;
     }
   }
+
+  if (key_code < KEYBOARD_NKRO_KEYS)
+    nkro_report[key_code >> 3] &= ~(1 << (key_code & 7));
 }
 
-bool modifier_state() {
-  if (modifier_key == NO_KEY)
+bool HOT_PATH(modifier_state)() {
+  if (taphold_layer())
+    return true;
+
+  if (modifier_key == NO_KEY_INDEX)
     return false;
 
-  return keys[modifier_key].reported_state;
+  return keys[modifier_key].debounce.reported_state;
+}
+
+void HOT_PATH(key_activate)(int id, bool active, bool modifier) {
+  if (active) {
+    key_press(modifier ? keymap[id].keycode_alt : keymap[id].keycode);
+  } else {
+    // Releasing both codes is cheap, and doesn't have side effects if do it when we're not down
+    key_release(keymap[id].keycode);
+    key_release(keymap[id].keycode_alt);
+  }
 }
 
-void keyboard_update_pressed() {
+void HOT_PATH(keyboard_activate_event)(int key, bool down) {
+  SocdChange changes[2];
   bool modifier = modifier_state();
 
+  // Opposing key pairs may turn this edge into a release of the other key
+  int count = socd_edge(key, down, changes);
+  for (int c = 0; c < count; c++)
+    key_activate(changes[c].key, changes[c].active, modifier);
+}
+
+void HOT_PATH(keyboard_key_event)(int key, bool down) {
+  if (taphold_event(key, down, scan_time))
+    keyboard_activate_event(key, down);
+}
+
+int keyboard_key_pin(int key) {
+  if (key < 0 || key >= KEYS || !keys[key].ready || keys[key].analog || keys[key].remote)
+    return -1;
+  return keys[key].pin;
+}
+
+void keyboard_wake(int key, uint32_t time) {
+  if (key >= 0 && key < KEYS) {
+    woken_by = key;
+    woken_time = time;
+  }
+}
+
+// Into the report being built. Anything that gets deferred again on the way
+// through (the release of a tap-hold tap, say) queues up for the one after
+static void HOT_PATH(keyboard_deferred_flush)() {
+  KeyEvent replay[DEFERRED_EVENTS];
+  int count = deferred_count;
+  memcpy(replay, deferred, sizeof(deferred));
+  deferred_count = 0;
+
+  for (int i = 0; i < count; i++)
+    keyboard_key_event(replay[i].key, replay[i].down);
+}
+
+void HOT_PATH(keyboard_defer_event)(int key, bool down) {
+  // A full queue goes out in this report rather than lose an edge, which
+  // could leave a key stuck down; at worst a tap shares a report with its
+  // press and the OS misses it
+  if (deferred_count == DEFERRED_EVENTS)
+    keyboard_deferred_flush();
+
+  if (deferred_count < DEFERRED_EVENTS)
+    deferred[deferred_count++] = (KeyEvent) { key, down };
+  else
+    keyboard_activate_event(key, down); // the flush filled it again
+  report_sent = false;
+}
+
+// The report we built has gone to the USB stack, so deferred events can go in
+// the next one
+void keyboard_report_sent() {
+  report_sent = true;
+}
+
+bool keyboard_keys_down() {
+  for (int i = 0; i < KEYS; i++) {
+    if (keys[i].ready && (keys[i].debounce.state || keys[i].debounce.reported_state))
+      return true;
+  }
+  return deferred_count > 0;
+}
+
+void HOT_PATH(keyboard_update_pressed)(uint32_t time) {
   for (int i = 0; i < KEYS; i++) {
-    if (keys[i].keycode == SPECIAL_KEY_MOD)
+    if (keymap[i].keycode == SPECIAL_KEY_MOD || keys[i].current_edge == 0)
       continue;
-    
-    if (keys[i].current_edge == -1) {
-      key_press(modifier ? keys[i].keycode_alt : keys[i].keycode);
-    } else if (keys[i].current_edge == 1) {
-      // Releasing both codes is cheap, and doesn't have side effects if do it when we're not down
-      key_release(keys[i].keycode);
-      key_release(keys[i].keycode_alt);
-    }
+
+    bool down = keys[i].current_edge == -1;
+    if (combo_edge(i, down, time))
+      keyboard_key_event(i, down);
   }
 }
 
@@ -221,7 +565,7 @@ bool keyboard_speed_test() {
   // Need to space the releases from the presses so that the operating system 
   // doesn't disregard the inputs (maybe it does its own debouncing)
   const int flood_start = 50;
-  if (keys[modifier_key].reported_state && keys[0].reported_state) {
+  if (keys[modifier_key].debounce.reported_state && keys[0].debounce.reported_state) {
     flood = flood_start;
   }
 
@@ -253,43 +597,98 @@ bool keyboard_speed_test() {
   return false; // test was not run
 }
 
-bool keyboard_update() {
-  int time = board_millis();
+bool HOT_PATH(keyboard_update)() {
+  uint32_t time = scan_time = time_us_32();
   bool state = false;
-  bool changed = false;
+  bool changed = benchmark_changed;
 
-  // Get and store the physical state of the hardware
-  for (int i = 0; i < KEYS; i++) {
-    state = !gpio_get(keys[i].pin);
+  benchmark_changed = false;
+
+  boot_mark(BOOT_FIRST_SCAN);
+
+  if (profile_request != -1) {
+    keyboard_profile_select(profile_request, false);
+    profile_request = -1;
+  }
+  changed |= config_changed;
+  config_changed = false;
 
-    if (state == keys[i].state) 
-      continue; // no change
-    
-    keys[i].state = state;
+  // Config changes land between scans
+  if (keymap_pending)
+    changed |= keymap_swap();
+
+  if (deferred_count > 0 && report_sent) {
+    keyboard_deferred_flush();
+    changed = true;
   }
 
-  // For each key, if the hardware state is different than the last reported state
-  // and greater than debounce time has elapsed, report it and log that this frame
-  // we have a rising or falling edge
+  // The key that woke the host went down while we weren't scanning, and may
+  // be back up by now; it goes in as a debounced press, and the scan finds
+  // the release as usual. The debounce window runs from now rather than from
+  // the press, so a tap that's already over still gets a report of its own
+  int woken = NO_KEY_INDEX;
+  if (woken_by != NO_KEY_INDEX) {
+    Debounce *d = &keys[woken_by].debounce;
+    if (!d->reported_state) {
+      d->state = d->reported_state = true;
+      d->changed_time = d->reported_time = time;
+      recorder_add(woken_time, RECORD_KEY_EDGE, woken_by, 1);
+      woken = woken_by;
+    }
+    woken_by = NO_KEY_INDEX;
+  }
+
+  analog_update();
+  split_task(time);
+
+  // Get the physical state of the hardware and run it through the debouncer;
+  // if the state is different from the last reported state and the debounce
+  // time has elapsed, this frame has a rising or falling edge. Analog keys don't
+  // bounce - their thresholds already give us hysteresis - and the other half
+  // of a split board has debounced its keys already, so they skip it
   for (int i = 0; i < KEYS; i++) {
-    if (keys[i].state != keys[i].reported_state && time > keys[i].reported_time + DEBOUNCE_MS) {
-      // If the pin is in a different state to what was reported, and we're after the debounce time,
-      // change the state of the switch
-      keys[i].reported_state = keys[i].state;
-      keys[i].reported_time = time;
-      keys[i].current_edge = keys[i].reported_state ? -1 : 1;
+    bool clean = keys[i].analog || keys[i].remote;
+    if (keys[i].analog)
+      state = analog_pressed(keys[i].pin);
+    else if (keys[i].remote)
+      state = split_key_state(keys[i].pin - SPLIT_PIN_BASE);
+    else
+      state = !gpio_get(keys[i].pin);
+
+    if (state != keys[i].debounce.state) {
+      recorder_add(time, RECORD_RAW_EDGE, i, state);
+      capture_edge(i, state);
+      if (!clean)
+        chatter_raw_edge(i, time);
+    }
+
+    keys[i].current_edge = debounce_update(&keys[i].debounce, state, time, chatter_window(i),
+                                           clean ? DEBOUNCE_NONE : DEBOUNCE_ALGORITHM);
+    if (keys[i].current_edge != 0) {
+      recorder_add(time, RECORD_KEY_EDGE, i, keys[i].current_edge == -1);
+      if (!clean)
+        chatter_reported_edge(i, time, keys[i].current_edge == -1);
       changed = true;
-    } else if (keys[i].state != keys[i].reported_state && time > keys[i].reported_time + DEBOUNCE_MS) {
-      // Otherwise if the pin has changed and we're in the debounce time, extend the debounce time
-      keys[i].reported_time = time;
-    } else if (keys[i].current_edge != 0) {
-      // Otherwise if the pin hasn't changed, but did change last frame, reset the edge
-      keys[i].current_edge = 0;
     }
   }
 
+  capture_update();
+
+  // The wake press is this scan's edge on its key, so it takes the same path
+  // as any other: past the modifier key check and through the combo engine
+  if (woken != NO_KEY_INDEX) {
+    keys[woken].current_edge = -1;
+    changed = true;
+  }
+
   if (changed)
-    keyboard_update_pressed();
+    keyboard_update_pressed(time);
+
+  if (combo_update(time))
+    changed = true;
+
+  if (taphold_update(time))
+    changed = true;
 
   //if (keyboard_speed_test())
   //  changed = true;
@@ -297,15 +696,144 @@ bool keyboard_update() {
   return changed;
 }
 
-uint8_t * get_keycode_report() {
+uint8_t * HOT_PATH(get_keycode_report)() {
   return keycode_report;
 };
 
+uint8_t * HOT_PATH(get_nkro_report)() {
+  return nkro_report;
+};
+
 uint8_t raw_report[KEYS];
-uint8_t * get_raw_report() {  
-  int index = 0;
+uint8_t * HOT_PATH(get_raw_report)() {  
   for (int i = 0; i < KEYS; i++) {
-    raw_report[i] = keys[i].reported_state;
+    raw_report[i] = keys[i].debounce.reported_state;
   }
   return raw_report;
-};
\ No newline at end of file
+};
+
+// SysTick counts down from 0xffffff at the processor clock
+static uint32_t cycles_since(uint32_t start) {
+  return (start - systick_hw->cvr) & 0xffffff;
+}
+
+bool keyboard_benchmark(ScanBench *result) {
+  const int runs = 256;
+  static Key saved_keys[KEYS];
+  uint8_t saved_report[KEYBOARD_REPORT_SIZE];
+  uint8_t saved_nkro[KEYBOARD_NKRO_SIZE];
+  KeyEvent saved_deferred[DEFERRED_EVENTS];
+  int saved_deferred_count;
+  bool saved_report_sent;
+  int saved_profile_request;
+  uint32_t start, cycles, total, max;
+
+  if (keyboard_keys_down())
+    return false;
+
+  systick_hw->rvr = 0xffffff;
+  systick_hw->csr = 0x5; // enabled, processor clock, no interrupt
+
+  memset(result, 0, sizeof(ScanBench));
+  result->keys = KEYS;
+  result->budget = clock_get_hz(clk_sys) / 1000000 * KEYBOARD_SCAN_RATE_US;
+
+  // These are real scans, and anything they find has to get to the host. A
+  // key going down ends the run, as the rest would hold its report back
+  total = max = 0;
+  for (int r = 0; r < runs; r++) {
+    start = systick_hw->cvr;
+    benchmark_changed |= keyboard_update();
+    cycles = cycles_since(start);
+    total += cycles;
+    max = cycles > max ? cycles : max;
+    if (benchmark_changed)
+      return false;
+  }
+  result->update_avg = total / runs;
+  result->update_max = max;
+
+  // The same with the XIP cache emptied first, so anything on the path that
+  // runs from flash has to be fetched again - the worst case a scan can hit.
+  // Reading FLUSH back waits for it to finish
+  total = max = 0;
+  for (int r = 0; r < runs; r++) {
+    xip_ctrl_hw->flush = 1;
+    (void) xip_ctrl_hw->flush;
+
+    start = systick_hw->cvr;
+    benchmark_changed |= keyboard_update();
+    cycles = cycles_since(start);
+    total += cycles;
+    max = cycles > max ? cycles : max;
+    if (benchmark_changed)
+      return false;
+  }
+  result->update_cold_avg = total / runs;
+  result->update_cold_max = max;
+
+  // From here on it's made-up edges through the same code the scan uses,
+  // which scribble over the keys, the report and every module's idea of
+  // what's down, so all of it goes back afterwards. A real press in the
+  // meantime is still on its pin for the next scan to find
+  memcpy(saved_keys, keys, sizeof(keys));
+  memcpy(saved_report, keycode_report, sizeof(keycode_report));
+  memcpy(saved_nkro, nkro_report, sizeof(nkro_report));
+  memcpy(saved_deferred, deferred, sizeof(deferred));
+  saved_deferred_count = deferred_count;
+  saved_report_sent = report_sent;
+  saved_profile_request = profile_request;
+  combo_state_save();
+  taphold_state_save();
+  socd_state_save();
+  mousekeys_state_save();
+  recorder_pause(true);
+
+  // Every key pressing then every key releasing, so the report is full and
+  // each press has to search it
+  total = max = 0;
+  for (int r = 0; r < runs; r++) {
+    for (int i = 0; i < KEYS; i++)
+      keys[i].current_edge = (r & 1) ? 1 : -1;
+
+    start = systick_hw->cvr;
+    keyboard_update_pressed(time_us_32());
+    cycles = cycles_since(start);
+    total += cycles;
+    max = cycles > max ? cycles : max;
+  }
+  result->pressed_avg = total / runs;
+  result->pressed_max = max;
+
+  memset(keycode_report, HID_KEY_A, sizeof(keycode_report));
+  start = systick_hw->cvr;
+  for (int r = 0; r < runs; r++)
+    key_press(HID_KEY_B + (r & 7));
+  result->key_press_avg = cycles_since(start) / runs;
+
+  start = systick_hw->cvr;
+  for (int r = 0; r < runs; r++)
+    key_release(HID_KEY_B + (r & 7));
+  result->key_release_avg = cycles_since(start) / runs;
+
+  start = systick_hw->cvr;
+  for (int r = 0; r < runs; r++)
+    get_raw_report();
+  result->raw_report_avg = cycles_since(start) / runs;
+
+  result->over_budget = result->update_cold_max + result->pressed_max + result->raw_report_avg > result->budget;
+
+  memcpy(keys, saved_keys, sizeof(keys));
+  memcpy(keycode_report, saved_report, sizeof(keycode_report));
+  memcpy(nkro_report, saved_nkro, sizeof(nkro_report));
+  memcpy(deferred, saved_deferred, sizeof(deferred));
+  deferred_count = saved_deferred_count;
+  report_sent = saved_report_sent;
+  profile_request = saved_profile_request;
+  combo_state_restore();
+  taphold_state_restore();
+  socd_state_restore();
+  mousekeys_state_restore();
+  recorder_pause(false);
+  return true;
+}
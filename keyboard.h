@@ -5,37 +5,113 @@
 
 #define BOARD003
 
-#ifdef BOARD003
-  #define KEYS 19
-#else
-  #define KEYS 0
+// KEYS can be overridden from the build (see KEYBOARD_KEYS in CMakeLists.txt)
+// to measure how the scan scales with bigger boards
+#ifndef KEYS
+  #ifdef BOARD003
+    #define KEYS 19
+  #else
+    #define KEYS 0
+  #endif
 #endif
 #define KEY_CONFIG_SIZE 3
+#define KEYMAP_CONFIG_SIZE (KEYS * KEY_CONFIG_SIZE)
 
-// Debounce is 'settling time' for the keypress, so a noisy key will take longer
-#define DEBOUNCE_MS 10
+// Debounce is 'settling time' for the keypress, so a noisy key will take longer.
+// Each key learns its own window between the bounds (see chatter.h), starting
+// from DEBOUNCE_US
+#define DEBOUNCE_US 10000
+#define DEBOUNCE_MIN_US 1000
+#define DEBOUNCE_MAX_US 20000
+#define DEBOUNCE_ALGORITHM DEBOUNCE_EAGER // see debounce.h
 
-// TODO: Figure out NKRO!
 #define KEYBOARD_REPORT_SIZE 6
+// Presses that don't fit in the report's slots go in a bitmap sent on its own
+// interface, one bit per usage up to the modifiers
+#define KEYBOARD_NKRO_KEYS 0xe8
+#define KEYBOARD_NKRO_SIZE (KEYBOARD_NKRO_KEYS / 8)
 #define KEYBOARD_SCAN_RATE_US 125
 
 #define SPECIAL_KEY_MOD 0xfe
 #define SPECIAL_KEY_BENCHMARK 0xfd
+#define SPECIAL_KEY_PROFILE 0xf0 // 0xf0 + n switches to profile n, see save.h
+#define SPECIAL_KEY_MOUSE 0xa5   // 0xa5 + MOUSE_KEY_, see mousekeys.h; a gap in the HID usage table
+#define SPECIAL_KEY_GAMEPAD_BUTTON 0xe8 // 0xe8 + n is gamepad button n + 1, see gamepad.h
+#define SPECIAL_KEY_GAMEPAD_HAT 0xf4    // 0xf4 + GAMEPAD_DIR_
 #define NO_KEY 255
+// KEYS can be 256, so a key index that may be none is an int holding this
+// rather than NO_KEY
+#define NO_KEY_INDEX -1
+
+// A byte holding a key number is always in range at 256 keys, where comparing
+// it with KEYS would only draw -Wtype-limits
+#if KEYS < 256
+#define KEY_IN_RANGE(key) ((key) < KEYS)
+#else
+#define KEY_IN_RANGE(key) true
+#endif
 
 void keyboard_config_flash_load();
 void keyboard_config_flash_save();
-int keyboard_config_read(uint8_t config[], uint8_t len);
-void keyboard_config_set(uint8_t config[], uint8_t len);
+bool keyboard_config_save_pending();
+int keyboard_config_read(uint8_t config[], int len);
+void keyboard_config_set(uint8_t config[], int len);
 void keyboard_config_reset();
 
+// For the SOCD, combo and tap-hold config set between scans: true if setting
+// it changed the report, which then goes out with the next scan
+void keyboard_config_changed(bool changed);
+
+// Switch between the configs stored in flash; persist makes it the one we boot into
+bool keyboard_profile_select(int index, bool persist);
+int keyboard_profile();
+uint8_t keyboard_profiles_saved();
+
 void keyboard_init();
 bool keyboard_update();
 
 void key_press(int key_code);
 void key_release(int key_code);
 
+// For anything that holds key edges back (combos, tap-hold) and lets them go
+// later; keyboard_activate_event skips tap-hold and goes straight to the report
+void keyboard_key_event(int key, bool down);
+void keyboard_activate_event(int key, bool down);
+void keyboard_defer_event(int key, bool down);
+void keyboard_report_sent();
+
+// Anything held, mid-bounce or still waiting to go out; the benchmarks stall
+// the scan, so they don't run while the keyboard's in use
+bool keyboard_keys_down();
+
+// For waking from suspend: the GPIO behind a key (-1 if it hasn't got one we
+// can take an interrupt on), and a press that happened while we weren't
+// scanning, to go in the next report
+int keyboard_key_pin(int key);
+void keyboard_wake(int key, uint32_t time);
+
 uint8_t * get_keycode_report();
+uint8_t * get_nkro_report();
 uint8_t * get_raw_report();
 
+// Cycle counts for the scan and report paths, from the SysTick counter
+typedef struct {
+  uint32_t keys;
+  uint32_t budget;         // cycles in one KEYBOARD_SCAN_RATE_US
+  uint32_t update_avg;     // keyboard_update with nothing changing
+  uint32_t update_max;
+  uint32_t update_cold_avg; // the same straight after an XIP cache flush
+  uint32_t update_cold_max;
+  uint32_t pressed_avg;    // keyboard_update_pressed with every key on an edge
+  uint32_t pressed_max;
+  uint32_t key_press_avg;  // into a full report, the worst case
+  uint32_t key_release_avg;
+  uint32_t raw_report_avg;
+  uint32_t over_budget;    // non-zero if a busy scan doesn't fit in the budget
+} ScanBench;
+
+// False, with nothing measured, if keys are in use or one goes down while it
+// runs; the benchmark's scans stand in for the main loop's meanwhile
+bool keyboard_benchmark(ScanBench *result);
+
 #endif /* KEYBOARD_H_ */
\ No newline at end of file
@@ -1,33 +1,213 @@
-#include "bsp/board.h"
+/**
+ * Status LED and per-key lighting, done in hardware so the scan loop never
+ * has to toggle anything.
+ *
+ * The status LED sits on a PWM slice for brightness, and a DMA channel steps
+ * its compare level through a pattern table, paced by the wrap of a second,
+ * pin-less PWM slice. A blink is a table that's half on and half off, a
+ * breathe is a ramp, and changing either is just rewriting the table and the
+ * pace. Like the analog sampling, a second channel restarts the first.
+ *
+ * WS2812 pixels go out through a PIO state machine fed by DMA from a frame
+ * buffer; drawing into the other buffer while one is going out means a frame
+ * is never torn.
+ */
 #include "led.h"
 
-int blink_interval_ms = LED_BLINK_NOT_MOUNTED;
-bool led_state = false;
+#include <string.h>
+#include "hardware/pwm.h"
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+#include "hardware/clocks.h"
+#include "ws2812.pio.h"
+
+#define LED_LEVEL_MAX 4096 // PWM counts per period, ~30kHz at 125MHz
+#define LED_PATTERN_STEPS 128
+#define LED_PACE_SLICE 7 // no pins on it, only its wrap DREQ is used
+#define LED_PACE_HZ 1000000 // pace counter rate, so its wrap is in us
+
+uint32_t pattern[LED_PATTERN_STEPS];
+uint32_t * pattern_start = pattern;
+int pattern_dma = -1;
+int pattern_restart_dma = -1;
+int led_shift = 0; // which half of the CC register our channel is
+
+static void led_pace(int period_ms) {
+  uint32_t step_us = period_ms * 1000 / LED_PATTERN_STEPS;
+  if (step_us < 1)
+    step_us = 1;
+  if (step_us > 65536)
+    step_us = 65536;
+  pwm_set_wrap(LED_PACE_SLICE, step_us - 1);
+}
+
+static void led_level(int step, uint32_t level) {
+  pattern[step] = level << led_shift;
+}
 
 void led_init() {
-  blink_interval_ms = LED_BLINK_DEFAULT;
+#ifdef PICO_DEFAULT_LED_PIN
+  int pin = PICO_DEFAULT_LED_PIN;
+  uint slice = pwm_gpio_to_slice_num(pin);
+  led_shift = pwm_gpio_to_channel(pin) == PWM_CHAN_B ? 16 : 0;
+
+  pwm_config config = pwm_get_default_config();
+  pwm_config_set_wrap(&config, LED_LEVEL_MAX - 1);
+  pwm_init(slice, &config, true);
+  gpio_set_function(pin, GPIO_FUNC_PWM);
+
+  pwm_config pace = pwm_get_default_config();
+  pwm_config_set_clkdiv(&pace, (float) clock_get_hz(clk_sys) / LED_PACE_HZ);
+  pwm_init(LED_PACE_SLICE, &pace, false);
+
+  pattern_dma = dma_claim_unused_channel(true);
+  pattern_restart_dma = dma_claim_unused_channel(true);
+
+  // Writes one level per pace wrap, then hands over to the restart channel
+  dma_channel_config pattern_config = dma_channel_get_default_config(pattern_dma);
+  channel_config_set_transfer_data_size(&pattern_config, DMA_SIZE_32);
+  channel_config_set_read_increment(&pattern_config, true);
+  channel_config_set_write_increment(&pattern_config, false);
+  channel_config_set_dreq(&pattern_config, DREQ_PWM_WRAP0 + LED_PACE_SLICE);
+  channel_config_set_chain_to(&pattern_config, pattern_restart_dma);
+  dma_channel_configure(pattern_dma, &pattern_config, &pwm_hw->slice[slice].cc, pattern,
+                        LED_PATTERN_STEPS, false);
+
+  // Points it back at the start of the table and retriggers it
+  dma_channel_config restart_config = dma_channel_get_default_config(pattern_restart_dma);
+  channel_config_set_transfer_data_size(&restart_config, DMA_SIZE_32);
+  channel_config_set_read_increment(&restart_config, false);
+  channel_config_set_write_increment(&restart_config, false);
+  dma_channel_configure(pattern_restart_dma, &restart_config, &dma_hw->ch[pattern_dma].al3_read_addr_trig,
+                        &pattern_start, 1, false);
+
+  led_blink(LED_BLINK_DEFAULT);
+  dma_channel_start(pattern_dma);
+  pwm_set_enabled(LED_PACE_SLICE, true);
+#endif
+
+  led_pixels_init();
 }
 
 void led_blink(int interval) {
-  blink_interval_ms = interval;
+  if (interval == LED_BLINK_DISABLED) {
+    led_solid(false);
+    return;
+  }
+
+  led_pace(interval * 2);
+  for (int i = 0; i < LED_PATTERN_STEPS; i++)
+    led_level(i, i < LED_PATTERN_STEPS / 2 ? LED_LEVEL_MAX : 0);
+}
+
+// Up and down once per period, squared so it looks linear to the eye
+void led_breathe(int period_ms) {
+  const int half = LED_PATTERN_STEPS / 2;
+
+  led_pace(period_ms);
+  for (int i = 0; i < LED_PATTERN_STEPS; i++) {
+    int x = i < half ? i : LED_PATTERN_STEPS - i;
+    led_level(i, x * x * LED_LEVEL_MAX / (half * half));
+  }
 }
 
 void led_solid(bool on) {
-  blink_interval_ms = LED_BLINK_DISABLED;
-  board_led_write(on);
-  led_state = on;
+  for (int i = 0; i < LED_PATTERN_STEPS; i++)
+    led_level(i, on ? LED_LEVEL_MAX : 0);
+}
+
+#if LED_PIXELS > 0
+#define LED_PIXEL_HZ 800000
+#define LED_PIXEL_RESET_US 300 // latch time; older parts need 50, newer ones 280
+
+uint32_t pixel_frames[2][LED_PIXELS];
+uint32_t * pixels = pixel_frames[0]; // being drawn
+uint32_t * pixels_out = pixel_frames[1]; // going out
+bool pixels_dirty = false;
+uint32_t pixels_sent_us = 0;
+
+PIO pixel_pio = pio0;
+int pixel_sm = -1;
+int pixel_dma = -1;
+
+void led_pixels_init() {
+  uint offset = pio_add_program(pixel_pio, &ws2812_program);
+  pixel_sm = pio_claim_unused_sm(pixel_pio, true);
+  ws2812_program_init(pixel_pio, pixel_sm, offset, LED_PIXEL_PIN, LED_PIXEL_HZ);
+
+  pixel_dma = dma_claim_unused_channel(true);
+  dma_channel_config config = dma_channel_get_default_config(pixel_dma);
+  channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+  channel_config_set_read_increment(&config, true);
+  channel_config_set_write_increment(&config, false);
+  channel_config_set_dreq(&config, pio_get_dreq(pixel_pio, pixel_sm, true));
+  dma_channel_configure(pixel_dma, &config, &pixel_pio->txf[pixel_sm], pixels_out, LED_PIXELS, false);
+
+  led_pixels_show();
+}
+
+// GRB, in the top 24 bits as the state machine shifts out MSB first
+void led_pixel_set(int index, uint8_t r, uint8_t g, uint8_t b) {
+  if (index < 0 || index >= LED_PIXELS)
+    return;
+
+  pixels[index] = ((uint32_t) g << 24) | ((uint32_t) r << 16) | ((uint32_t) b << 8);
+  pixels_dirty = true;
 }
 
+void led_pixels_show() {
+  pixels_dirty = true;
+  led_task();
+}
+
+// Starts the next frame once the last one has gone out and latched
 void led_task() {
-  static uint32_t start_ms = 0;
+  const uint32_t frame_us = LED_PIXELS * 24 * 1000000 / LED_PIXEL_HZ + LED_PIXEL_RESET_US;
+
+  if (!pixels_dirty || pixel_dma == -1 || dma_channel_is_busy(pixel_dma) ||
+      time_us_32() - pixels_sent_us < frame_us)
+    return;
 
-  // blink is disabled
-  if (!blink_interval_ms) return;
+  uint32_t * out = pixels;
+  pixels = pixels_out;
+  pixels_out = out;
+  memcpy(pixels, pixels_out, sizeof(pixel_frames[0]));
 
-  // Blink every interval ms
-  if ( board_millis() - start_ms < blink_interval_ms) return; // not enough time
-  start_ms += blink_interval_ms;
+  dma_channel_transfer_from_buffer_now(pixel_dma, pixels_out, LED_PIXELS);
+  pixels_sent_us = time_us_32();
+  pixels_dirty = false;
+}
+#else
+void led_pixels_init() {}
+void led_pixel_set(int index, uint8_t r, uint8_t g, uint8_t b) {
+  (void) index;
+  (void) r;
+  (void) g;
+  (void) b;
+}
+void led_pixels_show() {}
+void led_task() {}
+#endif
 
-  board_led_write(led_state);
-  led_state = 1 - led_state; // toggle
-}
\ No newline at end of file
+// The pace slice and the pixel state machine are divided down from clk_sys,
+// so they have to be worked out again whenever it changes
+void led_clock_changed() {
+#ifdef PICO_DEFAULT_LED_PIN
+  pwm_set_clkdiv(LED_PACE_SLICE, (float) clock_get_hz(clk_sys) / LED_PACE_HZ);
+#endif
+
+#if LED_PIXELS > 0
+  int cycles_per_bit = ws2812_T1 + ws2812_T2 + ws2812_T3;
+  if (pixel_sm != -1)
+    pio_sm_set_clkdiv(pixel_pio, pixel_sm, (float) clock_get_hz(clk_sys) / (LED_PIXEL_HZ * cycles_per_bit));
+#endif
+}
+
+// Lights the pixel under each key that's down
+void led_keys(uint8_t pressed[], int count) {
+  for (int i = 0; i < count && i < LED_PIXELS; i++) {
+    uint8_t level = pressed[i] ? 0x40 : 0;
+    led_pixel_set(i, level, level, level);
+  }
+  led_pixels_show();
+}
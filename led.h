@@ -1,6 +1,9 @@
 #ifndef LED_H_
 #define LED_H_
 
+#include "pico/stdlib.h"
+
+// Blink intervals in ms, on for one interval then off for the next
 enum  {
   LED_BLINK_DEFAULT = 50,
   LED_BLINK_NOT_MOUNTED = 100,
@@ -9,9 +12,27 @@ enum  {
   LED_BLINK_DISABLED = 0,
 };
 
+// Per-key RGB on a WS2812 chain, pixel n under key n; 0 for boards without one
+#ifndef LED_PIXELS
+#define LED_PIXELS 0
+#endif
+#define LED_PIXEL_PIN 22
+
+// The status LED runs from PWM, with DMA stepping it through a pattern, and
+// the pixels go out through PIO and DMA, so none of this costs the scan loop
+// anything once it's set up
 void led_init();
 void led_blink(int interval);
+void led_breathe(int period_ms);
 void led_solid(bool on);
+void led_clock_changed();
+
+void led_pixels_init();
+void led_pixel_set(int index, uint8_t r, uint8_t g, uint8_t b);
+void led_pixels_show();
+void led_keys(uint8_t pressed[], int count);
+
+// Only has work to do when a pixel frame is waiting on the last one to latch
 void led_task();
 
-#endif /* LED_H_ */
\ No newline at end of file
+#endif /* LED_H_ */
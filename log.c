@@ -0,0 +1,44 @@
+/**
+ * Deferred log ring. Writers only ever move log_written on, and the drain
+ * keeps its own place, so writing never waits for the host and a drain that
+ * falls a whole ring behind just skips to the oldest entry still there.
+ * Unlike the flight recorder's dump, a drain takes entries away: the next
+ * one starts where this one finished.
+ */
+#include "log.h"
+
+LogEntry log_ring[LOG_SIZE];
+uint32_t log_written = 0;
+
+static uint32_t log_read = 0;
+static uint32_t drain_end = 0;
+static bool draining = false;
+
+void log_drain_start() {
+  drain_end = log_written;
+  draining = true;
+}
+
+bool log_drain_running() {
+  return draining;
+}
+
+// Returns 0 once, when the drain has finished
+int log_drain_read(LogEntry out[], int max) {
+  int count = 0;
+
+  if (max > 0 && log_written - log_read > LOG_SIZE) {
+    uint32_t oldest = log_written - LOG_SIZE;
+    out[count++] = (LogEntry) { time_us_32(), LOG_DROPPED, 0, { oldest - log_read, 0, 0 } };
+    log_read = oldest;
+    if ((int32_t) (log_read - drain_end) > 0)
+      drain_end = log_read; // lapped the whole drain
+  }
+
+  while (count < max && log_read != drain_end)
+    out[count++] = log_ring[log_read++ & (LOG_SIZE - 1)];
+
+  if (count == 0)
+    draining = false;
+  return count;
+}
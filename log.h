@@ -0,0 +1,73 @@
+#ifndef LOG_H_
+#define LOG_H_
+
+#include "pico/stdlib.h"
+
+// Deferred logging. A call site stores a format ID and up to LOG_ARGS raw
+// arguments in a RAM ring; nothing is formatted on the device. The formats
+// live in the table below, which the firmware only takes the IDs from, and
+// the host tools build their copy of the strings from the same table, so
+// the two can't drift apart. Arguments are 32 bits, so formats should stick
+// to %u, %d and %x
+#define LOG_SIZE 512 // entries, must be a power of 2
+#define LOG_ARGS 3
+
+#define LOG_FORMATS(X) \
+  X(LOG_DROPPED,          "%u entries lost, the ring lapped the drain") \
+  X(LOG_MOUNTED,          "usb mounted") \
+  X(LOG_UNMOUNTED,        "usb unmounted") \
+  X(LOG_SUSPEND,          "usb suspended, remote wakeup %u") \
+  X(LOG_RESUME,           "usb resumed after %u ms") \
+  X(LOG_CLOCK,            "clk_sys now %u kHz (level %u)") \
+  X(LOG_PROFILE,          "profile %u selected, persist %u") \
+  X(LOG_CONFIG_SAVED,     "config saved to profile %u") \
+  X(LOG_DEBOUNCE_SAVED,   "learned debounce windows saved") \
+  X(LOG_SWITCH_FAILING,   "key %u failing: settles in %u us, %u escapes") \
+  X(LOG_CAPTURE_ARMED,    "capture armed on key %u, edge %u, %u Hz") \
+  X(LOG_CAPTURE_DONE,     "capture done, %u samples") \
+  X(LOG_SPLIT_UP,         "split link up") \
+  X(LOG_SPLIT_DOWN,       "split link lost, %u crc errors, %u sequence gaps") \
+  X(LOG_WEBUSB_DROPPED,   "vendor message '%c' of %u bytes dropped, queue full")
+
+#define LOG_ENUM(id, format) id,
+enum {
+  LOG_FORMATS(LOG_ENUM)
+  LOG_FORMAT_COUNT
+};
+
+typedef struct {
+  uint32_t time; // time_us_32()
+  uint16_t id;   // LOG_
+  uint16_t reserved;
+  uint32_t args[LOG_ARGS];
+} LogEntry;
+
+extern LogEntry log_ring[LOG_SIZE];
+extern uint32_t log_written;
+
+// Five stores and an increment. Like the flight recorder, it's for the main
+// loop only - an interrupt writing in the middle of one would tear it
+static inline void log_write(uint16_t id, uint32_t a, uint32_t b, uint32_t c) {
+  LogEntry *entry = &log_ring[log_written++ & (LOG_SIZE - 1)];
+  entry->time = time_us_32();
+  entry->id = id;
+  entry->args[0] = a;
+  entry->args[1] = b;
+  entry->args[2] = c;
+}
+
+// LOG(LOG_CLOCK, khz, level) and so on, with up to LOG_ARGS arguments
+#define LOG_PICK(_1, _2, _3, _4, name, ...) name
+#define LOG(...) LOG_PICK(__VA_ARGS__, LOG_3, LOG_2, LOG_1, LOG_0, _)(__VA_ARGS__)
+#define LOG_0(id) log_write(id, 0, 0, 0)
+#define LOG_1(id, a) log_write(id, a, 0, 0)
+#define LOG_2(id, a, b) log_write(id, a, b, 0)
+#define LOG_3(id, a, b, c) log_write(id, a, b, c)
+
+// Entries come out oldest first, each only once; an empty read means we've
+// caught up. If the ring lapped us, a LOG_DROPPED entry says by how much
+void log_drain_start();
+bool log_drain_running();
+int log_drain_read(LogEntry out[], int max);
+
+#endif /* LOG_H_ */
@@ -23,7 +23,6 @@
  */
 
 #include <stdlib.h>
-#include <stdio.h>
 #include <string.h>
 
 #include "bsp/board.h"
@@ -31,7 +30,19 @@
 #include "usb_descriptors.h"
 
 #include "keyboard.h"
+#include "mousekeys.h"
+#include "gamepad.h"
+#include "recorder.h"
+#include "boot.h"
 #include "led.h"
+#include "capture.h"
+#include "power.h"
+#include "governor.h"
+#include "chatter.h"
+#include "split.h"
+#include "log.h"
+#include "webusb.h"
+#include "hotpath.h"
 
 //--------------------------------------------------------------------+
 // MACRO CONSTANT TYPEDEF PROTYPES
@@ -45,31 +56,58 @@ const tusb_desc_webusb_url_t desc_url =
   .bScheme         = 1, // 0: http, 1: https
   .url             = URL
 };
-static bool web_serial_connected = false;
 
 //------------- prototypes -------------//
-void webserial_task(void);
-void send_webusb_message(char type, uint8_t * data, uint8_t data_size);
 void hid_task(void);
 
 /*------------- MAIN -------------*/
 int main(void)
 {
+  boot_mark(BOOT_MAIN);
   board_init();
-  tusb_init();
+  boot_mark(BOOT_BOARD_INIT);
 
-  //set_sys_clock_khz(200000, true);
+  // Keys are set up before USB so we're scanning while the host enumerates us,
+  // and anything pressed in the meantime goes out in the first report. The
+  // keymap needs to know which half of a split board we are first
+  split_init();
   keyboard_init();
+  tusb_init();
+  boot_mark(BOOT_USB_INIT);
   led_init();
-    
+  governor_init();
+
   while (1)
   {
     tud_task(); // tinyusb device task
 
+    // No scanning while the bus is suspended, see power.c
+    if (power_suspended()) {
+      power_task();
+      continue;
+    }
+
+    // The half of a split board without USB only sends its keys over
+    if (split_secondary()) {
+      split_secondary_task();
+      continue;
+    }
+
     hid_task();
     webserial_task();
 
     led_task();
+    governor_task();
+
+    // First boot - save the defaults once enumeration is out of the way
+    if (keyboard_config_save_pending() && tud_mounted()) {
+      keyboard_config_flash_save();
+      boot_mark(BOOT_CONFIG_SAVED);
+    }
+
+    // Learned debounce windows, now and then while nobody's typing
+    if (chatter_save_pending() && tud_mounted())
+      chatter_flash_save();
   }
 
   return 0;
@@ -82,12 +120,15 @@ int main(void)
 // Invoked when device is mounted
 void tud_mount_cb(void)
 {
+  boot_mark(BOOT_MOUNTED);
+  LOG(LOG_MOUNTED);
   led_solid(true);
 }
 
 // Invoked when device is unmounted
 void tud_umount_cb(void)
 {
+  LOG(LOG_UNMOUNTED);
   led_blink(LED_BLINK_NOT_MOUNTED);
 }
 
@@ -96,13 +137,20 @@ void tud_umount_cb(void)
 // Within 7ms, device must draw an average of current less than 2.5 mA from bus
 void tud_suspend_cb(bool remote_wakeup_en)
 {
-  (void) remote_wakeup_en;
-  led_blink(LED_BLINK_SUSPENDED);
+  power_suspend(remote_wakeup_en);
+  led_clock_changed();
+  capture_clock_changed();
+  split_clock_changed();
+  led_breathe(LED_BLINK_SUSPENDED * 2);
 }
 
 // Invoked when usb bus is resumed
 void tud_resume_cb(void)
 {
+  power_resume();
+  led_clock_changed();
+  capture_clock_changed();
+  split_clock_changed();
   led_solid(true);
 }
 
@@ -110,20 +158,48 @@ void tud_resume_cb(void)
 // HID
 //--------------------------------------------------------------------+
 bool hid_queued = false;
-static void send_hid_report()
+static void HOT_PATH(send_hid_report)()
 {
-  if (!tud_hid_ready()) {
+  if (!tud_hid_n_ready(HID_ITF_KEYBOARD)) {
+    recorder_add(time_us_32(), RECORD_HID_BUSY, 0, REPORT_ID_KEYBOARD);
     hid_queued = true;
     return;
   }
 
   uint8_t * report = get_keycode_report();
-  tud_hid_keyboard_report(REPORT_ID_KEYBOARD, 0, report);
+  tud_hid_n_keyboard_report(HID_ITF_KEYBOARD, 0, 0, report);
+  keyboard_report_sent();
+  boot_mark(BOOT_FIRST_REPORT);
+
+  uint8_t down = 0;
+  for (int i = 0; i < KEYBOARD_REPORT_SIZE; i++)
+    down += report[i] != 0;
+  recorder_add(time_us_32(), RECORD_HID_SENT, down, REPORT_ID_KEYBOARD);
 
   hid_queued = false;
 }
 
-static void send_media_report()
+// Each of these is on its own endpoint, so goes out in the same frame as
+// the keyboard report rather than the one after; one that's still busy with
+// its last report queues us up to try again on the next scan
+static void HOT_PATH(send_nkro_report)()
+{
+  static uint8_t nkro_sent[KEYBOARD_NKRO_SIZE];
+  uint8_t * report = get_nkro_report();
+
+  if (memcmp(report, nkro_sent, KEYBOARD_NKRO_SIZE) == 0)
+    return;
+
+  if (!tud_hid_n_ready(HID_ITF_NKRO)) {
+    hid_queued = true;
+    return;
+  }
+
+  tud_hid_n_report(HID_ITF_NKRO, 0, report, KEYBOARD_NKRO_SIZE);
+  memcpy(nkro_sent, report, KEYBOARD_NKRO_SIZE);
+}
+
+static void HOT_PATH(send_media_report)()
 {
   static uint16_t media_key_held = 0;
   uint16_t media_key = 0;
@@ -138,75 +214,114 @@ static void send_media_report()
       media_key = HID_USAGE_CONSUMER_MUTE;
   }
   
-  if (media_key != 0 && media_key != media_key_held) {
-    board_delay(2); // space from previous report .. because
-    media_key_held = media_key;
-    tud_hid_report(REPORT_ID_CONSUMER_CONTROL, &media_key, 2);
-  } else if (media_key == 0 && media_key_held != 0){
-    board_delay(2); // space from previous report .. because
-    media_key_held = 0;
-    uint16_t empty_key = 0;
-    tud_hid_report(REPORT_ID_CONSUMER_CONTROL, &empty_key, 2);
+  if (media_key == media_key_held)
+    return;
+
+  if (!tud_hid_n_ready(HID_ITF_CONSUMER)) {
+    hid_queued = true;
+    return;
   }
+
+  media_key_held = media_key;
+  tud_hid_n_report(HID_ITF_CONSUMER, REPORT_ID_CONSUMER_CONTROL, &media_key, 2);
 }
 
-void send_webusb_report() {
-  if (!web_serial_connected)
+// The gamepad shares the consumer interface with media keys and the mouse,
+// but never changes the keyboard report, so normally has it to itself
+static void HOT_PATH(send_gamepad_report)()
+{
+  uint32_t buttons;
+  uint8_t hat;
+
+  if (!tud_hid_n_ready(HID_ITF_CONSUMER))
     return;
-  
-  uint8_t * report = get_raw_report(); // need to replace this with a pins-down map
 
-  send_webusb_message('r', report, KEYS);
+  gamepad_state(&buttons, &hat);
+  tud_hid_n_gamepad_report(HID_ITF_CONSUMER, REPORT_ID_GAMEPAD, 0, 0, 0, 0, 0, 0, hat, buttons);
+  gamepad_sent();
 }
 
-// tud_hid_report_complete_cb() is used to send the next report after previous one is complete
-void hid_task(void)
+// Only on a frame the consumer interface isn't using - motion keeps adding
+// up in mousekeys until there's one, so waiting doesn't lose any
+static void HOT_PATH(send_mouse_report)()
+{
+  uint8_t buttons;
+  int8_t x, y, wheel;
+
+  if (!tud_hid_n_ready(HID_ITF_CONSUMER))
+    return;
+
+  if (mousekeys_report(&buttons, &x, &y, &wheel))
+    tud_hid_n_mouse_report(HID_ITF_CONSUMER, REPORT_ID_MOUSE, buttons, x, y, wheel, 0);
+}
+
+void HOT_PATH(hid_task)(void)
 {
   // Poll very quickly - faster than our USB polling rate so we always have fresh data
   // available (see TUD_HID_DESCRIPTOR in usb_descriptors.c)
   const uint64_t interval_us = KEYBOARD_SCAN_RATE_US;
   static uint64_t start_us = 0;
 
-  if (time_us_64() - start_us < interval_us) return; // not enough time
+  uint64_t now_us = time_us_64();
+  if (now_us - start_us < interval_us) return; // not enough time
   start_us += interval_us;
 
+  // Coming back from suspend, carry on from now rather than running every
+  // scan we missed back to back
+  if (now_us - start_us > 1000)
+    start_us = now_us;
+
   bool changed = keyboard_update();
-  if (!hid_queued && !changed) return;
+  bool pad = gamepad_update();
+  bool mouse = mousekeys_update(time_us_32());
+  if (changed && LED_PIXELS > 0)
+    led_keys(get_raw_report(), KEYS);
+  if (changed || pad || mouse)
+    governor_activity();
+  if (!hid_queued && !changed && !pad && !mouse) return;
 
   // Remote wakeup
   if (tud_suspended()) {
     // Wake up host if we are in suspend mode
-    // and REMOTE_WAKEUP feature is enabled by host
+    // and REMOTE_WAKEUP feature is enabled by host. The report is held until
+    // we're resumed, or the key that woke the host would never be sent
     tud_remote_wakeup();
+    hid_queued = hid_queued || changed;
   } else {
-    // Send the 1st of report chain, the rest will be sent by tud_hid_report_complete_cb()
-    send_hid_report();
-    send_media_report();
-    send_webusb_report();
+    if (hid_queued || changed) {
+      send_hid_report();
+      send_nkro_report();
+      send_media_report();
+      send_webusb_report();
+    }
+    if (pad)
+      send_gamepad_report();
+    if (mouse)
+      send_mouse_report();
   }
 }
 
 // Invoked when sent REPORT successfully to host
 // Application can use this to send the next report
-// Note: For composite reports, report[0] is report ID
 void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report, uint8_t len)
 {
-  (void) instance;
+  (void) report;
   (void) len;
 
-  return;
+  if (instance == HID_ITF_KEYBOARD)
+    power_report_delivered();
 }
 
 // Invoked when received SET_REPORT control request or
 // received data on OUT endpoint ( Report ID = 0, Type = 0 )
 void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize)
 {
-  (void) instance;
+  (void) report_id;
 
   if (report_type == HID_REPORT_TYPE_OUTPUT)
   {
     // Set keyboard LED e.g Capslock, Numlock etc...
-    if (report_id == REPORT_ID_KEYBOARD)
+    if (instance == HID_ITF_KEYBOARD)
     {
       // bufsize should be (at least) 1
       if ( bufsize < 1 ) return;
@@ -239,31 +354,6 @@ uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_t
   return 0;
 }
 
-// Stub so we can implement queuing to prevent message
-// concatenation - the problem is we don't know the
-// window of the concating.
-//
-// Need to look at https://github.com/hathach/tinyusb/blob/src/class/vendor/vendor_device.c
-// and tud_vendor_write_available() to see if those provide clues
-void send_webusb_message(char type, uint8_t * data, uint8_t data_size) {
-  if (!web_serial_connected)
-    return;
-
-  // Need to check that this does what we think it does
-  //if (!tud_vendor_available())
-  //  return;
-
-  int buf_size = data_size + 2;
-  uint8_t buf[buf_size];
-
-  memset(buf, 0, buf_size);
-  buf[0] = buf_size;
-  buf[1] = type;
-  memcpy(buf + 2, data, data_size);
-
-  tud_vendor_write(buf, buf_size);
-}
-
 //--------------------------------------------------------------------+
 // WebUSB use vendor class
 //--------------------------------------------------------------------+
@@ -306,12 +396,12 @@ bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_requ
       if (request->bRequest == 0x22)
       {
         // Webserial simulate the CDC_REQUEST_SET_CONTROL_LINE_STATE (0x22) to connect and disconnect.
-        web_serial_connected = (request->wValue != 0);
+        webserial_connect(request->wValue != 0);
 
-        // Always lit LED if connected
-        if ( web_serial_connected ) {
+        // Always lit LED if connected. No greeting - the IN side only
+        // carries framed messages, see webusb.c
+        if ( webserial_connected() ) {
           led_solid(true);
-          tud_vendor_write_str("\r\nTinyUSB WebUSB device example\r\n");
         } else {
           led_blink(LED_BLINK_MOUNTED);
         }
@@ -326,35 +416,3 @@ bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_requ
   // stall unknown request
   return false;
 }
-
-void send_webusb_keyboard_config() {
-  uint8_t data[KEYS * KEY_CONFIG_SIZE];
-  uint8_t size = keyboard_config_read(data, sizeof(data));
-  send_webusb_message('c', data, size);
-}
-
-void webserial_task(void)
-{
-  if (!web_serial_connected)
-    return;
-
-  uint8_t buf[128]; // need to check this
-  uint32_t count = tud_vendor_read(buf, sizeof(buf));
-  printf("read: %d", count);
-
-  if (count == 0)
-    return;
-
-  if(buf[0] == 'c') {
-    // Read the config and send
-    send_webusb_keyboard_config();
-  } else if (buf[0] == 's') {
-    // Set the keymap
-    keyboard_config_set(buf + 1, count - 1);
-    keyboard_config_flash_save();
-    send_webusb_keyboard_config();
-  } else if (buf[0] == 'd') {
-    keyboard_config_reset();
-    send_webusb_keyboard_config();
-  }
-}
\ No newline at end of file
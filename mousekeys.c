@@ -0,0 +1,140 @@
+/**
+ * Mouse keys. Direction keys accelerate the pointer from a slow start, for
+ * precise nudges, to full speed over the ramp; the wheel keys scroll a notch
+ * straight away and then at a steady rate.
+ *
+ * Everything's integrated in 16.16 fixed point a millisecond at a time, so
+ * the motion is the same whatever the scan rate, and only while something
+ * is held - with no mouse keys down mousekeys_update is a few compares.
+ * Reports can only go out when the endpoint is free, so motion adds up here
+ * until one does and none of it is lost.
+ */
+#include "mousekeys.h"
+#include "hotpath.h"
+#include "tusb.h" // for MOUSE_BUTTON_
+
+#define MOUSE_MOVE_KEYS (1 << MOUSE_KEY_UP | 1 << MOUSE_KEY_DOWN | 1 << MOUSE_KEY_LEFT | 1 << MOUSE_KEY_RIGHT)
+#define MOUSE_WHEEL_KEYS (1 << MOUSE_KEY_WHEEL_UP | 1 << MOUSE_KEY_WHEEL_DOWN)
+#define MOUSE_BUTTON_KEYS (1 << MOUSE_KEY_BUTTON_LEFT | 1 << MOUSE_KEY_BUTTON_RIGHT | 1 << MOUSE_KEY_BUTTON_MIDDLE)
+
+#define MOUSEKEYS_ACCEL ((MOUSEKEYS_SPEED_MAX - MOUSEKEYS_SPEED_START) / MOUSEKEYS_RAMP_MS)
+
+MouseMotion mouse;
+uint32_t mouse_time_us = 0;     // how far the integrator has got
+uint8_t mouse_buttons_sent = 0;
+
+static int axis(uint16_t held, int negative, int positive) {
+  return ((held >> positive) & 1) - ((held >> negative) & 1);
+}
+
+void mousekeys_integrate(MouseMotion *m, uint32_t ms) {
+  int dx = axis(m->held, MOUSE_KEY_LEFT, MOUSE_KEY_RIGHT);
+  int dy = axis(m->held, MOUSE_KEY_UP, MOUSE_KEY_DOWN);
+  int dw = axis(m->held, MOUSE_KEY_WHEEL_DOWN, MOUSE_KEY_WHEEL_UP);
+
+  for (uint32_t i = 0; i < ms; i++) {
+    if (dx != 0 || dy != 0) {
+      m->speed = m->speed == 0 ? MOUSEKEYS_SPEED_START : m->speed + MOUSEKEYS_ACCEL;
+      if (m->speed > MOUSEKEYS_SPEED_MAX)
+        m->speed = MOUSEKEYS_SPEED_MAX;
+
+      // Diagonals at the same speed, not sqrt(2) faster
+      int32_t step = dx != 0 && dy != 0 ? m->speed * 181 / 256 : m->speed;
+      m->x += dx * step;
+      m->y += dy * step;
+    } else {
+      m->speed = 0;
+    }
+    m->wheel += dw * MOUSEKEYS_WHEEL_SPEED;
+  }
+}
+
+void mousekeys_press(int key) {
+  if (key < 0 || key >= MOUSE_KEYS)
+    return;
+
+  // Start counting from this press, not from whenever we last moved
+  if ((mouse.held & (MOUSE_MOVE_KEYS | MOUSE_WHEEL_KEYS)) == 0)
+    mouse_time_us = time_us_32();
+
+  mouse.held |= 1 << key;
+  if (key == MOUSE_KEY_WHEEL_UP)
+    mouse.wheel += 65536;
+  else if (key == MOUSE_KEY_WHEEL_DOWN)
+    mouse.wheel -= 65536;
+}
+
+void mousekeys_release(int key) {
+  if (key < 0 || key >= MOUSE_KEYS)
+    return;
+
+  mouse.held &= ~(1 << key);
+
+  // Whole pixels still go out, but not the fraction of one left over
+  if ((mouse.held & MOUSE_MOVE_KEYS) == 0) {
+    mouse.speed = 0;
+    mouse.x = mouse.x / 65536 * 65536;
+    mouse.y = mouse.y / 65536 * 65536;
+  }
+  if ((mouse.held & MOUSE_WHEEL_KEYS) == 0)
+    mouse.wheel = mouse.wheel / 65536 * 65536;
+}
+
+static uint8_t mouse_buttons() {
+  return ((mouse.held >> MOUSE_KEY_BUTTON_LEFT) & 1 ? MOUSE_BUTTON_LEFT : 0) |
+         ((mouse.held >> MOUSE_KEY_BUTTON_RIGHT) & 1 ? MOUSE_BUTTON_RIGHT : 0) |
+         ((mouse.held >> MOUSE_KEY_BUTTON_MIDDLE) & 1 ? MOUSE_BUTTON_MIDDLE : 0);
+}
+
+static bool mouse_pending() {
+  return mouse.x >= 65536 || mouse.x <= -65536 || mouse.y >= 65536 || mouse.y <= -65536 ||
+         mouse.wheel >= 65536 || mouse.wheel <= -65536 || mouse_buttons() != mouse_buttons_sent;
+}
+
+bool HOT_PATH(mousekeys_update)(uint32_t time_us) {
+  if (mouse.held & (MOUSE_MOVE_KEYS | MOUSE_WHEEL_KEYS)) {
+    uint32_t ms = (time_us - mouse_time_us) / 1000;
+    mousekeys_integrate(&mouse, ms);
+    mouse_time_us += ms * 1000;
+  }
+
+  return mouse_pending();
+}
+
+// Whole units out of a 16.16 accumulator, at most what an int8_t holds
+static int8_t take(int32_t *value) {
+  int32_t whole = *value / 65536; // towards zero, so the fraction keeps its sign
+  if (whole > 127)
+    whole = 127;
+  else if (whole < -127)
+    whole = -127;
+  *value -= whole * 65536;
+  return whole;
+}
+
+bool mousekeys_report(uint8_t *buttons, int8_t *x, int8_t *y, int8_t *wheel) {
+  if (!mouse_pending())
+    return false;
+
+  *buttons = mouse_buttons_sent = mouse_buttons();
+  *x = take(&mouse.x);
+  *y = take(&mouse.y);
+  *wheel = take(&mouse.wheel);
+  return true;
+}
+
+static MouseMotion saved_mouse;
+static uint32_t saved_time_us;
+static uint8_t saved_buttons_sent;
+
+void mousekeys_state_save() {
+  saved_mouse = mouse;
+  saved_time_us = mouse_time_us;
+  saved_buttons_sent = mouse_buttons_sent;
+}
+
+void mousekeys_state_restore() {
+  mouse = saved_mouse;
+  mouse_time_us = saved_time_us;
+  mouse_buttons_sent = saved_buttons_sent;
+}
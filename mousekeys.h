@@ -0,0 +1,54 @@
+#ifndef MOUSEKEYS_H_
+#define MOUSEKEYS_H_
+
+#include "pico/stdlib.h"
+
+// Keys that drive the pointer; mapped as keycode SPECIAL_KEY_MOUSE + one of these
+enum {
+  MOUSE_KEY_UP = 0,
+  MOUSE_KEY_DOWN,
+  MOUSE_KEY_LEFT,
+  MOUSE_KEY_RIGHT,
+  MOUSE_KEY_WHEEL_UP,
+  MOUSE_KEY_WHEEL_DOWN,
+  MOUSE_KEY_BUTTON_LEFT,
+  MOUSE_KEY_BUTTON_RIGHT,
+  MOUSE_KEY_BUTTON_MIDDLE,
+  MOUSE_KEYS
+};
+
+// Speeds are 16.16 fixed point pixels (or wheel notches) per ms. The pointer
+// starts at MOUSEKEYS_SPEED_START and gets to MOUSEKEYS_SPEED_MAX after
+// MOUSEKEYS_RAMP_MS of holding
+#define MOUSEKEYS_SPEED_START (65536 / 4)   // 250 px/s
+#define MOUSEKEYS_SPEED_MAX   (65536 * 5 / 2) // 2500 px/s
+#define MOUSEKEYS_RAMP_MS     600
+#define MOUSEKEYS_WHEEL_SPEED (65536 / 60)  // a notch every 60ms after the first
+
+typedef struct {
+  uint16_t held;  // bit per MOUSE_KEY_
+  int32_t speed;  // current pointer speed, 0 until a direction is held
+  int32_t x, y;   // motion not reported yet
+  int32_t wheel;
+} MouseMotion;
+
+// The integrator, one ms at a time; no hardware in here, so the host tools
+// can run it
+void mousekeys_integrate(MouseMotion *m, uint32_t ms);
+
+void mousekeys_press(int key);
+void mousekeys_release(int key);
+
+// Runs the integrator up to now; true if there's a report to send
+bool mousekeys_update(uint32_t time_us);
+
+// Takes as much pending motion as fits in a report, leaving the rest for the
+// next one; false if there's nothing new to send
+bool mousekeys_report(uint8_t *buttons, int8_t *x, int8_t *y, int8_t *wheel);
+
+// For keyboard_benchmark, which pushes made-up edges through here: a copy of
+// what's pressed and pending, put back when it's done
+void mousekeys_state_save();
+void mousekeys_state_restore();
+
+#endif /* MOUSEKEYS_H_ */
@@ -0,0 +1,139 @@
+/**
+ * Suspend and remote wakeup. Scanning at 8kHz at full clock is far over the
+ * 2.5mA a suspended device is allowed, so on suspend the system clock drops
+ * to 48MHz off the USB PLL, the scan stops, and the main loop sleeps in WFE.
+ * The USB interrupt wakes it to notice a resume.
+ *
+ * If the host lets us wake it, every key pin gets a falling edge interrupt.
+ * The first key down is remembered with its time and we signal a remote
+ * wakeup. Once the host resumes, the press is fed to the keyboard as a
+ * debounced edge at the time it happened, so it goes out in the first report
+ * even if the key was let go while the bus came back - it's not left to the
+ * scan to notice, which it wouldn't for a quick tap.
+ *
+ * Each wake is timed from the key interrupt to the resume and to the report
+ * reaching the host (tud_hid_report_complete_cb), to see where it goes.
+ */
+#include "power.h"
+
+#include "hardware/clocks.h"
+#include "hardware/gpio.h"
+#include "hardware/sync.h"
+#include "tusb.h"
+
+#include "keyboard.h"
+#include "governor.h"
+#include "log.h"
+
+static bool suspended = false;
+static bool wakeup_allowed = false;
+static bool wakeup_sent = false;
+static uint32_t run_khz = 0; // the clock to go back to
+
+static volatile int wake_key = NO_KEY_INDEX;
+static volatile uint32_t wake_us = 0;
+static uint32_t suspend_us = 0;
+static uint32_t resume_us = 0;
+static bool wake_measuring = false; // waiting for the wake key's report to land
+
+static WakeStats wake_stats;
+
+static void power_gpio_irq(uint gpio, uint32_t events) {
+  (void) events; // only ever enabled for GPIO_IRQ_EDGE_FALL
+  if (wake_key != NO_KEY_INDEX)
+    return;
+
+  for (int i = 0; i < KEYS; i++) {
+    if (keyboard_key_pin(i) == (int) gpio) {
+      wake_us = time_us_32();
+      wake_key = i;
+      break;
+    }
+  }
+  __sev();
+}
+
+static void power_wake_irqs(bool enabled) {
+  for (int i = 0; i < KEYS; i++) {
+    int pin = keyboard_key_pin(i);
+    if (pin < 0)
+      continue;
+    gpio_acknowledge_irq(pin, GPIO_IRQ_EDGE_FALL);
+    gpio_set_irq_enabled_with_callback(pin, GPIO_IRQ_EDGE_FALL, enabled, &power_gpio_irq);
+  }
+}
+
+void power_suspend(bool remote_wakeup) {
+  if (suspended)
+    return;
+
+  suspended = true;
+  wakeup_allowed = remote_wakeup;
+  wakeup_sent = false;
+  wake_key = NO_KEY_INDEX;
+  suspend_us = time_us_32();
+  LOG(LOG_SUSPEND, remote_wakeup);
+
+  governor_suspend(true);
+  run_khz = clock_get_hz(clk_sys) / 1000;
+  set_sys_clock_48mhz();
+
+  if (wakeup_allowed)
+    power_wake_irqs(true);
+}
+
+void power_resume() {
+  if (!suspended)
+    return;
+
+  suspended = false;
+  resume_us = time_us_32();
+  LOG(LOG_RESUME, (resume_us - suspend_us) / 1000);
+  if (wakeup_allowed)
+    power_wake_irqs(false);
+
+  set_sys_clock_khz(run_khz, true);
+  governor_suspend(false);
+  governor_activity();
+
+  // Only a key that woke the host gets replayed; if the host resumed us on
+  // its own, whatever's down will be picked up by the scan
+  if (wake_key != NO_KEY_INDEX && wakeup_sent) {
+    keyboard_wake(wake_key, wake_us);
+    wake_measuring = true;
+  }
+  wake_key = NO_KEY_INDEX;
+}
+
+bool power_suspended() {
+  return suspended;
+}
+
+void power_task() {
+  if (wake_key != NO_KEY_INDEX && !wakeup_sent) {
+    tud_remote_wakeup();
+    wakeup_sent = true;
+    return;
+  }
+
+  // Any interrupt - USB or a key - sets the event and brings us back round
+  __wfe();
+}
+
+void power_report_delivered() {
+  if (!wake_measuring)
+    return;
+
+  uint32_t now = time_us_32();
+  wake_measuring = false;
+  wake_stats.wakes++;
+  wake_stats.wake_to_resume = resume_us - wake_us;
+  wake_stats.resume_to_report = now - resume_us;
+  wake_stats.wake_to_report = now - wake_us;
+  if (wake_stats.wake_to_report > wake_stats.worst_wake_to_report)
+    wake_stats.worst_wake_to_report = wake_stats.wake_to_report;
+}
+
+WakeStats * power_wake_stats() {
+  return &wake_stats;
+}
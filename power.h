@@ -0,0 +1,31 @@
+#ifndef POWER_H_
+#define POWER_H_
+
+#include "pico/stdlib.h"
+
+// USB suspend: the clock comes down, the scan stops, and the core sleeps
+// until the host resumes us or a key goes down
+
+// Reply to 'u', all in us
+typedef struct {
+  uint32_t wakes;           // remote wakeups from a key since boot
+  uint32_t wake_to_resume;  // key down to the host resuming the bus, last wake
+  uint32_t resume_to_report; // resume to the key's report reaching the host
+  uint32_t wake_to_report;  // the whole thing
+  uint32_t worst_wake_to_report;
+} WakeStats;
+
+// From the TinyUSB suspend/resume callbacks
+void power_suspend(bool remote_wakeup);
+void power_resume();
+bool power_suspended();
+
+// The main loop while suspended, instead of scanning
+void power_task();
+
+// A keyboard report reached the host
+void power_report_delivered();
+
+WakeStats * power_wake_stats();
+
+#endif /* POWER_H_ */
@@ -0,0 +1,47 @@
+/**
+ * Flight recorder. Records are 8 bytes so a few thousand of them fit in RAM,
+ * and they're dumped oldest first in chunks small enough for the vendor
+ * endpoint. Recording carries on during a dump; if it laps the dump, the
+ * dump skips ahead to the oldest record still in the ring.
+ */
+#include "recorder.h"
+
+Record records[RECORDER_SIZE];
+uint32_t records_written = 0;
+bool recorder_paused = false;
+
+uint32_t dump_next = 0;
+uint32_t dump_end = 0;
+bool dumping = false;
+
+void recorder_pause(bool paused) {
+  recorder_paused = paused;
+}
+
+void recorder_dump_start() {
+  dump_end = records_written;
+  dump_next = dump_end > RECORDER_SIZE ? dump_end - RECORDER_SIZE : 0;
+  dumping = true;
+}
+
+bool recorder_dump_running() {
+  return dumping;
+}
+
+// Returns 0 once, when the dump has finished
+int recorder_dump_read(Record out[], int max) {
+  if (records_written - dump_next > RECORDER_SIZE) {
+    dump_next = records_written - RECORDER_SIZE;
+    if ((int32_t) (dump_next - dump_end) > 0)
+      dump_next = dump_end; // lapped the whole dump
+  }
+
+  int count = 0;
+  while (count < max && dump_next != dump_end) {
+    out[count++] = records[dump_next++ & (RECORDER_SIZE - 1)];
+  }
+
+  if (count == 0)
+    dumping = false;
+  return count;
+}
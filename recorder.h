@@ -0,0 +1,48 @@
+#ifndef RECORDER_H_
+#define RECORDER_H_
+
+#include "pico/stdlib.h"
+
+// Flight recorder - an always-on ring of the most recent key and USB events,
+// so a "dropped key" can be looked at after the fact
+#define RECORDER_SIZE 4096 // records, must be a power of 2
+
+enum {
+  RECORD_RAW_EDGE = 1, // key: key index, data: new physical state
+  RECORD_KEY_EDGE,     // key: key index, data: new debounced state
+  RECORD_SLOT_FULL,    // data: keycode that didn't fit in the report, so went to NKRO
+  RECORD_HID_BUSY,     // data: report id tud_hid_ready() turned away
+  RECORD_HID_SENT,     // data: report id, key: keys down in the report
+};
+
+typedef struct {
+  uint32_t time; // time_us_32()
+  uint8_t type;
+  uint8_t key;
+  uint16_t data;
+} Record;
+
+extern Record records[RECORDER_SIZE];
+extern uint32_t records_written;
+extern bool recorder_paused;
+
+// Called from the scan path, so it's just a store and an increment
+static inline void recorder_add(uint32_t time, uint8_t type, uint8_t key, uint16_t data) {
+  if (recorder_paused)
+    return;
+  Record *record = &records[records_written++ & (RECORDER_SIZE - 1)];
+  record->time = time;
+  record->type = type;
+  record->key = key;
+  record->data = data;
+}
+
+// While keyboard_benchmark runs, so its made-up edges don't push real ones
+// out of the ring
+void recorder_pause(bool paused);
+
+void recorder_dump_start();
+bool recorder_dump_running();
+int recorder_dump_read(Record out[], int max);
+
+#endif /* RECORDER_H_ */
@@ -3,45 +3,128 @@
 #include "pico/stdlib.h"
 #include <string.h> // for memset
 #include "hardware/flash.h"
+#include "hardware/sync.h" // for save_and_disable_interrupts
 #include "save.h"
 
 // We're going to erase and reprogram a region 256k from the start of flash.
-// Once done, we can access this at XIP_BASE + 256k.
+// Once done, we can access this at XIP_BASE + 256k. Each profile gets a
+// sector of its own (profile 0 is where the single config always lived),
+// the sector after them holds the profile selection log, and the one after
+// that the learned debounce settle times
 #define FLASH_TARGET_OFFSET (256 * 1024)
+#define FLASH_PROFILE_OFFSET(profile) (FLASH_TARGET_OFFSET + (profile) * FLASH_SECTOR_SIZE)
+#define FLASH_SELECTION_OFFSET FLASH_PROFILE_OFFSET(FLASH_PROFILES)
+#define FLASH_DEBOUNCE_OFFSET FLASH_PROFILE_OFFSET(FLASH_PROFILES + 1)
 
 const uint8_t *flash_target_contents = (const uint8_t *) (XIP_BASE + FLASH_TARGET_OFFSET);
+const uint8_t *flash_selection_contents = (const uint8_t *) (XIP_BASE + FLASH_SELECTION_OFFSET);
 
-void flash_erase() {
-  flash_range_erase(FLASH_TARGET_OFFSET, FLASH_SECTOR_SIZE);
+// XIP is off while the flash is busy, so nothing that might run from flash
+// (an interrupt handler, say) can be let in until it's done. Each erase and
+// program gets its own window, so interrupts are only held off for one
+static void flash_erase_range(uint32_t offset, uint32_t count) {
+  uint32_t interrupts = save_and_disable_interrupts();
+  flash_range_erase(offset, count);
+  restore_interrupts(interrupts);
 }
 
-void flash_write(uint8_t data[], uint32_t size) {
-  flash_erase();
+static void flash_program_range(uint32_t offset, const uint8_t data[], uint32_t count) {
+  uint32_t interrupts = save_and_disable_interrupts();
+  flash_range_program(offset, data, count);
+  restore_interrupts(interrupts);
+}
+
+void flash_erase(int profile) {
+  flash_erase_range(FLASH_PROFILE_OFFSET(profile), FLASH_SECTOR_SIZE);
+}
 
+void flash_write(int profile, uint8_t data[], uint32_t size) {
+  if (profile < 0 || profile >= FLASH_PROFILES)
+    return;
+
+  flash_erase(profile);
+
+  // Bigger boards need more than one page; everything has to fit in the sector
   uint8_t page[FLASH_PAGE_SIZE];
-  memset(page, 0, FLASH_PAGE_SIZE);
-  for (int i = 0; i < size && i < FLASH_PAGE_SIZE; i++) {
-    page[i] = data[i];
+  for (uint32_t offset = 0; offset < size && offset < FLASH_SECTOR_SIZE; offset += FLASH_PAGE_SIZE) {
+    memset(page, 0, FLASH_PAGE_SIZE);
+    for (int i = 0; offset + i < size && i < FLASH_PAGE_SIZE; i++) {
+      page[i] = data[offset + i];
+    }
+    flash_program_range(FLASH_PROFILE_OFFSET(profile) + offset, page, FLASH_PAGE_SIZE);
+  }
+}
+
+// Straight out of XIP, so reading a profile never touches the flash contents
+void flash_read(int profile, uint8_t data[], uint32_t size) {
+  const uint8_t *contents = flash_target_contents + profile * FLASH_SECTOR_SIZE;
+  for (uint32_t i = 0; i < size; i++) {
+    data[i] = contents[i];
+  }
+}
+
+// The selection log is one byte per entry, appended into erased (0xff) flash;
+// the last entry written is the current choice. Programming only clears
+// bits, so an entry goes in by programming its page with every other byte
+// left at 0xff, and the sector is only erased once it's full
+static int flash_selection_end() {
+  int end = 0;
+  while (end < FLASH_SECTOR_SIZE && flash_selection_contents[end] != 0xff)
+    end++;
+  return end;
+}
+
+int flash_selection_read() {
+  int end = flash_selection_end();
+  if (end == 0 || flash_selection_contents[end - 1] >= FLASH_PROFILES)
+    return 0;
+
+  return flash_selection_contents[end - 1];
+}
+
+void flash_selection_write(int profile) {
+  if (profile < 0 || profile >= FLASH_PROFILES || flash_selection_read() == profile)
+    return;
+
+  int end = flash_selection_end();
+  if (end == FLASH_SECTOR_SIZE) {
+    flash_erase_range(FLASH_SELECTION_OFFSET, FLASH_SECTOR_SIZE);
+    end = 0;
   }
-  flash_range_program(FLASH_TARGET_OFFSET, page, FLASH_PAGE_SIZE);
+
+  uint8_t page[FLASH_PAGE_SIZE];
+  memset(page, 0xff, FLASH_PAGE_SIZE);
+  page[end % FLASH_PAGE_SIZE] = profile;
+  flash_program_range(FLASH_SELECTION_OFFSET + end - end % FLASH_PAGE_SIZE, page, FLASH_PAGE_SIZE);
 }
 
-void flash_read(uint8_t data[], uint32_t size) {
-  for (int i = 0; i < size; i++) {
-    data[i] = flash_target_contents[i];//*(uint8_t *) (flash_target_contents + i);
+// One erase, then a page at a time: with the header, two bytes a key fits a
+// page up to 124 keys and takes more past that
+void flash_debounce_write(uint8_t data[], uint32_t size) {
+  flash_erase_range(FLASH_DEBOUNCE_OFFSET, FLASH_SECTOR_SIZE);
+
+  uint8_t page[FLASH_PAGE_SIZE];
+  for (uint32_t offset = 0; offset < size && offset < FLASH_SECTOR_SIZE; offset += FLASH_PAGE_SIZE) {
+    memset(page, 0, FLASH_PAGE_SIZE);
+    memcpy(page, data + offset, size - offset < FLASH_PAGE_SIZE ? size - offset : FLASH_PAGE_SIZE);
+    flash_program_range(FLASH_DEBOUNCE_OFFSET + offset, page, FLASH_PAGE_SIZE);
   }
 }
 
+void flash_debounce_read(uint8_t data[], uint32_t size) {
+  memcpy(data, (const uint8_t *) (XIP_BASE + FLASH_DEBOUNCE_OFFSET), size);
+}
+
 bool verify_flash() {
   uint8_t data[64];
   for (int i = 0; i < 64; i++) {
     data[i] = i;
   }
-  flash_write(data, 64);
+  flash_write(0, data, 64);
 
   uint8_t read_data[64];
   memset(read_data, 0, 64);
-  flash_read(read_data, 64);
+  flash_read(0, read_data, 64);
   
   for (int i = 0; i < 64; i++) {
     if (data[i] != read_data[i]) {
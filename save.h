@@ -3,9 +3,21 @@
 
 #include "pico/stdlib.h"
 
-void flash_erase();
-void flash_write(uint8_t data[], uint32_t size);
-void flash_read(uint8_t data[], uint32_t size);
+// Complete configs stored side by side; switching between them is only a read
+#define FLASH_PROFILES 4
+
+void flash_erase(int profile);
+void flash_write(int profile, uint8_t data[], uint32_t size);
+void flash_read(int profile, uint8_t data[], uint32_t size);
+
+// Which profile to boot into, kept in an append-only log
+int flash_selection_read();
+void flash_selection_write(int profile);
+
+// Learned debounce settle times, see chatter.c; they're the same whichever
+// profile is in use, so they have a sector to themselves
+void flash_debounce_write(uint8_t data[], uint32_t size);
+void flash_debounce_read(uint8_t data[], uint32_t size);
 
 bool verify_flash();
 #endif // SAVE_H_
\ No newline at end of file
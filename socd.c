@@ -0,0 +1,169 @@
+/**
+ * SOCD resolver. Sits between the debounced edges in keyboard_update and
+ * key_press / key_release, and works out which keys of an opposing pair should
+ * be reported as down. Everything is resolved on the edge itself, so it adds
+ * no latency to either key.
+ */
+#include "socd.h"
+#include "keyboard.h" // for KEYS, keyboard_activate_event
+#include "hotpath.h" // for HOT_PATH
+
+#include <string.h> // for memset, memcpy
+
+typedef struct {
+  uint8_t a;
+  uint8_t b;
+  uint8_t mode;
+  bool a_down;
+  bool b_down;
+  uint8_t last; // the key that went down most recently
+} SocdPair;
+
+SocdPair pairs[SOCD_MAX_PAIRS];
+int pair_count = 0;
+
+// Which pair each key belongs to, so keys outside a pair cost one lookup
+#define SOCD_NO_PAIR 0xff
+uint8_t key_pair[KEYS];
+
+static void HOT_PATH(socd_resolve)(SocdPair *pair, bool *a_active, bool *b_active) {
+  *a_active = pair->a_down;
+  *b_active = pair->b_down;
+
+  if (!pair->a_down || !pair->b_down)
+    return;
+
+  switch (pair->mode) {
+    case SOCD_LAST_INPUT:
+      *a_active = pair->last == pair->a;
+      *b_active = pair->last == pair->b;
+      break;
+    case SOCD_NEUTRAL:
+      *a_active = false;
+      *b_active = false;
+      break;
+    case SOCD_FIRST_INPUT:
+      *a_active = pair->last != pair->a;
+      *b_active = pair->last != pair->b;
+      break;
+    default: break;
+  }
+}
+
+int HOT_PATH(socd_edge)(uint8_t key, bool down, SocdChange changes[2]) {
+  if (!KEY_IN_RANGE(key) || key_pair[key] == SOCD_NO_PAIR) {
+    changes[0].key = key;
+    changes[0].active = down;
+    return 1;
+  }
+
+  SocdPair *pair = &pairs[key_pair[key]];
+  bool a_was, b_was, a_active, b_active;
+  socd_resolve(pair, &a_was, &b_was);
+
+  if (key == pair->a)
+    pair->a_down = down;
+  else
+    pair->b_down = down;
+  if (down)
+    pair->last = key;
+
+  socd_resolve(pair, &a_active, &b_active);
+
+  // Releases go first so the report has a free slot for the press. A release
+  // of the edge key is always passed on, in case the pair was configured
+  // while it was held
+  int count = 0;
+  if (a_was && !a_active)
+    changes[count++] = (SocdChange) { pair->a, false };
+  if (b_was && !b_active)
+    changes[count++] = (SocdChange) { pair->b, false };
+  if (!down && count == 0)
+    changes[count++] = (SocdChange) { key, false };
+  if (!a_was && a_active)
+    changes[count++] = (SocdChange) { pair->a, true };
+  if (!b_was && b_active)
+    changes[count++] = (SocdChange) { pair->b, true };
+
+  return count;
+}
+
+int socd_config_read(uint8_t config[], uint8_t len) {
+  if (len < SOCD_CONFIG_SIZE)
+    return 0;
+
+  memset(config, 0, SOCD_CONFIG_SIZE);
+  config[0] = pair_count;
+  for (int i = 0; i < pair_count; i++) {
+    config[1 + i * SOCD_PAIR_CONFIG_SIZE + 0] = pairs[i].a;
+    config[1 + i * SOCD_PAIR_CONFIG_SIZE + 1] = pairs[i].b;
+    config[1 + i * SOCD_PAIR_CONFIG_SIZE + 2] = pairs[i].mode;
+  }
+
+  return SOCD_CONFIG_SIZE;
+}
+
+bool socd_config_set(uint8_t config[], uint8_t len) {
+  bool changed = socd_config_reset();
+  if (len < 1)
+    return changed;
+
+  // Erased flash reads as 0xff, which also lands here
+  int count = config[0];
+  if (count > SOCD_MAX_PAIRS || 1 + count * SOCD_PAIR_CONFIG_SIZE > len)
+    return changed;
+
+  for (int i = 0; i < count; i++) {
+    uint8_t a = config[1 + i * SOCD_PAIR_CONFIG_SIZE + 0];
+    uint8_t b = config[1 + i * SOCD_PAIR_CONFIG_SIZE + 1];
+    uint8_t mode = config[1 + i * SOCD_PAIR_CONFIG_SIZE + 2];
+
+    // A key can only be in one pair
+    if (!KEY_IN_RANGE(a) || !KEY_IN_RANGE(b) || a == b || mode >= SOCD_MODES ||
+        key_pair[a] != SOCD_NO_PAIR || key_pair[b] != SOCD_NO_PAIR)
+      continue;
+
+    // last is only looked at with both keys down, by which time it's been set
+    pairs[pair_count] = (SocdPair) { a, b, mode, false, false, a };
+    key_pair[a] = pair_count;
+    key_pair[b] = pair_count;
+    pair_count++;
+  }
+  return changed;
+}
+
+// The pairs hold their keys' state alongside the config
+static SocdPair saved_pairs[SOCD_MAX_PAIRS];
+
+void socd_state_save() {
+  memcpy(saved_pairs, pairs, sizeof(pairs));
+}
+
+void socd_state_restore() {
+  memcpy(pairs, saved_pairs, sizeof(pairs));
+}
+
+bool socd_config_reset() {
+  SocdPair old[SOCD_MAX_PAIRS];
+  int old_count = pair_count;
+  memcpy(old, pairs, sizeof(pairs));
+
+  pair_count = 0;
+  memset(key_pair, SOCD_NO_PAIR, sizeof(key_pair));
+
+  // A key held down but losing to the other of its pair is just down now
+  bool changed = false;
+  for (int i = 0; i < old_count; i++) {
+    bool a_active, b_active;
+    socd_resolve(&old[i], &a_active, &b_active);
+    if (old[i].a_down && !a_active) {
+      keyboard_activate_event(old[i].a, true);
+      changed = true;
+    }
+    if (old[i].b_down && !b_active) {
+      keyboard_activate_event(old[i].b, true);
+      changed = true;
+    }
+  }
+  return changed;
+}
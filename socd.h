@@ -0,0 +1,41 @@
+#ifndef SOCD_H_
+#define SOCD_H_
+
+#include "pico/stdlib.h"
+
+// SOCD (simultaneous opposing cardinal directions) resolution for pairs of
+// keys like A/D - decides which of the pair the OS gets to see when both are
+// held, without waiting for anything
+#define SOCD_MAX_PAIRS 4
+#define SOCD_PAIR_CONFIG_SIZE 3
+#define SOCD_CONFIG_SIZE (1 + SOCD_MAX_PAIRS * SOCD_PAIR_CONFIG_SIZE)
+
+enum {
+  SOCD_OFF = 0,     // both keys pass through
+  SOCD_LAST_INPUT,  // the most recently pressed key wins
+  SOCD_NEUTRAL,     // neither key is active while both are held
+  SOCD_FIRST_INPUT, // the key that was held first wins
+  SOCD_MODES
+};
+
+typedef struct {
+  uint8_t key;
+  bool active;
+} SocdChange;
+
+// Turns a debounced edge on a key into the keys whose active state changes;
+// returns the number of changes written (at most 2)
+int socd_edge(uint8_t key, bool down, SocdChange changes[2]);
+
+// Setting or resetting sends the keys the old pairs were keeping out of the
+// report; true if that changed it
+int socd_config_read(uint8_t config[], uint8_t len);
+bool socd_config_set(uint8_t config[], uint8_t len);
+bool socd_config_reset();
+
+// For keyboard_benchmark, which pushes made-up edges through here: a copy of
+// what's pressed and pending, put back when it's done
+void socd_state_save();
+void socd_state_restore();
+
+#endif /* SOCD_H_ */
@@ -0,0 +1,284 @@
+/**
+ * Split keyboard link. The secondary runs its own scan and debounce and
+ * sends what changed, so the primary treats a remote key like an analog
+ * one - already clean - and just reads its state in the scan, before any
+ * of the press handling.
+ *
+ * What a remote key costs over a local one is the time on the wire: a
+ * delta for a single key is three bytes, 30us at SPLIT_BAUD. Both halves
+ * sample once a scan either way, and the primary drains the UART at the
+ * start of every scan, so the FIFO never holds more than a scan's worth.
+ *
+ * Nothing goes back the other way. A frame that's lost or mangled is caught
+ * by its CRC or by the sequence number of the next one, and the full state
+ * the secondary sends every SPLIT_STATE_MS puts any key we missed right. If
+ * the link goes quiet altogether, remote keys are let go rather than left
+ * stuck down.
+ *
+ * The UART divides clk_peri, which follows clk_sys, so the baud rate is
+ * worked out again whenever the governor or a suspend changes the clock.
+ */
+#include "split.h"
+
+#include <string.h>
+
+#include "hardware/gpio.h"
+#include "hardware/uart.h"
+
+#include "keyboard.h" // for the scan rate and debounce settings
+#include "debounce.h"
+#include "hotpath.h" // for HOT_PATH
+#include "log.h"
+
+static bool secondary = false;
+static bool link_up = false;
+static SplitRx rx;
+
+//--------------------------------------------------------------------+
+// Protocol
+//--------------------------------------------------------------------+
+
+// CRC-8, polynomial 0x07; frames are a handful of bytes, so bitwise is fine
+uint8_t HOT_PATH(split_crc8)(const uint8_t data[], int length) {
+  uint8_t crc = 0;
+  for (int i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+      crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+  }
+  return crc;
+}
+
+static int split_encode(SplitTx *tx, int type, const uint8_t payload[], int count, uint8_t out[]) {
+  out[0] = type << 6 | (tx->seq & 7) << 3 | (count - 1);
+  memcpy(out + 1, payload, count);
+  out[count + 1] = split_crc8(out, count + 1);
+  tx->seq++;
+  return count + 2;
+}
+
+int split_encode_delta(SplitTx *tx, const uint8_t events[], int count, uint8_t out[]) {
+  if (count < 1 || count > SPLIT_PAYLOAD_MAX)
+    return 0;
+  return split_encode(tx, SPLIT_FRAME_DELTA, events, count, out);
+}
+
+int split_encode_state(SplitTx *tx, const uint8_t state[], int keys, uint8_t out[]) {
+  int count = (keys + 7) / 8;
+  if (count < 1 || count > SPLIT_PAYLOAD_MAX)
+    return 0;
+  return split_encode(tx, SPLIT_FRAME_STATE, state, count, out);
+}
+
+void split_rx_reset(SplitRx *rx) {
+  memset(rx, 0, sizeof(SplitRx));
+}
+
+static void split_apply(SplitRx *rx) {
+  int type = rx->frame[0] >> 6;
+  int seq = (rx->frame[0] >> 3) & 7;
+  int count = (rx->frame[0] & 7) + 1;
+  const uint8_t *payload = rx->frame + 1;
+
+  if (rx->synced && seq != ((rx->seq + 1) & 7))
+    rx->stats.seq_gaps++;
+  rx->seq = seq;
+  rx->synced = true;
+  rx->stats.frames++;
+
+  if (type == SPLIT_FRAME_DELTA) {
+    for (int i = 0; i < count; i++) {
+      int key = payload[i] & ~SPLIT_KEY_DOWN;
+      if (key >= SPLIT_MAX_KEYS)
+        continue;
+      if (payload[i] & SPLIT_KEY_DOWN)
+        rx->state[key >> 3] |= 1 << (key & 7);
+      else
+        rx->state[key >> 3] &= ~(1 << (key & 7));
+    }
+  } else {
+    if (rx->stats.keys != 0 && memcmp(rx->state, payload, count) != 0)
+      rx->stats.repairs++;
+    memset(rx->state, 0, sizeof(rx->state));
+    memcpy(rx->state, payload, count);
+    rx->stats.keys = count * 8;
+  }
+}
+
+static void split_drop(SplitRx *rx, int count) {
+  rx->length -= count;
+  memmove(rx->frame, rx->frame + count, rx->length);
+}
+
+// Bytes are framed by trying each as a header in turn: anything that isn't
+// one, or whose frame fails its CRC, is skipped a byte at a time until we're
+// back in step
+bool HOT_PATH(split_decode)(SplitRx *rx, uint8_t byte) {
+  bool applied = false;
+
+  rx->frame[rx->length++] = byte;
+  while (rx->length > 0) {
+    int type = rx->frame[0] >> 6;
+    if (type != SPLIT_FRAME_DELTA && type != SPLIT_FRAME_STATE) {
+      rx->stats.crc_errors++;
+      split_drop(rx, 1);
+      continue;
+    }
+
+    int length = (rx->frame[0] & 7) + 3;
+    if (rx->length < length)
+      break;
+
+    if (split_crc8(rx->frame, length - 1) == rx->frame[length - 1]) {
+      split_apply(rx);
+      split_drop(rx, length);
+      applied = true;
+    } else {
+      rx->stats.crc_errors++;
+      split_drop(rx, 1);
+    }
+  }
+  return applied;
+}
+
+//--------------------------------------------------------------------+
+// Link
+//--------------------------------------------------------------------+
+
+bool split_secondary() {
+  return secondary;
+}
+
+bool HOT_PATH(split_key_state)(int index) {
+  return rx.state[index >> 3] & (1 << (index & 7));
+}
+
+void split_stats(SplitStats *stats) {
+  *stats = rx.stats;
+  stats->link_up = link_up;
+  stats->secondary = secondary;
+}
+
+#ifdef SPLIT_UART
+static const uint8_t secondary_pins[SPLIT_SECONDARY_KEYS + 1] = SPLIT_SECONDARY_PINS;
+
+static bool listening = false;
+static uint32_t last_frame = 0;
+
+void split_init() {
+  split_rx_reset(&rx);
+  if (SPLIT_SECONDARY_KEYS == 0)
+    return;
+
+  gpio_init(SPLIT_VBUS_PIN);
+  gpio_set_dir(SPLIT_VBUS_PIN, GPIO_IN);
+  secondary = !gpio_get(SPLIT_VBUS_PIN);
+  if (!secondary)
+    return;
+
+  uart_init(SPLIT_UART, SPLIT_BAUD);
+  gpio_set_function(SPLIT_TX_PIN, GPIO_FUNC_UART);
+  for (int i = 0; i < SPLIT_SECONDARY_KEYS; i++) {
+    gpio_init(secondary_pins[i]);
+    gpio_set_dir(secondary_pins[i], GPIO_IN);
+    gpio_pull_up(secondary_pins[i]);
+  }
+}
+
+void split_listen() {
+  if (listening || secondary)
+    return;
+
+  uart_init(SPLIT_UART, SPLIT_BAUD);
+  gpio_set_function(SPLIT_RX_PIN, GPIO_FUNC_UART);
+  listening = true;
+}
+
+void split_clock_changed() {
+  if (listening || secondary)
+    uart_set_baudrate(SPLIT_UART, SPLIT_BAUD);
+}
+
+void HOT_PATH(split_task)(uint32_t time) {
+  if (!listening)
+    return;
+
+  while (uart_is_readable(SPLIT_UART)) {
+    if (split_decode(&rx, uart_getc(SPLIT_UART))) {
+      if (!link_up)
+        LOG(LOG_SPLIT_UP);
+      last_frame = time;
+      link_up = true;
+    }
+  }
+
+  if (link_up && time - last_frame > SPLIT_TIMEOUT_MS * 1000) {
+    memset(rx.state, 0, sizeof(rx.state));
+    rx.synced = false;
+    rx.stats.keys = 0;
+    rx.stats.timeouts++;
+    link_up = false;
+    LOG(LOG_SPLIT_DOWN, rx.stats.crc_errors, rx.stats.seq_gaps);
+  }
+}
+
+static void split_send(int type, const uint8_t payload[], int count) {
+  static SplitTx tx;
+  uint8_t frame[SPLIT_FRAME_MAX];
+  int length = type == SPLIT_FRAME_DELTA ? split_encode_delta(&tx, payload, count, frame)
+                                         : split_encode_state(&tx, payload, count, frame);
+  uart_write_blocking(SPLIT_UART, frame, length);
+}
+
+// The same pacing as hid_task. Deltas go out the scan they happen in; the
+// full state follows them, so it never contradicts one still on the wire
+void split_secondary_task() {
+  static Debounce debounce[SPLIT_SECONDARY_KEYS + 1];
+  static uint64_t start_us = 0;
+  static uint32_t state_sent = 0;
+
+  uint64_t now_us = time_us_64();
+  if (now_us - start_us < KEYBOARD_SCAN_RATE_US)
+    return;
+  start_us = now_us - start_us > 1000 ? now_us : start_us + KEYBOARD_SCAN_RATE_US;
+
+  uint32_t time = time_us_32();
+  uint8_t events[SPLIT_PAYLOAD_MAX];
+  int count = 0;
+
+  for (int i = 0; i < SPLIT_SECONDARY_KEYS; i++) {
+    bool state = !gpio_get(secondary_pins[i]);
+    int edge = debounce_update(&debounce[i], state, time, DEBOUNCE_US, DEBOUNCE_ALGORITHM);
+    if (edge == 0)
+      continue;
+
+    events[count++] = i | (edge == -1 ? SPLIT_KEY_DOWN : 0);
+    if (count == SPLIT_PAYLOAD_MAX) {
+      split_send(SPLIT_FRAME_DELTA, events, count);
+      count = 0;
+    }
+  }
+  if (count > 0)
+    split_send(SPLIT_FRAME_DELTA, events, count);
+
+  if (time - state_sent >= SPLIT_STATE_MS * 1000) {
+    uint8_t state[SPLIT_MAX_KEYS / 8] = { 0 };
+    for (int i = 0; i < SPLIT_SECONDARY_KEYS; i++) {
+      if (debounce[i].reported_state)
+        state[i >> 3] |= 1 << (i & 7);
+    }
+    split_send(SPLIT_FRAME_STATE, state, SPLIT_SECONDARY_KEYS);
+    state_sent = time;
+  }
+}
+#else
+// No UART for the link, so no other half to listen to or be
+void split_init() {
+  split_rx_reset(&rx);
+}
+
+void split_listen() {}
+void split_clock_changed() {}
+void split_task(uint32_t time) { (void) time; }
+void split_secondary_task() {}
+#endif
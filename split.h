@@ -0,0 +1,103 @@
+#ifndef SPLIT_H_
+#define SPLIT_H_
+
+#include "pico/stdlib.h"
+
+// Split boards: the half without USB (the secondary) scans and debounces its
+// own keys and sends the changes to the primary over a UART. On the primary,
+// a key whose pin is SPLIT_PIN_BASE + n is key n on the other half
+#define SPLIT_PIN_BASE 0x40
+#define SPLIT_MAX_KEYS 64
+
+// Crossed over between the halves; only secondary TX to primary RX is used.
+// There's no default: every pin a UART can go on is a key in the default map,
+// or the Pico's LED or VBUS sense, so the board has to say. Without them
+// we're never the secondary and remote keys never go down
+#ifdef SPLIT_UART
+  #if !defined(SPLIT_TX_PIN) || !defined(SPLIT_RX_PIN)
+    #error "SPLIT_UART needs SPLIT_TX_PIN and SPLIT_RX_PIN too"
+  #endif
+#elif defined(SPLIT_SECONDARY_PINS)
+  #error "a split board needs SPLIT_UART, SPLIT_TX_PIN and SPLIT_RX_PIN"
+#endif
+#define SPLIT_VBUS_PIN 24 // VBUS sense on a Pico, high on the half with USB
+#define SPLIT_BAUD 1000000 // a one-key change is 3 bytes, 30us on the wire
+
+// The secondary's key pins, by remote key index; none means this board
+// isn't split and we're always the primary
+#ifndef SPLIT_SECONDARY_PINS
+  #define SPLIT_SECONDARY_PINS { 0 }
+  #define SPLIT_SECONDARY_KEYS 0
+#endif
+
+#define SPLIT_STATE_MS 10   // the secondary sends its whole state this often
+#define SPLIT_TIMEOUT_MS 50 // and the primary lets go of its keys after this long without
+
+// A frame is a header byte, 1-8 payload bytes and a CRC-8 of the rest. The
+// header holds the frame type, a 3 bit sequence number and the payload
+// length less one. Deltas are a byte per key that changed - the index, with
+// the top bit set for a press - so they carry state rather than toggles and
+// a lost one only costs us until the next full state
+enum {
+  SPLIT_FRAME_DELTA = 1,
+  SPLIT_FRAME_STATE, // a bit per key
+};
+
+#define SPLIT_PAYLOAD_MAX 8
+#define SPLIT_FRAME_MAX (SPLIT_PAYLOAD_MAX + 2)
+#define SPLIT_KEY_DOWN 0x80
+
+// Reply to 'n'
+typedef struct {
+  uint32_t frames;     // good frames received
+  uint32_t crc_errors; // frames thrown away, and bytes skipped looking for the next
+  uint32_t seq_gaps;   // frames that came after a lost one
+  uint32_t repairs;    // full states that fixed a key we had wrong
+  uint32_t timeouts;   // times the link went quiet and we let go of everything
+  uint8_t link_up;
+  uint8_t secondary;   // this is the half without USB
+  uint8_t keys;        // keys covered by the last full state, a byte's worth at a time
+  uint8_t reserved;
+} SplitStats;
+
+typedef struct {
+  uint8_t seq;
+} SplitTx;
+
+typedef struct {
+  uint8_t frame[SPLIT_FRAME_MAX];
+  int length;
+  uint8_t seq;
+  bool synced;
+  uint8_t state[SPLIT_MAX_KEYS / 8];
+  SplitStats stats;
+} SplitRx;
+
+// The protocol alone, for both halves and for the host tools. Encoders
+// return the frame length; split_decode takes a byte at a time and returns
+// true when it completed a good frame
+uint8_t split_crc8(const uint8_t data[], int length);
+int split_encode_delta(SplitTx *tx, const uint8_t events[], int count, uint8_t out[]);
+int split_encode_state(SplitTx *tx, const uint8_t state[], int keys, uint8_t out[]);
+void split_rx_reset(SplitRx *rx);
+bool split_decode(SplitRx *rx, uint8_t byte);
+
+// The link: decides which half we are and sets up the UART on first use. The
+// secondary scans SPLIT_SECONDARY_PINS in place of its keymap, so keyboard_init
+// doesn't set up the keymap's pins there
+void split_init();
+bool split_secondary();
+void split_clock_changed();
+
+// Primary: the keymap starts us listening when it first uses a remote key.
+// From the scan, split_task takes in whatever has arrived, then
+// split_key_state gives the state of a key on the other half
+void split_listen();
+void split_task(uint32_t time);
+bool split_key_state(int index);
+void split_stats(SplitStats *stats);
+
+// Secondary, from the main loop in place of everything else
+void split_secondary_task();
+
+#endif /* SPLIT_H_ */
@@ -0,0 +1,270 @@
+/**
+ * Tap-hold keys. While a tap-hold key is down and undecided, edges from other
+ * keys are held back (so they land on the right side of the modifier) and it
+ * resolves as:
+ *  - tap, if it comes back up first
+ *  - hold, once it's been down for the term
+ *  - hold, as soon as another key goes down (TAPHOLD_HOLD_ON_OTHER)
+ *  - hold, as soon as another key goes down and up inside it (TAPHOLD_PERMISSIVE)
+ * after which the held-back edges are replayed in order.
+ */
+#include "taphold.h"
+#include "keyboard.h" // for KEYS, NO_KEY, NO_KEY_INDEX, SPECIAL_KEY_MOD, key_press, keyboard_*_event
+#include "tusb.h" // for HID_KEY_NONE
+#include "hotpath.h" // for HOT_PATH
+
+#include <string.h> // for memset, memcpy
+
+#define TAPHOLD_BUFFER 8
+
+typedef struct {
+  uint8_t key;
+  uint8_t hold_code;
+  uint8_t mode;
+} TapHold;
+
+typedef struct {
+  uint8_t key;
+  bool down;
+} HeldEvent;
+
+TapHold tapholds[TAPHOLD_MAX];
+int taphold_count = 0;
+uint32_t taphold_term_us = TAPHOLD_DEFAULT_TERM_MS * 1000;
+
+uint8_t key_taphold[KEYS]; // entry for each key, NO_KEY if it's a normal key
+bool holding[TAPHOLD_MAX];
+int layer_holds = 0;
+
+int undecided = NO_KEY_INDEX;
+uint32_t undecided_time = 0;
+
+HeldEvent held[TAPHOLD_BUFFER];
+int held_count = 0;
+
+bool HOT_PATH(taphold_layer)() {
+  return layer_holds > 0;
+}
+
+// Edges that were waiting on the decision go out in order. A key that went
+// down and up while we waited has its release deferred, or the OS would
+// never see the press
+static void HOT_PATH(taphold_replay)() {
+  HeldEvent replay[TAPHOLD_BUFFER];
+  int count = held_count;
+  memcpy(replay, held, sizeof(held));
+  held_count = 0;
+
+  for (int i = 0; i < count; i++) {
+    bool pressed_here = false;
+    for (int j = 0; j < i; j++) {
+      if (replay[j].key == replay[i].key && replay[j].down)
+        pressed_here = true;
+    }
+
+    if (!replay[i].down && pressed_here)
+      keyboard_defer_event(replay[i].key, false);
+    else
+      keyboard_key_event(replay[i].key, replay[i].down);
+  }
+}
+
+static void HOT_PATH(taphold_hold)() {
+  TapHold *entry = &tapholds[key_taphold[undecided]];
+  holding[key_taphold[undecided]] = true;
+  undecided = NO_KEY_INDEX;
+
+  if (entry->hold_code == SPECIAL_KEY_MOD)
+    layer_holds++;
+  else
+    key_press(entry->hold_code);
+
+  taphold_replay();
+}
+
+static void HOT_PATH(taphold_tap)() {
+  int key = undecided;
+  undecided = NO_KEY_INDEX;
+
+  keyboard_activate_event(key, true);
+  keyboard_defer_event(key, false);
+  taphold_replay();
+}
+
+static bool HOT_PATH(taphold_buffered_press)(uint8_t key) {
+  for (int i = 0; i < held_count; i++) {
+    if (held[i].key == key && held[i].down)
+      return true;
+  }
+  return false;
+}
+
+bool HOT_PATH(taphold_event)(uint8_t key, bool down, uint32_t time) {
+  if (!KEY_IN_RANGE(key))
+    return true;
+
+  if (undecided != NO_KEY_INDEX) {
+    uint8_t mode = tapholds[key_taphold[undecided]].mode;
+
+    if (key == undecided) {
+      if (!down)
+        taphold_tap();
+      return false;
+    }
+
+    if (down && mode == TAPHOLD_HOLD_ON_OTHER) {
+      // Decided - this key carries on below with the hold already applied
+      taphold_hold();
+    } else if (!down && mode == TAPHOLD_PERMISSIVE && taphold_buffered_press(key)) {
+      taphold_hold();
+      keyboard_defer_event(key, false);
+      return false;
+    } else if (!down && !taphold_buffered_press(key)) {
+      return true; // was down before we started waiting, nothing to order
+    } else if (held_count < TAPHOLD_BUFFER) {
+      held[held_count++] = (HeldEvent) { key, down };
+      return false;
+    } else {
+      // No room to wait any longer, and that many other edges inside the term
+      // makes it a hold. This edge then goes out after the buffered ones, a
+      // report later if it's the release of one of their presses
+      taphold_hold();
+      if (!down) {
+        keyboard_defer_event(key, false);
+        return false;
+      }
+    }
+  }
+
+  uint8_t entry = key_taphold[key];
+  if (entry == NO_KEY)
+    return true;
+
+  if (down) {
+    undecided = key;
+    undecided_time = time;
+    return false;
+  }
+
+  if (!holding[entry])
+    return true; // the deferred release of a tap
+
+  holding[entry] = false;
+  if (tapholds[entry].hold_code == SPECIAL_KEY_MOD)
+    layer_holds--;
+  else
+    key_release(tapholds[entry].hold_code);
+  return false;
+}
+
+bool HOT_PATH(taphold_update)(uint32_t time) {
+  if (undecided == NO_KEY_INDEX || time - undecided_time < taphold_term_us)
+    return false;
+
+  taphold_hold();
+  return true;
+}
+
+int taphold_config_read(uint8_t config[], int len) {
+  if (len < TAPHOLD_CONFIG_SIZE)
+    return 0;
+
+  memset(config, 0, TAPHOLD_CONFIG_SIZE);
+  config[0] = taphold_term_us / 1000;
+  config[1] = taphold_count;
+  for (int i = 0; i < taphold_count; i++) {
+    config[2 + i * TAPHOLD_ENTRY_SIZE + 0] = tapholds[i].key;
+    config[2 + i * TAPHOLD_ENTRY_SIZE + 1] = tapholds[i].hold_code;
+    config[2 + i * TAPHOLD_ENTRY_SIZE + 2] = tapholds[i].mode;
+  }
+
+  return TAPHOLD_CONFIG_SIZE;
+}
+
+bool taphold_config_set(uint8_t config[], int len) {
+  bool changed = taphold_config_reset();
+  if (len < 2)
+    return changed;
+
+  // Erased flash reads as 0xff, which also lands here
+  int count = config[1];
+  if (count > TAPHOLD_MAX || 2 + count * TAPHOLD_ENTRY_SIZE > len)
+    return changed;
+
+  if (config[0] != 0)
+    taphold_term_us = config[0] * 1000;
+
+  for (int i = 0; i < count; i++) {
+    uint8_t key = config[2 + i * TAPHOLD_ENTRY_SIZE + 0];
+    uint8_t hold_code = config[2 + i * TAPHOLD_ENTRY_SIZE + 1];
+    uint8_t mode = config[2 + i * TAPHOLD_ENTRY_SIZE + 2];
+
+    if (!KEY_IN_RANGE(key) || key_taphold[key] != NO_KEY || hold_code == HID_KEY_NONE || mode >= TAPHOLD_MODES)
+      continue;
+
+    tapholds[taphold_count] = (TapHold) { key, hold_code, mode };
+    key_taphold[key] = taphold_count;
+    taphold_count++;
+  }
+  return changed;
+}
+
+static struct {
+  bool holding[TAPHOLD_MAX];
+  int layer_holds;
+  int undecided;
+  uint32_t undecided_time;
+  HeldEvent held[TAPHOLD_BUFFER];
+  int held_count;
+} saved;
+
+void taphold_state_save() {
+  memcpy(saved.holding, holding, sizeof(holding));
+  saved.layer_holds = layer_holds;
+  saved.undecided = undecided;
+  saved.undecided_time = undecided_time;
+  memcpy(saved.held, held, sizeof(held));
+  saved.held_count = held_count;
+}
+
+void taphold_state_restore() {
+  memcpy(holding, saved.holding, sizeof(holding));
+  layer_holds = saved.layer_holds;
+  undecided = saved.undecided;
+  undecided_time = saved.undecided_time;
+  memcpy(held, saved.held, sizeof(held));
+  held_count = saved.held_count;
+}
+
+bool taphold_config_reset() {
+  bool changed = false;
+
+  // Let go of anything the old config had down
+  for (int i = 0; i < taphold_count; i++) {
+    if (holding[i] && tapholds[i].hold_code != SPECIAL_KEY_MOD) {
+      key_release(tapholds[i].hold_code);
+      changed = true;
+    }
+    holding[i] = false;
+  }
+
+  int key = undecided;
+  undecided = NO_KEY_INDEX;
+  layer_holds = 0;
+  taphold_count = 0;
+  taphold_term_us = TAPHOLD_DEFAULT_TERM_MS * 1000;
+  memset(key_taphold, NO_KEY, sizeof(key_taphold));
+
+  // and what it was waiting on goes out as plain keys: the undecided one's
+  // press, then the edges held back behind it. Its release comes later, past
+  // a config that no longer knows it
+  if (key != NO_KEY_INDEX) {
+    keyboard_activate_event(key, true);
+    changed = true;
+  }
+  if (held_count > 0) {
+    taphold_replay();
+    changed = true;
+  }
+  return changed;
+}
@@ -0,0 +1,45 @@
+#ifndef TAPHOLD_H_
+#define TAPHOLD_H_
+
+#include "pico/stdlib.h"
+
+// Tap-hold (mod-tap) keys - a tap sends the key's normal code, holding it
+// acts as a modifier or, with SPECIAL_KEY_MOD, the alt layer
+#define TAPHOLD_MAX 8
+#define TAPHOLD_DEFAULT_TERM_MS 200
+
+enum {
+  TAPHOLD_TERM = 0,       // hold only once the term runs out
+  TAPHOLD_PERMISSIVE,     // also hold if another key is tapped inside it
+  TAPHOLD_HOLD_ON_OTHER,  // also hold as soon as another key goes down
+  TAPHOLD_MODES
+};
+
+// Config is the term in ms and the entry count, then per entry the key, its
+// hold code and its mode
+#define TAPHOLD_ENTRY_SIZE 3
+#define TAPHOLD_CONFIG_SIZE (2 + TAPHOLD_MAX * TAPHOLD_ENTRY_SIZE)
+
+// Called with each key edge after combos. Returns true if the caller should
+// handle the edge as normal, false if it's been taken
+bool taphold_event(uint8_t key, bool down, uint32_t time);
+
+// Called every scan; turns a key held past the term into a hold. Returns true
+// if the report changed
+bool taphold_update(uint32_t time);
+
+// True while a tap-hold key is being held as the alt layer
+bool taphold_layer();
+
+// Setting or resetting lets go of what the old config had down, and sends
+// what it was holding back; true if that changed the report
+int taphold_config_read(uint8_t config[], int len);
+bool taphold_config_set(uint8_t config[], int len);
+bool taphold_config_reset();
+
+// For keyboard_benchmark, which pushes made-up edges through here: a copy of
+// what's pressed and pending, put back when it's done
+void taphold_state_save();
+void taphold_state_restore();
+
+#endif /* TAPHOLD_H_ */
@@ -0,0 +1,36 @@
+/**
+ * Clock sync. The host pings with 'y', stamping its clock either side, and
+ * we stamp ours when the ping is read and when the reply goes in the FIFO.
+ * NTP style, the pairs with the shortest round trip give the offset between
+ * the clocks, and a fit over a few seconds of them gives the drift.
+ *
+ * Frames are a clock we share with the host: every reply carries the last
+ * start of frame and when we saw it, so a host that can timestamp frames
+ * (usbmon, a bus analyser) can place us to within the loop's polling time
+ * instead of the round trip. There's no SOF interrupt to hang this on
+ * without taking the USB IRQ from TinyUSB, so it's polled.
+ */
+#include "timesync.h"
+
+#include "hardware/structs/usb.h"
+
+static uint16_t sof_frame = 0;
+static uint64_t sof_us = 0;
+
+void timesync_task() {
+  uint16_t frame = usb_hw->sof_rd & USB_SOF_RD_BITS;
+  if (frame == sof_frame)
+    return;
+
+  sof_frame = frame;
+  sof_us = time_us_64();
+}
+
+void timesync_reply(SyncReply *reply, uint32_t tag, uint64_t rx_us) {
+  reply->rx_us = rx_us;
+  reply->sof_us = sof_us;
+  reply->tag = tag;
+  reply->sof_frame = sof_frame;
+  reply->reserved = 0;
+  reply->tx_us = time_us_64();
+}
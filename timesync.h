@@ -0,0 +1,21 @@
+#ifndef TIMESYNC_H_
+#define TIMESYNC_H_
+
+#include "pico/stdlib.h"
+
+// Reply to a 'y' ping, for the host to line our time_us_64() up with its
+// own clock. Device times are us since reset
+typedef struct {
+  uint64_t rx_us;     // when we read the ping
+  uint64_t tx_us;     // when the reply was queued
+  uint64_t sof_us;    // when we saw the latest USB start of frame
+  uint32_t tag;       // echoed from the ping, to pair it with its reply
+  uint16_t sof_frame; // that frame's 11 bit number, as the host counts them
+  uint16_t reserved;
+} SyncReply;
+
+// Called every pass of the main loop, to notice frame number changes
+void timesync_task();
+void timesync_reply(SyncReply *reply, uint32_t tag, uint64_t rx_us);
+
+#endif /* TIMESYNC_H_ */
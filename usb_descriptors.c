@@ -77,10 +77,36 @@ uint8_t const * tud_descriptor_device_cb(void)
 // HID Report Descriptor
 //--------------------------------------------------------------------+
 
-uint8_t const desc_hid_report[] =
+// Without a report ID so it's the same as the boot protocol report, and
+// works in a BIOS
+uint8_t const desc_hid_report_keyboard[] =
 {
-  TUD_HID_REPORT_DESC_KEYBOARD( HID_REPORT_ID(REPORT_ID_KEYBOARD)),
-  TUD_HID_REPORT_DESC_CONSUMER( HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL )) // for media keys
+  TUD_HID_REPORT_DESC_KEYBOARD()
+};
+
+// A bit per usage from 0 to the modifiers, 29 bytes; the host merges it
+// with the keyboard above like any two keyboards plugged in at once
+uint8_t const desc_hid_report_nkro[] =
+{
+  HID_USAGE_PAGE   ( HID_USAGE_PAGE_DESKTOP     ),
+  HID_USAGE        ( HID_USAGE_DESKTOP_KEYBOARD ),
+  HID_COLLECTION   ( HID_COLLECTION_APPLICATION ),
+    HID_USAGE_PAGE   ( HID_USAGE_PAGE_KEYBOARD ),
+    HID_USAGE_MIN    ( 0                      ),
+    HID_USAGE_MAX    ( KEYBOARD_NKRO_KEYS - 1 ),
+    HID_LOGICAL_MIN  ( 0                      ),
+    HID_LOGICAL_MAX  ( 1                      ),
+    HID_REPORT_COUNT ( KEYBOARD_NKRO_KEYS     ),
+    HID_REPORT_SIZE  ( 1                      ),
+    HID_INPUT        ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ),
+  HID_COLLECTION_END
+};
+
+uint8_t const desc_hid_report_consumer[] =
+{
+  TUD_HID_REPORT_DESC_CONSUMER( HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL )), // for media keys
+  TUD_HID_REPORT_DESC_MOUSE   ( HID_REPORT_ID(REPORT_ID_MOUSE )), // for mouse keys
+  TUD_HID_REPORT_DESC_GAMEPAD ( HID_REPORT_ID(REPORT_ID_GAMEPAD )) // for keys bound to the gamepad
 };
 
 // Invoked when received GET HID REPORT DESCRIPTOR
@@ -88,24 +114,39 @@ uint8_t const desc_hid_report[] =
 // Descriptor contents must exist long enough for transfer to complete
 uint8_t const * tud_hid_descriptor_report_cb(uint8_t instance)
 {
-  (void) instance;
-  return desc_hid_report;
+  if (instance == HID_ITF_NKRO)
+    return desc_hid_report_nkro;
+  if (instance == HID_ITF_CONSUMER)
+    return desc_hid_report_consumer;
+  return desc_hid_report_keyboard;
 }
 
 //--------------------------------------------------------------------+
 // Configuration Descriptor
 //--------------------------------------------------------------------+
 
+// The HID interfaces come first, in HID_ITF_ order, since that's how
+// TinyUSB numbers its instances
 enum
 {
-  ITF_NUM_HID = 0,
+  ITF_NUM_HID_KEYBOARD = 0,
+  ITF_NUM_HID_NKRO,
+  ITF_NUM_HID_CONSUMER,
   ITF_NUM_VENDOR,
   ITF_NUM_TOTAL
 };
 
-#define CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN + TUD_VENDOR_DESC_LEN)
+#define CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + HID_ITF_COUNT * TUD_HID_DESC_LEN + TUD_VENDOR_DESC_LEN)
 
-#define EPNUM_HID     0x81
+#define EPNUM_HID_KEYBOARD 0x81
+#define EPNUM_HID_NKRO     0x82
+#define EPNUM_HID_CONSUMER 0x83
+
+// In frames at full speed and microframes at high speed, so 1 is every 1ms
+// or 125us. Full speed is all the RP2040 has, and 1ms is as often as a full
+// speed interrupt endpoint can be polled - which is why each report type
+// gets an endpoint of its own
+#define HID_POLL_INTERVAL 1
 
 #if CFG_TUSB_MCU == OPT_MCU_LPC175X_6X || CFG_TUSB_MCU == OPT_MCU_LPC177X_8X || CFG_TUSB_MCU == OPT_MCU_LPC40XX
   // LPC 17xx and 40xx endpoint type (bulk/interrupt/iso) are fixed by its number
@@ -124,8 +165,8 @@ enum
 #else
   #define EPNUM_CDC_IN     2
   #define EPNUM_CDC_OUT    2
-  #define EPNUM_VENDOR_IN  3
-  #define EPNUM_VENDOR_OUT 3
+  #define EPNUM_VENDOR_IN  4
+  #define EPNUM_VENDOR_OUT 4
 #endif
 
 /* THE ORDERING HERE HAS TO MATCH ITF_NUM ORDERING */
@@ -135,8 +176,9 @@ uint8_t const desc_configuration[] =
   TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0x00, 100),
 
   // Interface number, string index, protocol, report descriptor len, EP In address, size & polling interval
-  // (Glen): We modified the default from 5 to 0.125ms to try to get to a 8000hz polling rate
-  TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, TUD_OPT_HIGH_SPEED ? KEYBOARD_SCAN_RATE_US / 1000.0f : 1),
+  TUD_HID_DESCRIPTOR(ITF_NUM_HID_KEYBOARD, 0, HID_ITF_PROTOCOL_KEYBOARD, sizeof(desc_hid_report_keyboard), EPNUM_HID_KEYBOARD, CFG_TUD_HID_EP_BUFSIZE, HID_POLL_INTERVAL),
+  TUD_HID_DESCRIPTOR(ITF_NUM_HID_NKRO, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report_nkro), EPNUM_HID_NKRO, CFG_TUD_HID_EP_BUFSIZE, HID_POLL_INTERVAL),
+  TUD_HID_DESCRIPTOR(ITF_NUM_HID_CONSUMER, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report_consumer), EPNUM_HID_CONSUMER, CFG_TUD_HID_EP_BUFSIZE, HID_POLL_INTERVAL),
 
   // Interface number, string index, EP Out & IN address, EP size
   TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR, 0, EPNUM_VENDOR_OUT, 0x80 | EPNUM_VENDOR_IN, TUD_OPT_HIGH_SPEED ? 512 : 64),
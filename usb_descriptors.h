@@ -27,6 +27,18 @@
 
 extern uint8_t const desc_ms_os_20[];
 
+// HID instances, in the order their interfaces appear in the configuration.
+// Each has its own interrupt IN endpoint, so one of each can go in a frame
+enum
+{
+  HID_ITF_KEYBOARD = 0, // boot keyboard, no report ID
+  HID_ITF_NKRO,         // keys that didn't fit in the keyboard report, no report ID
+  HID_ITF_CONSUMER,     // media keys, plus the mouse and gamepad
+  HID_ITF_COUNT
+};
+
+// Report IDs on the consumer interface; the keyboard's is only used to tag
+// recorder events
 enum
 {
   REPORT_ID_KEYBOARD = 1,
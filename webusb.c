@@ -0,0 +1,362 @@
+/**
+ * The vendor (WebUSB) protocol. Every message is framed as a length byte,
+ * which counts the two header bytes, then a type byte and the payload.
+ * Commands from the host are a type letter and arguments in one transfer:
+ *   'c' read the keymap        's' set the keymap       'd' reset to defaults
+ *   'o' SOCD pairs             'm' combos               'h' tap-hold keys
+ *   'p' profiles               'b' debounce benchmark   'k' scan benchmark
+ *   'f' flight recorder dump   't' boot trace
+ *   'w' arm the pin capture    'g' get the pin capture  'y' clock sync ping
+ *   'q' send queue stats       'u' suspend wake timings 'z' clock residency
+ *   'a' per-key switch health  'n' split link stats     'l' drain the log
+ *   'v' analog key thresholds
+ * and each gets a reply of the same type; 'a', 'b', 'f', 'g' and 'l' stream theirs
+ * over several messages, ending with an empty one. 'r' messages go out
+ * unprompted with the raw key state, and 'e' with a key's health the first
+ * time it's flagged as failing.
+ *
+ * Only the tud_vendor_ calls touch TinyUSB, so the host tools can run this
+ * in-process against a simulated endpoint (see host/).
+ */
+#include "webusb.h"
+
+#include <string.h>
+
+#include "tusb.h"
+
+#include "keyboard.h"
+#include "socd.h"
+#include "combo.h"
+#include "taphold.h"
+#include "analog.h"
+#include "bench.h"
+#include "recorder.h"
+#include "capture.h"
+#include "timesync.h"
+#include "power.h"
+#include "governor.h"
+#include "chatter.h"
+#include "split.h"
+#include "log.h"
+#include "boot.h"
+
+static bool web_serial_connected = false;
+
+// Messages are queued here and fed to the endpoint as it has room, so
+// nothing waits on the host and nothing goes out half written. The IN side
+// is a byte stream: messages pack back to back into packets and can span
+// them, and the host cuts them apart by their length byte
+static uint8_t tx_ring[WEBUSB_TX_RING];
+static uint32_t tx_head = 0; // next byte to go to the endpoint
+static uint32_t tx_tail = 0; // next free byte; both run freely and wrap
+static WebusbStats tx_stats;
+
+void webserial_connect(bool connected) {
+  web_serial_connected = connected;
+
+  // Anything queued was for the last session
+  tx_head = tx_tail = 0;
+}
+
+bool webserial_connected() {
+  return web_serial_connected;
+}
+
+static uint32_t webusb_tx_free() {
+  return WEBUSB_TX_RING - (tx_tail - tx_head);
+}
+
+// Payload bytes that can be queued right now, up to a message's worth
+uint32_t webusb_tx_space() {
+  uint32_t space = webusb_tx_free();
+  if (space < 2)
+    return 0;
+  return space - 2 < WEBUSB_MAX_DATA ? space - 2 : WEBUSB_MAX_DATA;
+}
+
+// Hands the endpoint as much of the ring as it'll take
+void webusb_tx_task() {
+  uint32_t written = 0;
+
+  while (tx_tail != tx_head) {
+    uint32_t start = tx_head % WEBUSB_TX_RING;
+    uint32_t len = tx_tail - tx_head;
+    if (len > WEBUSB_TX_RING - start)
+      len = WEBUSB_TX_RING - start; // up to the wrap, the rest next time round
+
+    uint32_t available = tud_vendor_write_available();
+    if (len > available)
+      len = available;
+    if (len == 0)
+      break;
+
+    len = tud_vendor_write(tx_ring + start, len);
+    tx_head += len;
+    written += len;
+  }
+
+  if (written > 0)
+    tud_vendor_flush();
+}
+
+// Queues the whole message or, if the ring is full, none of it
+bool send_webusb_message(char type, uint8_t * data, uint8_t data_size) {
+  if (!web_serial_connected)
+    return false;
+
+  uint32_t size = data_size + 2;
+  if (data_size > WEBUSB_MAX_DATA || size > webusb_tx_free()) {
+    tx_stats.dropped++;
+    LOG(LOG_WEBUSB_DROPPED, type, data_size);
+    return false;
+  }
+
+  uint8_t header[2] = { size, type };
+  for (uint32_t i = 0; i < size; i++)
+    tx_ring[(tx_tail + i) % WEBUSB_TX_RING] = i < 2 ? header[i] : data[i - 2];
+  tx_tail += size;
+
+  tx_stats.sent++;
+  if (tx_tail - tx_head > tx_stats.high_water)
+    tx_stats.high_water = tx_tail - tx_head;
+
+  // Straight to the endpoint if there's room, so a report isn't held up
+  // until the next webserial_task
+  webusb_tx_task();
+  return true;
+}
+
+void send_webusb_report() {
+  if (!web_serial_connected)
+    return;
+  
+  uint8_t * report = get_raw_report(); // need to replace this with a pins-down map
+
+  send_webusb_message('r', report, KEYS < WEBUSB_MAX_DATA ? KEYS : WEBUSB_MAX_DATA);
+}
+
+void send_webusb_keyboard_config() {
+  uint8_t data[KEYS * KEY_CONFIG_SIZE];
+  uint8_t size = keyboard_config_read(data, WEBUSB_MAX_DATA);
+  send_webusb_message('c', data, size);
+}
+
+void send_webusb_socd_config() {
+  uint8_t data[SOCD_CONFIG_SIZE];
+  uint8_t size = socd_config_read(data, sizeof(data));
+  send_webusb_message('o', data, size);
+}
+
+void send_webusb_combo_config() {
+  uint8_t data[COMBO_CONFIG_SIZE];
+  uint8_t size = combo_config_read(data, sizeof(data));
+  send_webusb_message('m', data, size);
+}
+
+void send_webusb_profile() {
+  uint8_t data[2] = { keyboard_profile(), keyboard_profiles_saved() };
+  send_webusb_message('p', data, sizeof(data));
+}
+
+void send_webusb_taphold_config() {
+  uint8_t data[TAPHOLD_CONFIG_SIZE];
+  uint8_t size = taphold_config_read(data, sizeof(data));
+  send_webusb_message('h', data, size);
+}
+
+void send_webusb_analog_config() {
+  uint8_t data[ANALOG_CONFIG_SIZE];
+  uint8_t size = analog_config_read(data, sizeof(data));
+  send_webusb_message('v', data, size);
+}
+
+void webserial_task(void)
+{
+  timesync_task();
+
+  if (!web_serial_connected)
+    return;
+
+  webusb_tx_task();
+
+  // Streaming keeps the clock up, the same as typing does
+  if (tx_tail != tx_head || bench_debounce_running() || recorder_dump_running() || capture_dump_running() ||
+      chatter_dump_running() || log_drain_running())
+    governor_activity();
+
+  // Benchmark results go out one at a time, as there's room in the ring, and
+  // an empty message ends them. Each step stalls the scan, so a key going
+  // down cuts the run short
+  if (bench_debounce_running() && webusb_tx_space() >= sizeof(BenchResult)) {
+    if (keyboard_keys_down())
+      bench_debounce_stop();
+    BenchResult *result = bench_debounce_step();
+    send_webusb_message('b', (uint8_t *) result, result ? sizeof(BenchResult) : 0);
+  }
+
+  // Same for the flight recorder, as many records as fit in a message; an
+  // empty message marks the end of the dump
+  if (recorder_dump_running() && webusb_tx_space() >= sizeof(Record)) {
+    Record chunk[WEBUSB_MAX_DATA / sizeof(Record)];
+    int count = recorder_dump_read(chunk, webusb_tx_space() / sizeof(Record));
+    send_webusb_message('f', (uint8_t *) chunk, count * sizeof(Record));
+  }
+
+  // And the pin capture, as runs
+  if (capture_dump_running() && webusb_tx_space() >= sizeof(CaptureRun)) {
+    CaptureRun chunk[WEBUSB_MAX_DATA / sizeof(CaptureRun)];
+    int count = capture_dump_read(chunk, webusb_tx_space() / sizeof(CaptureRun));
+    send_webusb_message('g', (uint8_t *) chunk, count * sizeof(CaptureRun));
+  }
+
+  // And the switch health, a key per record
+  if (chatter_dump_running() && webusb_tx_space() >= sizeof(ChatterStats)) {
+    ChatterStats chunk[WEBUSB_MAX_DATA / sizeof(ChatterStats)];
+    int count = chatter_dump_read(chunk, webusb_tx_space() / sizeof(ChatterStats));
+    send_webusb_message('a', (uint8_t *) chunk, count * sizeof(ChatterStats));
+  }
+
+  // And the log, which is formatted on the host
+  if (log_drain_running() && webusb_tx_space() >= sizeof(LogEntry)) {
+    LogEntry chunk[WEBUSB_MAX_DATA / sizeof(LogEntry)];
+    int count = log_drain_read(chunk, webusb_tx_space() / sizeof(LogEntry));
+    send_webusb_message('l', (uint8_t *) chunk, count * sizeof(LogEntry));
+  }
+
+  // A switch that's started chattering; held until there's room so the
+  // flag isn't lost to a full queue
+  static int failing = -1;
+  if (failing == -1)
+    failing = chatter_failing_key();
+  if (failing != -1 && webusb_tx_space() >= sizeof(ChatterStats)) {
+    ChatterStats stats;
+    chatter_stats(failing, &stats);
+    send_webusb_message('e', (uint8_t *) &stats, sizeof(stats));
+    failing = -1;
+  }
+
+  uint8_t buf[128]; // need to check this
+  uint32_t count = tud_vendor_read(buf, sizeof(buf));
+  uint64_t read_us = time_us_64();
+
+  if (count == 0)
+    return;
+
+  if(buf[0] == 'c') {
+    // Read the config and send
+    send_webusb_keyboard_config();
+  } else if (buf[0] == 's') {
+    // Set the keymap
+    keyboard_config_set(buf + 1, count - 1);
+    keyboard_config_flash_save();
+    send_webusb_keyboard_config();
+  } else if (buf[0] == 'd') {
+    keyboard_config_reset();
+    send_webusb_keyboard_config();
+  } else if (buf[0] == 'o') {
+    // Read, or set if we were sent pairs, the opposing key resolution
+    if (count > 1) {
+      keyboard_config_changed(socd_config_set(buf + 1, count - 1));
+      keyboard_config_flash_save();
+    }
+    send_webusb_socd_config();
+  } else if (buf[0] == 'm') {
+    // Read, or set if we were sent them, the combos
+    if (count > 1) {
+      keyboard_config_changed(combo_config_set(buf + 1, count - 1));
+      keyboard_config_flash_save();
+    }
+    send_webusb_combo_config();
+  } else if (buf[0] == 'h') {
+    // Read, or set if we were sent them, the tap-hold keys
+    if (count > 1) {
+      keyboard_config_changed(taphold_config_set(buf + 1, count - 1));
+      keyboard_config_flash_save();
+    }
+    send_webusb_taphold_config();
+  } else if (buf[0] == 'v') {
+    // Read, or set if we were sent them, the analog keys' actuation, release
+    // and rapid trigger points
+    if (count > 1) {
+      analog_config_set(buf + 1, count - 1);
+      keyboard_config_flash_save();
+    }
+    send_webusb_analog_config();
+  } else if (buf[0] == 'p') {
+    // Read, or switch if we were sent one, the active profile; a second byte
+    // of 1 makes the switch stick across restarts. Replies with the active
+    // profile and a bitmask of the ones that have been saved
+    if (count > 1)
+      keyboard_profile_select(buf[1], count > 2 && buf[2]);
+    send_webusb_profile();
+  } else if (buf[0] == 'b') {
+    // Run the debounce benchmark, results are streamed back as 'b' messages.
+    // With keys in use it's refused, which is just the empty end message
+    if (keyboard_keys_down())
+      send_webusb_message('b', NULL, 0);
+    else
+      bench_debounce_start();
+  } else if (buf[0] == 'k') {
+    // Time the scan and report paths at this build's key count; an empty
+    // reply if keys were in use
+    ScanBench result;
+    if (keyboard_benchmark(&result))
+      send_webusb_message('k', (uint8_t *) &result, sizeof(result));
+    else
+      send_webusb_message('k', NULL, 0);
+  } else if (buf[0] == 'f') {
+    // Dump the flight recorder, streamed back as 'f' messages
+    recorder_dump_start();
+  } else if (buf[0] == 'w') {
+    // Arm the pin capture if we were sent a key, with optional edge (see
+    // CAPTURE_EDGE_) and rate in kHz (16 bit, little endian); replies with
+    // its status either way
+    if (count > 1) {
+      uint8_t edge = count > 2 ? buf[2] : CAPTURE_EDGE_ANY;
+      uint32_t rate_khz = count > 4 ? buf[3] | buf[4] << 8 : CAPTURE_DEFAULT_KHZ;
+      capture_arm(buf[1], edge, rate_khz);
+    }
+    CaptureStatus status;
+    capture_status(&status);
+    send_webusb_message('w', (uint8_t *) &status, sizeof(status));
+  } else if (buf[0] == 'g') {
+    // Dump a finished capture, streamed back as 'g' messages
+    capture_dump_start();
+  } else if (buf[0] == 'y') {
+    // Clock sync, echoing the host's 32 bit tag (little endian) with our
+    // timestamps; stamped as late as we can so the reply is what gets timed
+    uint32_t tag = 0;
+    if (count > 4)
+      memcpy(&tag, buf + 1, sizeof(tag));
+    SyncReply reply;
+    timesync_reply(&reply, tag, read_us);
+    send_webusb_message('y', (uint8_t *) &reply, sizeof(reply));
+  } else if (buf[0] == 'q') {
+    // How the send queue is doing
+    WebusbStats stats = tx_stats;
+    stats.queued = tx_tail - tx_head;
+    send_webusb_message('q', (uint8_t *) &stats, sizeof(stats));
+  } else if (buf[0] == 'u') {
+    // How long the last wake from suspend took to get its key to the host
+    send_webusb_message('u', (uint8_t *) power_wake_stats(), sizeof(WakeStats));
+  } else if (buf[0] == 'z') {
+    // Clock levels and the time spent at each
+    GovernorStats stats;
+    governor_stats(&stats);
+    send_webusb_message('z', (uint8_t *) &stats, sizeof(stats));
+  } else if (buf[0] == 'n') {
+    // Frames from the other half of a split board, and what went wrong
+    SplitStats stats;
+    split_stats(&stats);
+    send_webusb_message('n', (uint8_t *) &stats, sizeof(stats));
+  } else if (buf[0] == 'l') {
+    // Everything logged since the last drain, streamed back as 'l' messages
+    log_drain_start();
+  } else if (buf[0] == 'a') {
+    // Bounce counts and learned windows, streamed back as 'a' messages
+    chatter_dump_start();
+  } else if (buf[0] == 't') {
+    // Boot trace, us since reset for each BOOT_ stage
+    send_webusb_message('t', (uint8_t *) boot_trace(), BOOT_STAGES * sizeof(uint32_t));
+  }
+}
\ No newline at end of file
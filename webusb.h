@@ -0,0 +1,30 @@
+#ifndef WEBUSB_H_
+#define WEBUSB_H_
+
+#include "pico/stdlib.h"
+
+#define WEBUSB_MAX_DATA 253 // messages carry their length in a byte, including the header
+#define WEBUSB_TX_RING 2048 // send queue, a power of two
+
+// Reply to 'q'
+typedef struct {
+  uint32_t sent;       // messages queued since boot
+  uint32_t dropped;    // messages thrown away because the queue was full
+  uint32_t high_water; // most bytes ever waiting
+  uint32_t queued;     // bytes waiting now
+} WebusbStats;
+
+// Set from the CDC-style line state request the WebUSB page sends
+void webserial_connect(bool connected);
+bool webserial_connected();
+
+void webserial_task(void);
+
+// Queues a message, returning false if it was dropped; webusb_tx_space is
+// the largest payload that would go in now
+bool send_webusb_message(char type, uint8_t * data, uint8_t data_size);
+uint32_t webusb_tx_space();
+void webusb_tx_task();
+void send_webusb_report();
+
+#endif /* WEBUSB_H_ */